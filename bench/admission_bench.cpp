@@ -0,0 +1,287 @@
+///
+/// 冷启动时同时打开大量房间：不加控制地全部同时握手，对比经过 admission_controller 准入。
+/// 本机的测试服务器在一个线程上接受连接，每个连接先等待 delay 模拟网络往返，再完成 TLS 握手并回复 1 字节，
+/// 监听队列长度为 backlog，模拟对端有限的握手能力。客户端的 TLS 握手与服务器在同一台机器上竞争 CPU。
+/// 一次尝试超过 timeout 未完成算失败：不加控制时立即重新打开（原先由 supervisor 立即重新分配），
+/// 经过准入时调用 on_failed，按退避重新排队。
+/// 输出每个房间从请求打开到连接成功的耗时、最后一次握手本身的耗时（p50/p90/p99）、总耗时和失败次数。
+///
+/// 用法：admission_bench [房间数=1000] [delay ms=20] [backlog=128] [timeout ms=5000]
+#include "admission_controller.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vNerve::bilibili;
+namespace ssl = boost::asio::ssl;
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+///
+/// 自签名证书，只用于本机测试服务器
+void use_self_signed_certificate(ssl::context& context)
+{
+    auto key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_keygen_init(key_context);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(key_context, &key);
+    EVP_PKEY_CTX_free(key_context);
+
+    auto certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_set_pubkey(certificate, key);
+    auto name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_sign(certificate, key, EVP_sha256());
+
+    SSL_CTX_use_certificate(context.native_handle(), certificate);
+    SSL_CTX_use_PrivateKey(context.native_handle(), key);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+///
+/// 测试服务器：接受连接，等待 delay，TLS 握手，回复 1 字节后保持连接直到停止。
+class handshake_server
+{
+    boost::asio::io_context _context;
+    ssl::context _tls{ssl::context::tls_server};
+    tcp::acceptor _acceptor;
+    std::chrono::milliseconds _delay;
+    std::vector<std::shared_ptr<ssl::stream<tcp::socket>>> _established;
+    std::thread _thread;
+
+    void accept()
+    {
+        _acceptor.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec)
+                return;
+            auto stream = std::make_shared<ssl::stream<tcp::socket>>(std::move(socket), _tls);
+            auto timer = std::make_shared<boost::asio::steady_timer>(_context, _delay);
+            timer->async_wait([this, stream, timer](const boost::system::error_code&) {
+                stream->async_handshake(ssl::stream_base::server, [this, stream](const boost::system::error_code& ec) {
+                    if (ec)
+                        return;
+                    static const char reply = 1;
+                    boost::asio::async_write(*stream, boost::asio::buffer(&reply, 1), [this, stream](const boost::system::error_code& ec, size_t) {
+                        if (!ec)
+                            _established.push_back(stream);
+                    });
+                });
+            });
+            accept();
+        });
+    }
+
+public:
+    handshake_server(std::chrono::milliseconds delay, int backlog)
+        : _acceptor(_context), _delay(delay)
+    {
+        use_self_signed_certificate(_tls);
+        tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+        _acceptor.open(endpoint.protocol());
+        _acceptor.bind(endpoint);
+        _acceptor.listen(backlog);
+        accept();
+        _thread = std::thread([this]() { _context.run(); });
+    }
+
+    ~handshake_server()
+    {
+        boost::asio::post(_context, [this]() {
+            boost::system::error_code ec;
+            _acceptor.close(ec);
+            _established.clear();
+            _context.stop();
+        });
+        _thread.join();
+    }
+
+    tcp::endpoint endpoint() const { return _acceptor.local_endpoint(); }
+};
+
+///
+/// 一次连接尝试：TCP 连接、TLS 握手、读取 1 字节，超时算失败
+struct attempt : std::enable_shared_from_this<attempt>
+{
+    ssl::stream<tcp::socket> stream;
+    boost::asio::steady_timer timer;
+    std::function<void(bool)> done;
+    bool finished = false;
+    char reply = 0;
+
+    attempt(boost::asio::io_context& context, ssl::context& tls)
+        : stream(context, tls), timer(context) {}
+
+    void finish(bool ok)
+    {
+        if (finished)
+            return;
+        finished = true;
+        timer.cancel();
+        if (!ok)
+        {
+            boost::system::error_code ec;
+            stream.lowest_layer().close(ec);
+        }
+        done(ok);
+    }
+
+    void start(const tcp::endpoint& endpoint, std::chrono::milliseconds timeout)
+    {
+        auto self = shared_from_this();
+        timer.expires_after(timeout);
+        timer.async_wait([self](const boost::system::error_code& ec) {
+            if (!ec)
+                self->finish(false);
+        });
+        stream.lowest_layer().async_connect(endpoint, [self](const boost::system::error_code& ec) {
+            if (ec)
+                return self->finish(false);
+            self->stream.async_handshake(ssl::stream_base::client, [self](const boost::system::error_code& ec) {
+                if (ec)
+                    return self->finish(false);
+                boost::asio::async_read(self->stream, boost::asio::buffer(&self->reply, 1), [self](const boost::system::error_code& ec, size_t) {
+                    self->finish(!ec);
+                });
+            });
+        });
+    }
+};
+
+struct room_state
+{
+    bench_clock::time_point requested;
+    bench_clock::time_point attempt_started;
+    double open_ms = 0;       // 请求打开到连接成功
+    double handshake_ms = 0;  // 成功的那次尝试本身
+    std::shared_ptr<attempt> connection;
+};
+
+double percentile(std::vector<double> values, double ratio)
+{
+    if (values.empty())
+        return 0;
+    auto index = std::min(static_cast<size_t>(ratio * values.size()), values.size() - 1);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+config::config_t make_config(std::vector<std::string> extra)
+{
+    std::vector<std::string> args = {"admission_bench"};
+    args.insert(args.end(), extra.begin(), extra.end());
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back(arg.data());
+    return config::parse_options(static_cast<int>(argv.size()), argv.data());
+}
+
+///
+/// @param admission_options 为空时不经过准入，所有房间立即开始连接
+void run(const char* name, size_t rooms, std::chrono::milliseconds delay, int backlog, std::chrono::milliseconds timeout,
+         const std::vector<std::string>* admission_options)
+{
+    handshake_server server(delay, backlog);
+    auto endpoint = server.endpoint();
+
+    boost::asio::io_context context;
+    ssl::context tls(ssl::context::tls_client);
+    tls.set_verify_mode(ssl::verify_none);
+    std::vector<room_state> states(rooms);
+    size_t established = 0;
+    size_t failures = 0;
+    std::unique_ptr<admission_controller> admission;
+
+    std::function<void(int)> start = [&](int room_id) {
+        auto& state = states[room_id];
+        state.attempt_started = bench_clock::now();
+        state.connection = std::make_shared<attempt>(context, tls);
+        state.connection->done = [&, room_id](bool ok) {
+            auto& state = states[room_id];
+            auto now = bench_clock::now();
+            if (!ok)
+            {
+                failures++;
+                if (admission)
+                {
+                    admission->on_failed(room_id);
+                    admission->request(room_id);
+                }
+                else
+                {
+                    boost::asio::post(context, [&, room_id]() { start(room_id); });
+                }
+                return;
+            }
+            state.open_ms = std::chrono::duration<double, std::milli>(now - state.requested).count();
+            state.handshake_ms = std::chrono::duration<double, std::milli>(now - state.attempt_started).count();
+            if (admission)
+                admission->on_established(room_id);
+            if (++established == rooms)
+                context.stop();
+        };
+        state.connection->start(endpoint, timeout);
+    };
+
+    auto begin = bench_clock::now();
+    if (admission_options)
+        admission = std::make_unique<admission_controller>(context, make_config(*admission_options), start);
+    boost::asio::post(context, [&]() {
+        for (size_t i = 0; i < rooms; i++)
+        {
+            states[i].requested = bench_clock::now();
+            if (admission)
+                admission->request(static_cast<int>(i));
+            else
+                start(static_cast<int>(i));
+        }
+    });
+    context.run();
+    auto total_ms = std::chrono::duration<double, std::milli>(bench_clock::now() - begin).count();
+
+    std::vector<double> open_ms, handshake_ms;
+    for (auto& state : states)
+    {
+        open_ms.push_back(state.open_ms);
+        handshake_ms.push_back(state.handshake_ms);
+    }
+    std::printf("%-24s open p50/p90/p99 %6.0f %6.0f %6.0f ms  handshake p50/p90/p99 %6.0f %6.0f %6.0f ms  total %6.0f ms  %zu failed attempts\n",
+                name, percentile(open_ms, 0.5), percentile(open_ms, 0.9), percentile(open_ms, 0.99),
+                percentile(handshake_ms, 0.5), percentile(handshake_ms, 0.9), percentile(handshake_ms, 0.99),
+                total_ms, failures);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    size_t rooms = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+    auto delay = std::chrono::milliseconds(argc > 2 ? std::atoi(argv[2]) : 20);
+    auto backlog = argc > 3 ? std::atoi(argv[3]) : 128;
+    auto timeout = std::chrono::milliseconds(argc > 4 ? std::atoi(argv[4]) : 5000);
+
+    std::vector<std::string> defaults;
+    std::vector<std::string> unlimited_rate = {"--connect-rate=0"};
+    run("unbounded", rooms, delay, backlog, timeout, nullptr);
+    run("admission (defaults)", rooms, delay, backlog, timeout, &defaults);
+    run("admission (rate=0)", rooms, delay, backlog, timeout, &unlimited_rate);
+    return 0;
+}
@@ -0,0 +1,98 @@
+///
+/// cmd 分发的开销：bili_json.cpp 使用的编译期完美哈希表，对比原先以 std::function 为值的 robin_hood 字符串表。
+/// 两边登记的都是 BILI_COMMANDS 中的 cmd，处理函数只计数。
+/// 带后缀的 cmd 两边都按 command_table::find 的方式处理：精确查找失败后，再查一次第一个 ':' 之前的部分。
+///
+/// 用法：cmd_dispatch_bench [轮数=2000000]
+#include "bili_command_table.h"
+#include "robin_hood_ext.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string_view>
+
+using namespace vNerve::bilibili;
+
+namespace
+{
+size_t handled = 0;
+bool count_command(const unsigned int& room_id)
+{
+    handled += room_id;
+    return true;
+}
+
+struct command_entry
+{
+    std::string_view name;
+    bool (*handler)(const unsigned int&);
+};
+
+constexpr command_entry commands[] = {
+#define COMMAND_ENTRY(name) {#name, count_command},
+    BILI_COMMANDS(COMMAND_ENTRY)
+#undef COMMAND_ENTRY
+};
+constexpr size_t command_count = sizeof(commands) / sizeof(commands[0]);
+constexpr command_table<64, command_entry, command_count> commands_by_name(commands);
+
+util::unordered_map_string<std::function<bool(const unsigned int&)>> command_map;
+
+template <class Dispatch>
+void run(const char* name, const char* label, const std::string_view* cmds, size_t count, int rounds, Dispatch dispatch)
+{
+    handled = 0;
+    size_t unknown = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        for (size_t j = 0; j < count; j++)
+            unknown += !dispatch(cmds[j]);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-12s %-13s %6.2f ns/message  handled %zu, unknown %zu\n",
+                name, label, elapsed.count() * 1e9 / (double(rounds) * count), handled, unknown);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    for (auto& entry : commands)
+        command_map.emplace(std::string(entry.name), entry.handler);
+
+    // 繁忙直播间中常见的 cmd 比例
+    static const std::string_view traffic[] = {
+        "DANMU_MSG", "DANMU_MSG", "DANMU_MSG", "DANMU_MSG", "SEND_GIFT", "SEND_GIFT",
+        "INTERACT_WORD", "INTERACT_WORD", "ONLINE_RANK_COUNT", "SUPER_CHAT_MESSAGE",
+        "ENTRY_EFFECT", "WELCOME", "COMBO_SEND", "ROOM_REAL_TIME_MESSAGE_UPDATE", "USER_TOAST_MSG", "STOP_LIVE_ROOM_LIST"};
+    static const std::string_view suffixed[] = {"DANMU_MSG:4:0:2:2:2:0", "DANMU_MSG:4:0:2:2:2:0", "SEND_GIFT", "INTERACT_WORD"};
+    static const std::string_view known[] = {"DANMU_MSG", "SEND_GIFT", "SUPER_CHAT_MESSAGE", "WELCOME"};
+
+    auto table = [](std::string_view cmd) {
+        auto entry = commands_by_name.find(cmd);
+        return entry && entry->handler(1);
+    };
+    auto map = [](std::string_view cmd) {
+        auto iter = command_map.find(cmd);
+        if (iter == command_map.end())
+        {
+            auto colon = cmd.find(':');
+            if (colon == std::string_view::npos)
+                return false;
+            iter = command_map.find(cmd.substr(0, colon));
+            if (iter == command_map.end())
+                return false;
+        }
+        return iter->second(1);
+    };
+
+#define RUN(cmds, label)                                                                                  \
+    run("robin_hood", label, cmds, sizeof(cmds) / sizeof(cmds[0]), rounds, map);                         \
+    run("perfect_hash", label, cmds, sizeof(cmds) / sizeof(cmds[0]), rounds, table);
+    RUN(known, "known")
+    RUN(traffic, "traffic mix")
+    RUN(suffixed, "suffixed mix")
+#undef RUN
+    return 0;
+}
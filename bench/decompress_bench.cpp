@@ -0,0 +1,134 @@
+///
+/// bili_decompress 中各解压后端的吞吐量。
+/// 没有录制的数据包时，用生成的 DANMU_MSG 消息拼成与线上相同结构的压缩包（每包若干条 JSON 数据包）。
+/// 本程序替换了 handle_packet，只统计解压和分包的开销，不包括 JSON 解析。
+///
+/// 用法：decompress_bench [每个压缩包的消息数=20] [轮数=2000]
+#include "bili_decompress.h"
+#include "bili_packet.h"
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+size_t handled_packets = 0;
+
+void handle_packet(unsigned char* buf, worker_supervisor::room_id_t, const message_handler&)
+{
+    handled_packets += reinterpret_cast<bilibili_packet_header*>(buf)->op_code() == json_message;
+}
+}  // namespace vNerve::bilibili
+
+using namespace vNerve::bilibili;
+
+namespace
+{
+std::string generate_danmaku(std::mt19937& random)
+{
+    static const char* texts[] = {"草", "哈哈哈哈哈哈哈哈", "主播晚上好", "这波操作可以的，下次一定", "？？？"};
+    char json[1024];
+    auto uid = random() % 400000000;
+    auto length = snprintf(json, sizeof(json),
+                           R"({"cmd":"DANMU_MSG","info":[[0,1,25,16777215,%u,%u,0,"%08x",0,0,0,"",0,"{}","{}"],)"
+                           R"("%s",[%u,"用户%u",0,0,0,10000,1,""],[%u,"粉丝牌","主播",%u,6067854,"",0],[%u,0,9868950,">50000"],)"
+                           R"(["",""],0,0,null,{"ts":%u,"ct":"%08X"},0,0,null,null,0,105]})",
+                           static_cast<unsigned>(random()), static_cast<unsigned>(random()), static_cast<unsigned>(random()),
+                           texts[random() % 5], uid, uid, static_cast<unsigned>(random() % 30), static_cast<unsigned>(random() % 2000000),
+                           static_cast<unsigned>(random() % 60), static_cast<unsigned>(random()), static_cast<unsigned>(random()));
+    auto header = bilibili_packet_header();
+    header.length(static_cast<uint32_t>(sizeof(bilibili_packet_header) + length));
+    header.protocol_version(json_protocol);
+    header.op_code(json_message);
+    return std::string(reinterpret_cast<char*>(&header), sizeof(header)) + std::string(json, length);
+}
+
+std::string compress_zlib(const std::string& data)
+{
+    std::string out(compressBound(static_cast<uLong>(data.size())), '\0');
+    auto length = static_cast<uLongf>(out.size());
+    compress(reinterpret_cast<Bytef*>(out.data()), &length, reinterpret_cast<const Bytef*>(data.data()), static_cast<uLong>(data.size()));
+    out.resize(length);
+    return out;
+}
+
+std::string compress_brotli(const std::string& data)
+{
+    std::string out(BrotliEncoderMaxCompressedSize(data.size()), '\0');
+    auto length = out.size();
+    BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, data.size(),
+                          reinterpret_cast<const uint8_t*>(data.data()), &length, reinterpret_cast<uint8_t*>(out.data()));
+    out.resize(length);
+    return out;
+}
+
+config::config_t make_options(const std::string& zlib_backend)
+{
+    auto options = std::make_shared<boost::program_options::variables_map>();
+    options->emplace("zlib-buffer", boost::program_options::variable_value(size_t(256 * 1024), false));
+    options->emplace("zlib-backend", boost::program_options::variable_value(zlib_backend, false));
+    return options;
+}
+
+void run(const char* backend, uint16_t protocol_version, const std::vector<std::string>& packets,
+         size_t plain_bytes, size_t messages, int rounds)
+{
+    std::thread([&]() {
+        handled_packets = 0;
+        auto decompressor = get_decompressor(protocol_version);
+        message_handler handler;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++)
+            for (auto& packet : packets)
+                decompressor->decompress(reinterpret_cast<const unsigned char*>(packet.data()), packet.size(), 1, handler);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        size_t compressed_bytes = 0;
+        for (auto& packet : packets)
+            compressed_bytes += packet.size();
+        if (handled_packets != messages * rounds)
+            std::printf("%-11s handled %zu packets, expected %zu!\n", backend, handled_packets, messages * rounds);
+        std::printf("%-11s ratio %5.1f%%  %8.1f MB/s out  %7.1f ns/message\n",
+                    backend, 100.0 * compressed_bytes / plain_bytes,
+                    plain_bytes * rounds / elapsed.count() / 1e6,
+                    elapsed.count() * 1e9 / (messages * rounds));
+    }).join();
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    size_t per_packet = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    std::mt19937 random(42);
+    std::vector<std::string> zlib_packets, brotli_packets;
+    size_t plain_bytes = 0, messages = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        std::string plain;
+        for (size_t j = 0; j < per_packet; j++)
+            plain += generate_danmaku(random);
+        plain_bytes += plain.size();
+        messages += per_packet;
+        zlib_packets.push_back(compress_zlib(plain));
+        brotli_packets.push_back(compress_brotli(plain));
+    }
+    std::printf("%zu compressed packets, %zu messages each, %zu bytes before compression, %d rounds\n",
+                zlib_packets.size(), per_packet, plain_bytes, rounds);
+
+    setup_decompressors(make_options("zlib"));
+    run("zlib", zlib_compressed, zlib_packets, plain_bytes, messages, rounds);
+    setup_decompressors(make_options("libdeflate"));
+    run("libdeflate", zlib_compressed, zlib_packets, plain_bytes, messages, rounds);
+    run("brotli", brotli_compressed, brotli_packets, plain_bytes, messages, rounds);
+    return 0;
+}
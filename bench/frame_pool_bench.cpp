@@ -0,0 +1,165 @@
+///
+/// 发往 supervisor 的数据帧的分配开销。
+/// 1. 跨线程分配与释放：一个线程分配帧并 post 到另一个线程上释放，与 supervisor 连接的写出路径相同。
+///    比较 frame_pool 与原来的 new[] + std::function 删除器。
+/// 2. 以每秒 rate 条的速度调用 supervisor_session::on_message，数据发往本机的测试 supervisor，
+///    分别测量批量发送和逐条发送时实际达到的速率和帧池命中率。
+///
+/// 用法：frame_pool_bench [每秒消息数=1000000] [秒数=3] [消息字节数=200]
+#include "frame_pool.h"
+#include "supervisor_session.h"
+#include "borrowed_message.h"
+#include "fake_supervisor.h"
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vNerve::bilibili;
+using namespace vNerve::bilibili::worker_supervisor;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+class fake_message : public borrowed_message
+{
+    std::string _payload;
+
+public:
+    explicit fake_message(size_t size)
+        : _payload(size, 'x')
+    {
+        checksum = 0x123456789abcdefull;
+        std::memset(routing_key, 0, sizeof(routing_key));
+        std::memcpy(routing_key, "danmaku", 7);
+    }
+
+    size_t size() const override { return _payload.size(); }
+    void write(void* data, int size) const override { std::memcpy(data, _payload.data(), size); }
+};
+
+void deleter_unsigned_char_array(unsigned char* buf)
+{
+    delete[] buf;
+}
+
+///
+/// 在当前线程上分配 count 个帧，post 到另一个线程上释放。
+/// 同时在途的帧不超过 max_in_flight，相当于有上限的发送队列。
+/// @return 每帧的平均耗时（纳秒），包括 post
+template <class Allocate, class Release>
+double cross_thread(size_t count, size_t size, Allocate allocate, Release release)
+{
+    const size_t max_in_flight = 4096;
+    boost::asio::io_context context;
+    auto guard = boost::asio::make_work_guard(context);
+    std::thread consumer([&context]() { context.run(); });
+    std::atomic<size_t> released{0};
+
+    auto begin = bench_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        while (i - released.load(std::memory_order_relaxed) >= max_in_flight)
+            std::this_thread::yield();
+        auto [frame, deleter] = allocate(size);
+        frame[0] = static_cast<unsigned char>(i);
+        boost::asio::post(context, [frame, deleter, &release, &released]() {
+            release(frame, deleter);
+            released.fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    guard.reset();
+    consumer.join();
+    auto elapsed = std::chrono::duration<double, std::nano>(bench_clock::now() - begin).count();
+    return elapsed / count;
+}
+
+void bench_cross_thread(size_t size)
+{
+    const size_t count = 2000000;
+    auto baseline = cross_thread(
+        count, size,
+        [](size_t size) { return std::pair(new unsigned char[size], std::function<void(unsigned char*)>(deleter_unsigned_char_array)); },
+        [](unsigned char* frame, const std::function<void(unsigned char*)>& deleter) { deleter(frame); });
+    auto pooled = cross_thread(
+        count, size,
+        [](size_t size) { return std::pair(allocate_frame(size), &release_frame); },
+        [](unsigned char* frame, void (*deleter)(unsigned char*)) { deleter(frame); });
+    std::printf("cross-thread %5zuB  new[]+std::function %7.1f ns/frame   frame_pool %7.1f ns/frame\n", size, baseline, pooled);
+}
+
+config::config_t make_config(unsigned short port, size_t batch_size)
+{
+    std::vector<std::string> args = {
+        "frame_pool_bench",
+        "--supervisor-host=127.0.0.1",
+        "--supervisor-port=" + std::to_string(port),
+        "--batch-size=" + std::to_string(batch_size),
+        "--retry-interval-sec=1"};
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back(arg.data());
+    return config::parse_options(static_cast<int>(argv.size()), argv.data());
+}
+
+void bench_on_message(const char* name, size_t batch_size, double rate, double seconds, size_t message_size)
+{
+    test::fake_supervisor supervisor(capability_data_batch, false);
+    supervisor_session session(
+        make_config(supervisor.port(), batch_size), [](int) {}, [](int) {}, []() {}, []() { return std::vector<room_id_t>(); });
+    // supervisor_connection 在启动 5 秒后才第一次连接
+    if (!supervisor.wait([](const test::fake_supervisor& s) { return s.ready_received() > 0; }, std::chrono::seconds(15)))
+    {
+        std::printf("%s: supervisor not connected.\n", name);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));  // 等待 SUPERVISOR READY
+    report_frame_pool_statistics();  // 清零统计
+
+    fake_message message(message_size);
+    auto total = static_cast<size_t>(rate * seconds);
+    auto interval = std::chrono::duration<double>(1.0 / rate);
+    auto begin = bench_clock::now();
+    for (size_t i = 0; i < total; i++)
+    {
+        // 每 1000 条检查一次进度，超前时等待
+        if (i % 1000 == 0)
+        {
+            auto due = begin + std::chrono::duration_cast<bench_clock::duration>(interval * i);
+            std::this_thread::sleep_until(due);
+        }
+        session.on_message(static_cast<room_id_t>(i % 1000), &message);
+    }
+    auto produced = std::chrono::duration<double>(bench_clock::now() - begin).count();
+    supervisor.wait([total](const test::fake_supervisor& s) { return s.data_packets_received() >= total; }, std::chrono::seconds(10));
+    auto delivered = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+    std::printf("%-10s %zu msgs  produced %.0f msg/s  delivered %llu (%.0f msg/s, %.1f MB/s)\n",
+                name, total, total / produced,
+                static_cast<unsigned long long>(supervisor.data_packets_received()),
+                supervisor.data_packets_received() / delivered, supervisor.bytes_received() / delivered / 1e6);
+    report_frame_pool_statistics();
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    double rate = argc > 1 ? std::atof(argv[1]) : 1000000;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 3;
+    size_t message_size = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 200;
+
+    for (auto size : {300, 1200, 8000})
+        bench_cross_thread(size);
+
+    bench_on_message("batched", 16 * 1024, rate, seconds, message_size);
+    bench_on_message("unbatched", 0, rate, seconds, message_size);
+    return 0;
+}
@@ -0,0 +1,158 @@
+///
+/// 分片时间轮与每个连接各自的 steady_timer 的开销对比。
+/// 模拟 n 个房间：每个房间先安排一个握手超时再取消（握手完成），然后以 interval 加上抖动为周期反复触发心跳。
+/// 为了在几秒内跑完，心跳周期按比例缩短，时间轮的 tick 相应设为 1ms。
+///
+/// 用法：timing_wheel_bench [心跳周期ms=200] [运行秒数=2]
+#include "timing_wheel.h"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace vNerve::bilibili;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+struct result
+{
+    double arm_cancel_ns;  // 每对安排 + 取消
+    uint64_t fired;
+    double cpu_us_per_fire;
+    double mean_late_us;  // 实际触发时间减去应触发时间，负数为提前
+};
+
+double cpu_seconds()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::chrono::milliseconds jittered(std::mt19937& random, std::chrono::milliseconds interval)
+{
+    return interval + std::chrono::milliseconds(random() % (interval.count() / 4 + 1));
+}
+
+result run_wheel(size_t rooms, std::chrono::milliseconds interval, std::chrono::milliseconds duration)
+{
+    boost::asio::io_context context;
+    timing_wheel wheel(context, std::chrono::milliseconds(1));
+    std::mt19937 random(1);
+    result r{};
+
+    auto begin = bench_clock::now();
+    std::vector<timing_wheel::timer_id> handshakes(rooms);
+    for (size_t i = 0; i < rooms; i++)
+        handshakes[i] = wheel.schedule(std::chrono::seconds(45), []() {});
+    for (auto id : handshakes)
+        wheel.cancel(id);
+    r.arm_cancel_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - begin).count() / rooms;
+
+    struct room
+    {
+        bench_clock::time_point due;
+    };
+    std::vector<room> states(rooms);
+    double late_us = 0;
+    auto stop_at = bench_clock::now() + duration;
+    std::function<void(size_t)> arm = [&](size_t index) {
+        auto delay = jittered(random, interval);
+        states[index].due = bench_clock::now() + delay;
+        wheel.schedule(delay, [&, index]() {
+            auto now = bench_clock::now();
+            late_us += std::chrono::duration<double, std::micro>(now - states[index].due).count();
+            r.fired++;
+            if (now < stop_at)
+                arm(index);
+        });
+    };
+    for (size_t i = 0; i < rooms; i++)
+        arm(i);
+
+    auto cpu_begin = cpu_seconds();
+    context.run_until(stop_at + interval * 2);
+    wheel.stop();
+    r.cpu_us_per_fire = (cpu_seconds() - cpu_begin) * 1e6 / r.fired;
+    r.mean_late_us = late_us / r.fired;
+    return r;
+}
+
+result run_timers(size_t rooms, std::chrono::milliseconds interval, std::chrono::milliseconds duration)
+{
+    boost::asio::io_context context;
+    std::mt19937 random(1);
+    result r{};
+
+    std::vector<std::unique_ptr<boost::asio::steady_timer>> timers;
+    timers.reserve(rooms);
+    for (size_t i = 0; i < rooms; i++)
+        timers.push_back(std::make_unique<boost::asio::steady_timer>(context));
+
+    // 握手超时：每个连接自己的定时器，安排后取消
+    auto begin = bench_clock::now();
+    for (auto& timer : timers)
+    {
+        timer->expires_after(std::chrono::seconds(45));
+        timer->async_wait([](const boost::system::error_code&) {});
+    }
+    for (auto& timer : timers)
+        timer->cancel();
+    r.arm_cancel_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - begin).count() / rooms;
+    context.poll();  // 执行取消后的回调
+    context.restart();
+
+    std::vector<bench_clock::time_point> due(rooms);
+    double late_us = 0;
+    auto stop_at = bench_clock::now() + duration;
+    std::function<void(size_t)> arm = [&](size_t index) {
+        auto delay = jittered(random, interval);
+        due[index] = bench_clock::now() + delay;
+        timers[index]->expires_after(delay);
+        timers[index]->async_wait([&, index](const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            auto now = bench_clock::now();
+            late_us += std::chrono::duration<double, std::micro>(now - due[index]).count();
+            r.fired++;
+            if (now < stop_at)
+                arm(index);
+        });
+    };
+    for (size_t i = 0; i < rooms; i++)
+        arm(i);
+
+    auto cpu_begin = cpu_seconds();
+    context.run();
+    r.cpu_us_per_fire = (cpu_seconds() - cpu_begin) * 1e6 / r.fired;
+    r.mean_late_us = late_us / r.fired;
+    return r;
+}
+
+void print(const char* name, size_t rooms, const result& r)
+{
+    std::printf("%-12s %6zu rooms  arm+cancel %6.1f ns  %8llu fired  %5.2f us CPU/fire  mean offset %7.1f us\n",
+                name, rooms, r.arm_cancel_ns, static_cast<unsigned long long>(r.fired), r.cpu_us_per_fire, r.mean_late_us);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    auto interval = std::chrono::milliseconds(argc > 1 ? std::atoi(argv[1]) : 200);
+    auto duration = std::chrono::milliseconds(static_cast<int>((argc > 2 ? std::atof(argv[2]) : 2) * 1000));
+
+    for (size_t rooms : {1000, 10000, 50000})
+    {
+        print("timing_wheel", rooms, run_wheel(rooms, interval, duration));
+        print("steady_timer", rooms, run_timers(rooms, interval, duration));
+    }
+    return 0;
+}
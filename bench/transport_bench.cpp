@@ -0,0 +1,286 @@
+///
+/// 纯 TCP 与 WebSocket over TLS 两种传输方式在 worker 一侧的 CPU 开销。
+/// 本机的测试服务器接受 rooms 个连接，轮流向每个连接发送未压缩的 JSON 数据包（每条一个 WebSocket 消息 / 一次 TCP 写）。
+/// 客户端的读取循环与 bilibili_connection_plain_tcp / bilibili_connection_websocket 相同：
+/// 分段读入 bili_packet_framer 再分包，只计数，不解析 JSON。
+/// 只统计客户端线程的 CPU 时间：建立连接（TCP 连接、TLS 握手、WebSocket 握手）平均到每个房间，收消息平均到每 1000 条。
+/// 服务器证书是运行时生成的自签名 P-256 证书，客户端不验证证书，也不使用 client_tls_context 的会话恢复。
+///
+/// 用法：transport_bench [房间数=200] [消息数=200000] [消息字节数=300]
+#include "bili_packet.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 本程序只分包，不解析 JSON，不链接 bili_json.cpp 和 protobuf
+namespace vNerve::bilibili
+{
+const borrowed_message* serialize_buffer(char*, const size_t&, const unsigned int&) { return nullptr; }
+const borrowed_message* serialize_popularity(const long long, const unsigned int&) { return nullptr; }
+}  // namespace vNerve::bilibili
+
+using namespace vNerve::bilibili;
+namespace beast = boost::beast;
+namespace websocket = boost::beast::websocket;
+namespace ssl = boost::asio::ssl;
+using boost::asio::ip::tcp;
+
+namespace
+{
+const size_t max_read_buffer = 64 * 1024;
+const size_t tcp_read_size = 2048;  // 与 bili_conn_plain_tcp.cpp 相同
+const size_t ws_write_buffer_bytes = 512;  // 与 bili_conn_ws.cpp 相同
+
+double thread_cpu_seconds()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::string make_message(size_t size)
+{
+    std::string json = R"({"cmd":"DANMU_MSG","info":[[0,1,25,16777215,1600000000000,0,0,"0",0,0,0,"",0,"{}","{}"],")";
+    while (json.size() + 2 < size)
+        json += "x";
+    json += "\"]";
+    auto header = bilibili_packet_header();
+    header.length(static_cast<uint32_t>(sizeof(bilibili_packet_header) + json.size()));
+    header.protocol_version(json_protocol);
+    header.op_code(json_message);
+    return std::string(reinterpret_cast<char*>(&header), sizeof(header)) + json;
+}
+
+///
+/// 自签名证书，只用于本机测试服务器
+void use_self_signed_certificate(ssl::context& context)
+{
+    auto key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_keygen_init(key_context);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(key_context, &key);
+    EVP_PKEY_CTX_free(key_context);
+
+    auto certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_set_pubkey(certificate, key);
+    auto name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_sign(certificate, key, EVP_sha256());
+
+    SSL_CTX_use_certificate(context.native_handle(), certificate);
+    SSL_CTX_use_PrivateKey(context.native_handle(), key);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+enum class transport
+{
+    plain_tcp,
+    websocket_tls
+};
+
+///
+/// 在后台线程上接受 rooms 个连接，然后轮流向每个连接发送 message，共 total 条。
+std::thread serve(tcp::acceptor& acceptor, transport kind, size_t rooms, size_t total, const std::string& message)
+{
+    return std::thread([&acceptor, kind, rooms, total, message]() {
+        boost::asio::io_context context;
+        ssl::context tls(ssl::context::tls_server);
+        use_self_signed_certificate(tls);
+
+        std::vector<std::unique_ptr<tcp::socket>> sockets;
+        std::vector<std::unique_ptr<websocket::stream<beast::ssl_stream<tcp::socket>>>> streams;
+        for (size_t i = 0; i < rooms; i++)
+        {
+            tcp::socket socket(context);
+            acceptor.accept(socket);
+            socket.set_option(tcp::no_delay(true));
+            if (kind == transport::plain_tcp)
+            {
+                sockets.push_back(std::make_unique<tcp::socket>(std::move(socket)));
+                continue;
+            }
+            auto stream = std::make_unique<websocket::stream<beast::ssl_stream<tcp::socket>>>(std::move(socket), tls);
+            stream->next_layer().handshake(ssl::stream_base::server);
+            stream->accept();
+            stream->binary(true);
+            streams.push_back(std::move(stream));
+        }
+
+        boost::system::error_code ec;
+        for (size_t i = 0; i < total; i++)
+        {
+            if (kind == transport::plain_tcp)
+                boost::asio::write(*sockets[i % rooms], boost::asio::buffer(message), ec);
+            else
+                streams[i % rooms]->write(boost::asio::buffer(message), ec);
+        }
+        // 客户端收完后直接关闭连接，这里等待对方断开
+        char discard[64];
+        for (auto& socket : sockets)
+            socket->read_some(boost::asio::buffer(discard), ec);
+        for (auto& stream : streams)
+            stream->next_layer().next_layer().read_some(boost::asio::buffer(discard), ec);
+    });
+}
+
+struct result
+{
+    double connect_us_per_room;
+    double cpu_us_per_1k;
+    size_t received;
+};
+
+///
+/// 一个房间的连接和读取循环
+struct room_connection
+{
+    bili_packet_framer framer{max_read_buffer};
+    std::unique_ptr<tcp::socket> socket;
+    std::unique_ptr<websocket::stream<beast::ssl_stream<beast::tcp_stream>>> ws;
+};
+
+result run(transport kind, size_t rooms, size_t total, const std::string& message)
+{
+    boost::asio::io_context server_context;
+    tcp::acceptor acceptor(server_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto endpoint = acceptor.local_endpoint();
+    auto server = serve(acceptor, kind, rooms, total, message);
+
+    boost::asio::io_context context;
+    ssl::context tls(ssl::context::tls_client);
+    tls.set_verify_mode(ssl::verify_none);
+    std::vector<std::unique_ptr<room_connection>> connections;
+    size_t established = 0;
+    size_t received = 0;
+    double cpu_begin = 0, cpu_established = 0, cpu_end = 0;
+
+    auto on_all_received = [&]() {
+        cpu_end = thread_cpu_seconds();
+        boost::system::error_code ec;
+        for (auto& connection : connections)
+        {
+            if (connection->socket)
+                connection->socket->close(ec);
+            else
+                beast::get_lowest_layer(*connection->ws).socket().close(ec);
+        }
+    };
+    auto on_data = [&](room_connection& connection) {
+        connection.framer.on_data([&](unsigned char* packet) {
+            received += reinterpret_cast<bilibili_packet_header*>(packet)->op_code() == json_message;
+        });
+        if (received == total)
+            on_all_received();
+    };
+
+    std::function<void(room_connection&)> start_read = [&](room_connection& connection) {
+        auto on_receive = [&](const boost::system::error_code& ec, size_t transferred) {
+            if (ec)
+                return;
+            if (connection.socket)
+                connection.framer.buffer().commit(transferred);
+            on_data(connection);
+            if (received < total)
+                start_read(connection);
+        };
+        if (connection.socket)
+        {
+            auto& buffer = connection.framer.buffer();
+            auto size = std::min(std::max(tcp_read_size, buffer.capacity() - buffer.size()), connection.framer.read_limit());
+            connection.socket->async_read_some(buffer.prepare(size), on_receive);
+        }
+        else
+        {
+            connection.ws->async_read_some(connection.framer.buffer(), connection.framer.read_limit(), on_receive);
+        }
+    };
+    auto on_established = [&](room_connection& connection) {
+        if (++established == rooms)
+            cpu_established = thread_cpu_seconds();
+        start_read(connection);
+    };
+
+    cpu_begin = thread_cpu_seconds();
+    for (size_t i = 0; i < rooms; i++)
+    {
+        auto connection = std::make_unique<room_connection>();
+        auto& ref = *connection;
+        if (kind == transport::plain_tcp)
+        {
+            connection->socket = std::make_unique<tcp::socket>(context);
+            connection->socket->async_connect(endpoint, [&](const boost::system::error_code& ec) {
+                if (ec)
+                    return;
+                ref.socket->set_option(tcp::no_delay(true));
+                on_established(ref);
+            });
+        }
+        else
+        {
+            connection->ws = std::make_unique<websocket::stream<beast::ssl_stream<beast::tcp_stream>>>(context, tls);
+            connection->ws->auto_fragment(false);
+            connection->ws->write_buffer_bytes(ws_write_buffer_bytes);
+            beast::get_lowest_layer(*connection->ws).async_connect(endpoint, [&](const boost::system::error_code& ec) {
+                if (ec)
+                    return;
+                beast::get_lowest_layer(*ref.ws).socket().set_option(tcp::no_delay(true));
+                ref.ws->next_layer().async_handshake(ssl::stream_base::client, [&](const boost::system::error_code& ec) {
+                    if (ec)
+                        return;
+                    ref.ws->async_handshake("localhost", "/sub", [&](const boost::system::error_code& ec) {
+                        if (!ec)
+                            on_established(ref);
+                    });
+                });
+            });
+        }
+        connections.push_back(std::move(connection));
+    }
+    context.run();
+    server.join();
+
+    result r{};
+    r.connect_us_per_room = (cpu_established - cpu_begin) * 1e6 / rooms;
+    r.cpu_us_per_1k = (cpu_end - cpu_established) * 1e6 / (total / 1000.0);
+    r.received = received;
+    return r;
+}
+
+void print(const char* name, size_t rooms, size_t total, const result& r)
+{
+    std::printf("%-13s %5zu rooms  connect %8.1f us CPU/room  %9.1f us CPU/1k msgs  (%zu/%zu received)\n",
+                name, rooms, r.connect_us_per_room, r.cpu_us_per_1k, r.received, total);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    size_t rooms = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200;
+    size_t total = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+    size_t message_size = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 300;
+    auto message = make_message(message_size);
+
+    print("plain_tcp", rooms, total, run(transport::plain_tcp, rooms, total, message));
+    print("websocket_tls", rooms, total, run(transport::websocket_tls, rooms, total, message));
+    return 0;
+}
@@ -3,15 +3,33 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <utility>
+#include <climits>
 
 #define LOG_PREFIX "[a_sock] "
 
 namespace vNerve::bilibili
 {
+#ifdef IOV_MAX
+const size_t max_gather_buffers = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+const size_t max_gather_buffers = 64;  // Windows: WSASend 没有 IOV_MAX，boost.asio 自身限制为 64
+#endif
 
-asio_socket_write_helper::asio_socket_write_helper(std::string log_prefix, std::shared_ptr<boost::asio::ip::tcp::socket> socket, socket_close_handler close_handler)
+asio_socket_write_helper::asio_socket_write_helper(std::string log_prefix, std::shared_ptr<boost::asio::ip::tcp::socket> socket, socket_close_handler close_handler,
+                                                   size_t high_water)
     : _log_prefix(std::move(log_prefix)), _socket(socket), _close_handler(std::move(close_handler))
 {
+    _buffers.reserve(max_gather_buffers);
+    set_watermarks(high_water);
+}
+
+void asio_socket_write_helper::set_watermarks(size_t high_water, size_t low_water)
+{
+    _high_water = high_water;
+    _low_water = low_water == 0 ? high_water / 2 : std::min(low_water, high_water);
+    _drop_limits[static_cast<size_t>(write_priority::control)] = 0;
+    _drop_limits[static_cast<size_t>(write_priority::data)] = high_water * 2;
+    _drop_limits[static_cast<size_t>(write_priority::bulk)] = high_water;
 }
 
 void asio_socket_write_helper::start_async_write()
@@ -23,61 +41,72 @@ void asio_socket_write_helper::start_async_write()
             LOG_PREFIX "Current socket invalidated! Closing.");
         return;
     }
-    int count = static_cast<int>(_write_queue.size());
-    if (count > 1)
-    {
-        SPDLOG_TRACE(LOG_PREFIX "{} Starting batch async write. BufferCount={}", _log_prefix, count);
-        std::vector<boost::asio::const_buffer> buffers(count);
-        for (int i = 0; i < count; i++)
-        {
-            auto& buf_iter = _write_queue[i];
-            SPDLOG_TRACE(LOG_PREFIX "{} Buffer #{}: Len={}", _log_prefix, i, std::get<1>(buf_iter));
-            buffers.emplace_back(std::get<0>(buf_iter), std::get<1>(buf_iter));
-        }
-        async_write(
-            *socket,
-            buffers,
-            boost::bind(&asio_socket_write_helper::on_written, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred,
-                        count));
-    }
-    else
+    _writing = std::min(_write_queue.size(), max_gather_buffers);
+    _buffers.clear();
+    for (size_t i = 0; i < _writing; i++)
     {
-        // Single buffer: avoid vector allocating.
-        auto& buf_iter = _write_queue.front();
-        SPDLOG_TRACE(LOG_PREFIX "{} Starting async write. Len={}", _log_prefix, std::get<1>(buf_iter));
-        async_write(
-            *socket,
-            boost::asio::buffer(std::get<0>(buf_iter), std::get<1>(buf_iter)),
-            boost::bind(&asio_socket_write_helper::on_written, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred,
-                        1));
+        auto& pending = _write_queue[i];
+        _buffers.emplace_back(pending.data, pending.length);
     }
+    SPDLOG_TRACE(LOG_PREFIX "{} Starting async write. BufferCount={}", _log_prefix, _writing);
+    // _buffers 在写完之前不会被修改，_write_queue 在此期间只会在尾部追加
+    async_write(
+        *socket,
+        _buffers,
+        boost::bind(&asio_socket_write_helper::on_written, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
-void asio_socket_write_helper::on_written(const boost::system::error_code& ec, size_t byte_transferred, int buffer_count)
+void asio_socket_write_helper::on_written(const boost::system::error_code& ec, [[maybe_unused]] size_t byte_transferred)
 {
+    auto buffer_count = _writing;
+    _writing = 0;
     delete_first_n_buffers(buffer_count);
 
     if (ec.value() == boost::asio::error::operation_aborted)
+    {
+        // reset 到了新的 socket：继续写出期间排队的数据
+        if (!_write_queue.empty())
+            start_async_write();
         return;
+    }
     if (ec)
     {
         spdlog::warn(LOG_PREFIX "{} Error writing to socket! Disconnecting. err: {}:{}", _log_prefix, ec.value(), ec.message());
         _close_handler();
+        return;
     }
     SPDLOG_DEBUG(LOG_PREFIX "{} Written {} bytes in {} buffers.", _log_prefix, byte_transferred, buffer_count);
     if (!_write_queue.empty())
         start_async_write();
 }
 
-void asio_socket_write_helper::delete_first_n_buffers(int n)
+void asio_socket_write_helper::delete_first_n_buffers(size_t n)
 {
-    n = std::min(n, static_cast<int>(_write_queue.size()));
-    for (int i = 0; i < n; i++)
+    n = std::min(n, _write_queue.size());
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++)
     {
-        auto& buf_iter = _write_queue.front();
-        std::get<2>(buf_iter)(std::get<0>(buf_iter)); // Use deleter
+        auto& pending = _write_queue.front();
+        bytes += pending.length;
+        pending.deleter(pending.data);
         _write_queue.pop_front();
     }
+    release_bytes(bytes);
+}
+
+void asio_socket_write_helper::release_bytes(size_t bytes)
+{
+    auto queued = _queued_bytes.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+    if (queued >= _low_water || !_above_high_water.load(std::memory_order_relaxed))
+        return;
+    bool expected = true;
+    if (!_above_high_water.compare_exchange_strong(expected, false))
+        return;
+
+    spdlog::info(LOG_PREFIX "{} Write queue drained below low water mark({} < {}). Dropped: data={}, bulk={}.",
+                 _log_prefix, queued, _low_water, dropped(write_priority::data), dropped(write_priority::bulk));
+    if (_watermark_handler)
+        _watermark_handler(false);
 }
 
 void asio_socket_write_helper::reset(std::shared_ptr<boost::asio::ip::tcp::socket> socket)
@@ -88,27 +117,80 @@ void asio_socket_write_helper::reset(std::shared_ptr<boost::asio::ip::tcp::socke
         old_socket->cancel(nec);
     _socket = socket;
 
-    delete_first_n_buffers(static_cast<int>(_write_queue.size()));
+    // 正在写出的缓冲区由 on_written(operation_aborted) 释放
+    auto in_flight = _writing;
+    if (_write_queue.size() > in_flight)
+    {
+        size_t bytes = 0;
+        for (auto it = _write_queue.begin() + in_flight; it != _write_queue.end(); ++it)
+        {
+            bytes += it->length;
+            it->deleter(it->data);
+        }
+        _write_queue.erase(_write_queue.begin() + in_flight, _write_queue.end());
+        release_bytes(bytes);
+    }
+}
+
+void asio_socket_write_helper::record_drop(size_t queued, size_t len, write_priority priority)
+{
+    auto& stats = _statistics[static_cast<size_t>(priority)];
+    if (stats.dropped.fetch_add(1, std::memory_order_relaxed) % 1000 == 0)
+        spdlog::warn(LOG_PREFIX "{} Write queue full({} > {}), dropping priority {} data.",
+                     _log_prefix, queued, _drop_limits[static_cast<size_t>(priority)], static_cast<int>(priority));
+    stats.dropped_bytes.fetch_add(len, std::memory_order_relaxed);
 }
 
-void asio_socket_write_helper::write(unsigned char* buf, size_t len, const supervisor_buffer_deleter& deleter)
+bool asio_socket_write_helper::admit(size_t len, write_priority priority)
+{
+    auto limit = _drop_limits[static_cast<size_t>(priority)];
+    auto queued = _queued_bytes.load(std::memory_order_relaxed) + len;
+    if (limit == 0 || queued <= limit)
+        return true;
+    record_drop(queued, len, priority);
+    return false;
+}
+
+bool asio_socket_write_helper::write(unsigned char* buf, size_t len, supervisor_buffer_deleter deleter, write_priority priority)
 {
     auto socket = _socket.lock();
     if (!socket)
     {
         deleter(buf);
-        return;
+        return false;
     }
-    post(socket->get_executor(), [=]() {
-        if (!socket)
+
+    auto limit = _drop_limits[static_cast<size_t>(priority)];
+    auto queued = _queued_bytes.fetch_add(len, std::memory_order_relaxed) + len;
+    if (limit != 0 && queued > limit)
+    {
+        _queued_bytes.fetch_sub(len, std::memory_order_relaxed);
+        record_drop(queued, len, priority);
+        deleter(buf);
+        return false;
+    }
+    if (queued > _high_water && !_above_high_water.load(std::memory_order_relaxed))
+    {
+        bool expected = false;
+        if (_above_high_water.compare_exchange_strong(expected, true))
+        {
+            spdlog::info(LOG_PREFIX "{} Write queue above high water mark({} > {}).", _log_prefix, queued, _high_water);
+            if (_watermark_handler)
+                _watermark_handler(true);
+        }
+    }
+
+    post(socket->get_executor(), [this, self = shared_from_this(), buf, len, deleter]() {
+        if (_socket.expired())
         {
             deleter(buf);
+            release_bytes(len);
             return;
         }
-        bool write_in_process = !_write_queue.empty();
-        _write_queue.emplace_back(buf, len, deleter);
-        if (!write_in_process)
+        _write_queue.push_back(pending_write{buf, len, deleter});
+        if (_writing == 0)
             start_async_write();
     });
+    return true;
 }
 }
@@ -1,53 +1,106 @@
 #pragma once
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/buffer.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace vNerve::bilibili
 {
-using supervisor_buffer_deleter = std::function<void(unsigned char*)>;
+using supervisor_buffer_deleter = void (*)(unsigned char*);
 using socket_close_handler = std::function<void()>;
+///
+/// 队列中的字节数超过 high water mark 时以 true 调用，降到 low water mark 以下时以 false 调用。
+/// 可能在任意线程中被调用。
+using write_watermark_handler = std::function<void(bool)>;
+
+enum class write_priority : uint8_t
+{
+    control = 0,  // 握手、任务失败等，不丢弃
+    data = 1,     // 普通数据
+    bulk = 2,     // 可以最先丢弃的数据
+};
+inline const size_t write_priority_count = 3;
 
 class asio_socket_write_helper : public std::enable_shared_from_this<asio_socket_write_helper>
 {
 private:
-    std::deque<std::tuple<unsigned char*, size_t, supervisor_buffer_deleter>> _write_queue;
+    struct pending_write
+    {
+        unsigned char* data;
+        size_t length;
+        supervisor_buffer_deleter deleter;
+    };
+    struct priority_statistics
+    {
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> dropped_bytes{0};
+    };
+
+    // 只在 socket 的 executor 上访问
+    std::deque<pending_write> _write_queue;
+    std::vector<boost::asio::const_buffer> _buffers;  // 正在写出的缓冲区，复用
+    size_t _writing = 0;                              // 正在写出的缓冲区个数
+
     std::string _log_prefix;
 
     std::weak_ptr<boost::asio::ip::tcp::socket> _socket;
     socket_close_handler _close_handler;
 
+    // 任意线程访问
+    std::atomic<size_t> _queued_bytes{0};  // 包括已经 post 但还没有进入 _write_queue 的数据
+    std::atomic<bool> _above_high_water{false};
+    size_t _high_water;
+    size_t _low_water;
+    std::array<size_t, write_priority_count> _drop_limits;  // 队列超过此字节数后丢弃该优先级的新数据，0 为不丢弃
+    std::array<priority_statistics, write_priority_count> _statistics;
+    write_watermark_handler _watermark_handler;
+
     void start_async_write();
-    void on_written(const boost::system::error_code& ec, size_t byte_transferred, int buffer_count);
-    void delete_first_n_buffers(int n);
+    void on_written(const boost::system::error_code& ec, size_t byte_transferred);
+    void delete_first_n_buffers(size_t n);
+    void release_bytes(size_t bytes);
+    void record_drop(size_t queued, size_t len, write_priority priority);
 
 public:
-    asio_socket_write_helper(std::string log_prefix, std::shared_ptr<boost::asio::ip::tcp::socket> socket, socket_close_handler close_handler);
+    asio_socket_write_helper(std::string log_prefix, std::shared_ptr<boost::asio::ip::tcp::socket> socket, socket_close_handler close_handler,
+                             size_t high_water = 16 * 1024 * 1024);
     void reset(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
 
-    void write(unsigned char*, size_t, const supervisor_buffer_deleter&);
+    ///
+    /// 写出数据。taking ownership of the buffer, which is deleted by the deleter after written or dropped.
+    /// @return false 表示因为超过了该优先级的限制而被丢弃
+    bool write(unsigned char*, size_t, supervisor_buffer_deleter, write_priority priority = write_priority::data);
+    ///
+    /// 按该优先级的限制判断 len 字节的数据现在是否会被丢弃，不写出数据。
+    /// 用于写出前还要变换的数据（如压缩块）：先按原始数据决定丢弃，变换后的数据再以 control 写出。
+    /// @return false 表示应当丢弃，已计入丢弃统计
+    bool admit(size_t len, write_priority priority);
 
+    ///
+    /// 设置水位。low_water 为 0 时取 high_water 的一半。
+    /// 各优先级的默认丢弃限制：control 不丢弃，data 为 2 * high_water，bulk 为 high_water。
+    /// Must be called before writing.
+    void set_watermarks(size_t high_water, size_t low_water = 0);
+    /// Must be called before writing.
+    void set_drop_limit(write_priority priority, size_t limit) { _drop_limits[static_cast<size_t>(priority)] = limit; }
+    /// Must be called before writing.
+    void set_watermark_handler(write_watermark_handler handler) { _watermark_handler = std::move(handler); }
+
+    size_t queued_bytes() const { return _queued_bytes.load(std::memory_order_relaxed); }
+    bool above_high_water() const { return _above_high_water.load(std::memory_order_relaxed); }
+    uint64_t dropped(write_priority priority) const { return _statistics[static_cast<size_t>(priority)].dropped.load(std::memory_order_relaxed); }
 
     asio_socket_write_helper(const asio_socket_write_helper& other) = delete;
     asio_socket_write_helper& operator=(const asio_socket_write_helper& other) = delete;
-
-    asio_socket_write_helper(asio_socket_write_helper&& other) noexcept
-        : _write_queue(std::move(other._write_queue)),
-          _log_prefix(std::move(other._log_prefix)),
-          _socket(std::move(other._socket)),
-          _close_handler(std::move(other._close_handler))
-    {
-    }
-
-    asio_socket_write_helper& operator=(asio_socket_write_helper&& other) noexcept
-    {
-        if (this == &other)
-            return *this;
-        _write_queue = std::move(other._write_queue);
-        _log_prefix = std::move(other._log_prefix);
-        _socket = std::move(other._socket);
-        _close_handler = std::move(other._close_handler);
-        return *this;
-    }
+    asio_socket_write_helper(asio_socket_write_helper&& other) = delete;
+    asio_socket_write_helper& operator=(asio_socket_write_helper&& other) = delete;
 };
 }
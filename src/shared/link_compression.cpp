@@ -0,0 +1,204 @@
+#include "link_compression.h"
+
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace vNerve::bilibili::worker_supervisor
+{
+namespace
+{
+const int link_window_bits = -15;  // raw deflate, 不需要 zlib 头部与校验和
+const int link_memory_level = 8;
+
+struct link_codec_statistics
+{
+    std::atomic<uint64_t> chunks{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> compressed_bytes{0};
+    std::atomic<uint64_t> cpu_ns{0};
+
+    void add(size_t raw, size_t compressed, std::chrono::steady_clock::duration elapsed)
+    {
+        chunks.fetch_add(1, std::memory_order_relaxed);
+        raw_bytes.fetch_add(raw, std::memory_order_relaxed);
+        compressed_bytes.fetch_add(compressed, std::memory_order_relaxed);
+        cpu_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    }
+
+    void report(const char* name)
+    {
+        auto count = chunks.exchange(0, std::memory_order_relaxed);
+        if (count == 0)
+            return;
+        auto raw = raw_bytes.exchange(0, std::memory_order_relaxed);
+        auto compressed = compressed_bytes.exchange(0, std::memory_order_relaxed);
+        auto ns = cpu_ns.exchange(0, std::memory_order_relaxed);
+        spdlog::info("[l_comp] {}: {} chunks, {} -> {} bytes, ratio {:.3f}, {:.1f}ms CPU, {:.1f}ns/byte.",
+                     name, count, raw, compressed,
+                     raw == 0 ? 1.0 : static_cast<double>(compressed) / raw,
+                     ns / 1e6, raw == 0 ? 0.0 : static_cast<double>(ns) / raw);
+    }
+};
+
+link_codec_statistics deflate_statistics;
+link_codec_statistics inflate_statistics;
+}  // namespace
+
+link_dictionary_t load_link_dictionary(const std::string& path)
+{
+    if (path.empty())
+        return nullptr;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        spdlog::critical("[l_comp] Failed to open link compression dictionary {}!", path);
+        throw std::runtime_error("Failed to open link compression dictionary.");
+    }
+    auto dictionary = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    spdlog::info("[l_comp] Loaded link compression dictionary {}: {} bytes, id={:08x}.",
+                 path, dictionary->size(), link_dictionary_id(dictionary));
+    return dictionary;
+}
+
+uint32_t link_dictionary_id(const link_dictionary_t& dictionary)
+{
+    if (!dictionary || dictionary->empty())
+        return 0;
+    return static_cast<uint32_t>(adler32(adler32(0, nullptr, 0),
+                                         reinterpret_cast<const Bytef*>(dictionary->data()),
+                                         static_cast<uInt>(dictionary->size())));
+}
+
+link_deflater::link_deflater(const int level, const link_dictionary_t& dictionary)
+    : _stream(std::make_unique<z_stream>())
+{
+    std::memset(_stream.get(), 0, sizeof(z_stream));
+    auto result = deflateInit2(_stream.get(), level, Z_DEFLATED, link_window_bits, link_memory_level, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK)
+    {
+        spdlog::error("[l_comp] Failed initializing deflate stream: {}", result);
+        _stream.reset();
+        return;
+    }
+    if (dictionary && !dictionary->empty())
+        deflateSetDictionary(_stream.get(), reinterpret_cast<const Bytef*>(dictionary->data()), static_cast<uInt>(dictionary->size()));
+}
+
+link_deflater::~link_deflater()
+{
+    if (_stream)
+        deflateEnd(_stream.get());
+}
+
+size_t link_deflater::bound(const size_t len) const
+{
+    // deflateBound 按 Z_FINISH 估算，再加上 Z_SYNC_FLUSH 的空块与块头
+    return (_stream ? deflateBound(_stream.get(), static_cast<uLong>(len)) : len) + 16;
+}
+
+size_t link_deflater::compress(const unsigned char* in, const size_t len, unsigned char* out)
+{
+    if (!_stream)
+        return 0;
+    auto begin = std::chrono::steady_clock::now();
+    auto capacity = bound(len);
+    _stream->next_in = const_cast<Bytef*>(in);
+    _stream->avail_in = static_cast<uInt>(len);
+    _stream->next_out = out;
+    _stream->avail_out = static_cast<uInt>(capacity);
+    auto result = deflate(_stream.get(), Z_SYNC_FLUSH);
+    if (result != Z_OK || _stream->avail_in != 0)
+    {
+        spdlog::error("[l_comp] deflate failed: {}, {} bytes left.", result, _stream->avail_in);
+        deflateEnd(_stream.get());
+        _stream.reset();
+        return 0;
+    }
+    auto produced = capacity - _stream->avail_out;
+    deflate_statistics.add(len, produced, std::chrono::steady_clock::now() - begin);
+    return produced;
+}
+
+link_inflater::link_inflater(const size_t max_size, const link_dictionary_t& dictionary)
+    : _stream(std::make_unique<z_stream>()),
+      _capacity(std::min<size_t>(16 * 1024, max_size)),
+      _max_size(max_size)
+{
+    _buffer = std::make_unique<unsigned char[]>(_capacity);
+    std::memset(_stream.get(), 0, sizeof(z_stream));
+    auto result = inflateInit2(_stream.get(), link_window_bits);
+    if (result != Z_OK)
+    {
+        spdlog::error("[l_comp] Failed initializing inflate stream: {}", result);
+        _stream.reset();
+        return;
+    }
+    if (dictionary && !dictionary->empty())
+        inflateSetDictionary(_stream.get(), reinterpret_cast<const Bytef*>(dictionary->data()), static_cast<uInt>(dictionary->size()));
+}
+
+link_inflater::~link_inflater()
+{
+    if (_stream)
+        inflateEnd(_stream.get());
+}
+
+std::pair<const unsigned char*, size_t> link_inflater::decompress(const unsigned char* in, const size_t len)
+{
+    if (!_stream)
+        return {nullptr, 0};
+    auto begin = std::chrono::steady_clock::now();
+    _stream->next_in = const_cast<Bytef*>(in);
+    _stream->avail_in = static_cast<uInt>(len);
+    size_t filled = 0;
+    while (true)
+    {
+        _stream->next_out = _buffer.get() + filled;
+        _stream->avail_out = static_cast<uInt>(_capacity - filled);
+        auto result = inflate(_stream.get(), Z_SYNC_FLUSH);
+        filled = _capacity - _stream->avail_out;
+        if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            spdlog::warn("[l_comp] inflate failed: {}", result);
+            break;
+        }
+        if (_stream->avail_in == 0 && _stream->avail_out != 0)
+        {
+            inflate_statistics.add(filled, len, std::chrono::steady_clock::now() - begin);
+            return {_buffer.get(), filled};
+        }
+        if (_stream->avail_out != 0)
+        {
+            spdlog::warn("[l_comp] inflate made no progress.");
+            break;
+        }
+        if (_capacity >= _max_size)
+        {
+            spdlog::warn("[l_comp] Decompressed chunk too big: > max size({}).", _max_size);
+            break;
+        }
+        auto capacity = std::min(_capacity * 2, _max_size);
+        auto buffer = std::make_unique<unsigned char[]>(capacity);
+        std::memcpy(buffer.get(), _buffer.get(), filled);
+        _buffer = std::move(buffer);
+        _capacity = capacity;
+    }
+    inflateEnd(_stream.get());
+    _stream.reset();
+    return {nullptr, 0};
+}
+
+void report_link_compression_statistics()
+{
+    deflate_statistics.report("deflate");
+    inflate_statistics.report("inflate");
+}
+}  // namespace vNerve::bilibili::worker_supervisor
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+typedef struct z_stream_s z_stream;
+
+namespace vNerve::bilibili::worker_supervisor
+{
+using link_dictionary_t = std::shared_ptr<const std::string>;
+
+///
+/// 读取 worker 与 supervisor 共用的预设字典。
+/// 字典是一段典型的数据包内容（例如若干条拼接在一起的 room_message），最后 32KB 生效。
+/// @return 路径为空时返回 nullptr
+link_dictionary_t load_link_dictionary(const std::string& path);
+///
+/// 字典的标识（adler32），用于握手时确认双方使用同一个字典。没有字典时为 0。
+uint32_t link_dictionary_id(const link_dictionary_t& dictionary);
+
+///
+/// worker 到 supervisor 链路的流式压缩（raw deflate）。
+/// 整个连接共用一个压缩流，每次 compress 以 Z_SYNC_FLUSH 结束，
+/// 因此每个 COMPRESSED CHUNK 解压后都是完整的数据包，同时可以引用之前发送过的内容。
+class link_deflater
+{
+private:
+    std::unique_ptr<z_stream> _stream;
+
+public:
+    link_deflater(int level, const link_dictionary_t& dictionary);
+    ~link_deflater();
+    link_deflater(const link_deflater&) = delete;
+    link_deflater& operator=(const link_deflater&) = delete;
+
+    /// 压缩 len 字节所需的最大输出空间
+    size_t bound(size_t len) const;
+    ///
+    /// @param out 至少有 bound(len) 字节
+    /// @return 输出的字节数，出错时为 0，此后压缩流不可再用
+    size_t compress(const unsigned char* in, size_t len, unsigned char* out);
+};
+
+class link_inflater
+{
+private:
+    std::unique_ptr<z_stream> _stream;
+    std::unique_ptr<unsigned char[]> _buffer;
+    size_t _capacity;
+    size_t _max_size;
+
+public:
+    link_inflater(size_t max_size, const link_dictionary_t& dictionary);
+    ~link_inflater();
+    link_inflater(const link_inflater&) = delete;
+    link_inflater& operator=(const link_inflater&) = delete;
+
+    ///
+    /// 解压一个 COMPRESSED CHUNK。
+    /// @return 解压结果，指向内部缓冲区，下次调用前有效。出错或超过 max_size 时返回 {nullptr, 0}，此后解压流不可再用
+    std::pair<const unsigned char*, size_t> decompress(const unsigned char* in, size_t len);
+};
+
+///
+/// 输出自上次调用以来的压缩率与耗时。
+void report_link_compression_statistics();
+}  // namespace vNerve::bilibili::worker_supervisor
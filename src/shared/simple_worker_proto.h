@@ -3,6 +3,8 @@
 
 #include <utility>
 #include <functional>
+#include <cstdint>
+#include <cstring>
 
 namespace vNerve::bilibili::worker_supervisor
 {
@@ -14,35 +16,86 @@ const size_t auth_code_size = 32;
 inline const unsigned char worker_ready_code = static_cast<unsigned char>(0x00000001);
 inline const unsigned char room_failed_code = static_cast<unsigned char>(0x00000002);
 inline const unsigned char worker_data_code = static_cast<unsigned char>(0x00000000);
+inline const unsigned char worker_data_batch_code = static_cast<unsigned char>(0x00000003);
+inline const unsigned char compressed_chunk_code = static_cast<unsigned char>(0x00000004);
 
 inline const unsigned char assign_room_code = static_cast<unsigned char>(0x10000001);
 inline const unsigned char unassign_room_code = static_cast<unsigned char>(0x10000002);
+inline const unsigned char supervisor_ready_code = static_cast<unsigned char>(0x10000003);
+
+// WORKER READY 中的 FLAGS，以及 SUPERVISOR READY 中确认启用的 FLAGS
+inline const uint32_t capability_data_batch = 0x00000001;
+inline const uint32_t capability_link_compression = 0x00000002;
+inline const uint32_t capability_session_resume = 0x00000004;
 
 inline const size_t simple_message_header_length = sizeof(unsigned int);
-inline const size_t crc_32_length = sizeof(checksum_t);
+inline const size_t checksum_length = sizeof(checksum_t);
 inline const size_t room_id_length = sizeof(room_id_t);
 inline const unsigned int worker_ready_payload_length = 1 + room_id_length + auth_code_size;
+inline const unsigned int worker_ready_flags_length = sizeof(uint32_t) + sizeof(uint32_t);  // FLAGS DICT_ID
+inline const unsigned int worker_ready_session_header_length = sizeof(uint64_t) + sizeof(uint32_t);  // SESSION_ID ROOM_COUNT
+inline const unsigned int supervisor_ready_payload_length = 1 + sizeof(uint32_t);
 inline const unsigned int room_failed_payload_length = 1 + room_id_length;
 inline const unsigned int assign_unassign_payload_length = 1 + room_id_length;
-inline const unsigned int worker_data_payload_header_length = 1 + room_id_length + crc_32_length + routing_key_max_size;
+inline const unsigned int worker_data_payload_header_length = 1 + room_id_length + checksum_length + routing_key_max_size;
+inline const unsigned int worker_data_batch_header_length = 1;
+inline const unsigned int compressed_chunk_header_length = 1;
+inline const unsigned int worker_data_entry_header_length = room_id_length + checksum_length + 1;  // 不含 ROUTING_KEY 与 PAYLOAD_LEN
+inline const unsigned int worker_data_entry_payload_length_length = sizeof(uint32_t);
 
 /*
  * All big endian.
  * byte    uint32
- * OP_CODE=1 ROOM_ID   (ROOM FAILED)
- * OP_CODE=2 MAX_ROOMS AUTHCODE[32] (WORKER READY)
+ * OP_CODE=2 ROOM_ID   (ROOM FAILED)
+ * OP_CODE=1 MAX_ROOMS AUTHCODE[32] [FLAGS(uint32) DICT_ID(uint32) [SESSION_ID(uint64) ROOM_COUNT(uint32) ROOM_ID(uint32)...]] (WORKER READY)
+ * SESSION_ID and the rooms the worker is still connected to are present only when FLAGS contains capability_session_resume.
+ * SESSION_ID stays the same across reconnections of one worker process.
+ *
+ * byte      uint32  uint64   char[32]
+ * OP_CODE=0 ROOM_ID CHECKSUM ROUTING_KEY PAYLOAD
+ * CHECKSUM = 0: Always send.
  *
- * byte      uint32  int32 char[32]
- * OP_CODE=0 ROOM_ID CRC32 ROUTING_KEY PAYLOAD
- * CRC32 = 0: Always send.
+ * byte      (uint32  uint64   byte   char[RK_LEN] uint32      byte[PAYLOAD_LEN])...
+ * OP_CODE=3 (ROOM_ID CHECKSUM RK_LEN ROUTING_KEY  PAYLOAD_LEN PAYLOAD)...   (WORKER DATA BATCH)
+ * Only sent after the supervisor accepted capability_data_batch.
  *
- * OP_CODE ROOM_ID
+ * byte      byte[]
+ * OP_CODE=4 DEFLATED   (COMPRESSED CHUNK)
+ * Raw deflate stream shared by the whole connection, preset with the dictionary identified by DICT_ID,
+ * flushed with Z_SYNC_FLUSH after every chunk. Inflates to one or more complete packets(LEN + PAYLOAD).
+ * Only sent after the supervisor accepted capability_link_compression.
+ *
+ * Supervisor to worker:
+ * OP_CODE ROOM_ID  (ASSIGN=1 / UNASSIGN=2)
+ * OP_CODE=3 FLAGS  (SUPERVISOR READY, reply to a WORKER READY carrying FLAGS)
+ * With capability_session_resume accepted, the supervisor adopts the rooms listed in WORKER READY as tasks of the worker,
+ * and sends UNASSIGN for the listed rooms it doesn't adopt. Otherwise the worker should close all its rooms.
  */
 
 /**
  * All packets starts with packet length, then the payload.
  */
 
+inline uint64_t host_to_network_longlong(uint64_t value)
+{
+    unsigned char bytes[8];
+    for (int i = 7; i >= 0; i--, value >>= 8)
+        bytes[i] = static_cast<unsigned char>(value & 0xFF);
+    uint64_t result;
+    std::memcpy(&result, bytes, sizeof(result));
+    return result;
+}
+
+inline uint64_t network_to_host_longlong(uint64_t value)
+{
+    unsigned char bytes[8];
+    std::memcpy(bytes, &value, sizeof(value));
+    uint64_t result = 0;
+    for (int i = 0; i < 8; i++)
+        result = (result << 8) | bytes[i];
+    return result;
+}
+
 using buffer_handler = std::function<void(unsigned char*, size_t)>;
 ///
 /// 用于处理一次读取获得的缓冲区。
@@ -9,5 +9,5 @@ namespace worker_supervisor
 using identifier_t = uint64_t;
 using room_id_t = int;
 }
-using checksum_t = int; // CRC-32
+using checksum_t = uint64_t; // XXH3-64, seeded by room id
 }
\ No newline at end of file
@@ -25,12 +25,15 @@ const int DEFAULT_WORKER_MAX_NEW_TASKS_PER_BUNCH = 4;
 const int DEFAULT_READ_BUFFER = 128 * 1024;
 const int DEFAULT_WORKER_INTERVAL_THRESHOLD_SEC = 40;
 const int DEFAULT_WORKER_PENALTY_MIN = 1;
+const int DEFAULT_SESSION_GRACE_SEC = 60;
+const int DEFAULT_STARTUP_GRACE_SEC = 30;
 const std::string DEFAULT_AUTH_CODE = "abcdefghijklmnopqrstuvwyzabcdef";
 
 const int DEFAULT_MESSAGE_TTL_SEC = 30;
 const int DEFAULT_MIN_INTERVAL_POPULARITY_SEC = 20;
 
 const int DEFAULT_PROFILER_PORT = 7216;
+const int DEFAULT_STATS_INTERVAL_SEC = 60;
 
 boost::program_options::options_description create_description()
 {
@@ -71,6 +74,11 @@ boost::program_options::options_description create_description()
         ("worker-penalty-min,p", value<int>()->default_value(DEFAULT_WORKER_PENALTY_MIN), "Penalty applied to worker when a task fails. in minutes. No new task will be assign to the worker in the given time period.")
         ("worker-max-new-tasks-per-bunch,M", value<int>()->default_value(DEFAULT_WORKER_MAX_NEW_TASKS_PER_BUNCH), "Max new task assigned to a single worker every bunch.")
         ("auth-code,A", value<std::string>()->default_value(DEFAULT_AUTH_CODE), "Auth code for worker.")
+        ("link-compression", value<bool>()->default_value(true), "Accept compressed data from workers requesting it.")
+        ("link-dictionary", value<std::string>()->default_value(""), "Preset dictionary file for compressed data from workers. Must be the same file as workers use.")
+        ("session-resume", value<bool>()->default_value(true), "Let reconnecting workers resume their sessions, keeping the rooms they are still connected to.")
+        ("session-grace-sec", value<int>()->default_value(DEFAULT_SESSION_GRACE_SEC), "Time(secs) keeping tasks of a disconnected worker before reassigning them. 0 to reassign immediately.")
+        ("startup-grace-sec", value<int>()->default_value(DEFAULT_STARTUP_GRACE_SEC), "Time(secs) after startup before assigning new tasks, waiting for workers to resume sessions.")
         //("worker-mq-threads, t", value<int>()->default_value(DEFAULT_WORKER_MQ_THREADS), "Thread count for MQ communicating with workers.")
     ;
 
@@ -84,6 +92,7 @@ boost::program_options::options_description create_description()
     descDiagnostics.add_options()
         ("profiler-port", value<int>()->default_value(DEFAULT_PROFILER_PORT), "Remote port for profiler.")
         ("profiler-limit-local", bool_switch()->default_value(false), "Accept only connections from localhost in profiler..")
+        ("stats-interval-sec", value<int>()->default_value(DEFAULT_STATS_INTERVAL_SEC), "Interval between printing runtime statistics. 0 to disable.")
     ;
 
     auto desc = options_description("vNerve Bilibili Livestream chat crawling supervisor");
@@ -126,6 +135,11 @@ std::shared_ptr<config_supervisor> fill_config(config::config_t raw)
     worker.worker_penalty_min = rawr["worker-penalty-min"].as<int>();
     worker.read_buffer_size = rawr["read-buffer"].as<size_t>();
     worker.max_new_tasks_per_bunch = rawr["worker-max-new-tasks-per-bunch"].as<int>();
+    worker.link_compression = rawr["link-compression"].as<bool>();
+    worker.link_dictionary = rawr["link-dictionary"].as<std::string>();
+    worker.session_resume = rawr["session-resume"].as<bool>();
+    worker.session_grace_sec = rawr["session-grace-sec"].as<int>();
+    worker.startup_grace_sec = rawr["startup-grace-sec"].as<int>();
 
     auto& message = result->message;
     message.message_ttl_sec = rawr["message-ttl-sec"].as<int>();
@@ -134,6 +148,7 @@ std::shared_ptr<config_supervisor> fill_config(config::config_t raw)
     auto& diag = result->diag;
     diag.profiler_port = rawr["profiler-port"].as<int>();
     diag.profiler_limit_localhost = rawr["profiler-limit-local"].as<bool>();
+    diag.stats_interval_sec = rawr["stats-interval-sec"].as<int>();
 
     return result;
 }
@@ -163,12 +178,18 @@ std::shared_ptr<config_dynamic_linker> link_config(config_sv_t config)
     result->register_entry("worker-penalty-min", &config->worker.worker_penalty_min, true);
     result->register_entry("read-buffer", static_cast<int*>(nullptr), false);
     result->register_entry("worker-max-new-tasks-per-bunch", &config->worker.max_new_tasks_per_bunch, true);
+    result->register_entry("link-compression", static_cast<int*>(nullptr), false);
+    result->register_entry("link-dictionary", static_cast<std::string*>(nullptr), false);
+    result->register_entry("session-resume", static_cast<int*>(nullptr), false);
+    result->register_entry("session-grace-sec", &config->worker.session_grace_sec, true);
+    result->register_entry("startup-grace-sec", static_cast<int*>(nullptr), false);
 
     result->register_entry("message-ttl-sec", &config->message.message_ttl_sec, true);
     result->register_entry("min-interval-popularity-sec", &config->message.min_interval_popularity_sec, true);
 
     result->register_entry("profiler-port", &config->diag.profiler_port, false);
     result->register_entry("profiler-limit-local", static_cast<int*>(nullptr), false);
+    result->register_entry("stats-interval-sec", &config->diag.stats_interval_sec, true);
 
     return result;
 }
@@ -41,6 +41,13 @@ struct config_supervisor
         size_t read_buffer_size;
 
         int max_new_tasks_per_bunch;
+
+        bool link_compression;
+        std::string link_dictionary;
+
+        bool session_resume;
+        int session_grace_sec;
+        int startup_grace_sec;
     } worker;
 
     struct config_message
@@ -53,6 +60,7 @@ struct config_supervisor
     {
         int profiler_port;
         bool profiler_limit_localhost;
+        int stats_interval_sec;
     } diag;
 };
 
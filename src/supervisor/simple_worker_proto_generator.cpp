@@ -28,4 +28,12 @@ std::pair<unsigned char*, size_t> generate_unassign_packet(room_id_t room_id)
     return buf;
 }
 
+std::pair<unsigned char*, size_t> generate_supervisor_ready_packet(uint32_t flags)
+{
+    // 与 ASSIGN / UNASSIGN 格式相同，FLAGS 位于 ROOM_ID 的位置
+    auto buf = generate_assign_unassign_base_packet(static_cast<room_id_t>(flags));
+    buf.first[simple_message_header_length] = supervisor_ready_code;
+    return buf;
+}
+
 }
@@ -8,4 +8,5 @@ namespace vNerve::bilibili::worker_supervisor
 /// Use delete[] to remove!
 std::pair<unsigned char*, size_t> generate_unassign_packet(room_id_t room_id);
 std::pair<unsigned char*, size_t> generate_assign_packet(room_id_t room_id);
+std::pair<unsigned char*, size_t> generate_supervisor_ready_packet(uint32_t flags);
 }
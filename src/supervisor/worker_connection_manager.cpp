@@ -1,5 +1,8 @@
 #include "worker_connection_manager.h"
 
+#include "simple_worker_proto.h"
+
+#include <boost/asio/detail/socket_ops.hpp>
 #include <spdlog/spdlog.h>
 #include <utility>
 
@@ -37,14 +40,56 @@ void worker_session::init()
     _read_handler = std::make_shared<simple_worker_proto_handler>(
         fmt::format(LOG_PREFIX "[{:016x}]", _identifier),
         _socket, _read_buffer_size,
-        std::bind(_buffer_handler, _identifier, std::placeholders::_1, std::placeholders::_2),
+        std::bind(&worker_session::on_buffer, shared_from_this(), std::placeholders::_1, std::placeholders::_2),
         std::bind(&worker_session::disconnect, shared_from_this(), true));
     _read_handler->start();
 }
 
 void worker_session::send(unsigned char* buf, size_t len, supervisor_buffer_deleter deleter)
 {
-    _write_helper->write(buf, len, deleter);
+    // 发往 worker 的都是任务分配等控制数据包，不能丢弃
+    _write_helper->write(buf, len, deleter, write_priority::control);
+}
+
+void worker_session::enable_link_compression(const link_dictionary_t& dictionary)
+{
+    spdlog::info(LOG_PREFIX "[{:016x}] Enabling link compression.", _identifier);
+    _inflater = std::make_unique<link_inflater>(_read_buffer_size, dictionary);
+}
+
+void worker_session::on_buffer(unsigned char* payload, size_t len)
+{
+    if (len == 0 || payload[0] != compressed_chunk_code)
+    {
+        _buffer_handler(_identifier, payload, len);
+        return;
+    }
+    if (!_inflater)
+    {
+        SPDLOG_DEBUG(LOG_PREFIX "[{:016x}] Unexpected compressed chunk: compression not negotiated.", _identifier);
+        return;
+    }
+
+    auto [data, size] = _inflater->decompress(payload + compressed_chunk_header_length, len - compressed_chunk_header_length);
+    if (!data)
+    {
+        spdlog::warn(LOG_PREFIX "[{:016x}] Failed decompressing chunk. Disconnecting.", _identifier);
+        disconnect(true);
+        return;
+    }
+    // 解压结果是完整的数据包，直接在解压缓冲区内逐个处理
+    auto begin = const_cast<unsigned char*>(data);
+    auto end = begin + size;
+    while (end - begin >= static_cast<ptrdiff_t>(simple_message_header_length))
+    {
+        auto length = boost::asio::detail::socket_ops::network_to_host_long(*reinterpret_cast<simple_message_header*>(begin));
+        if (length > static_cast<size_t>(end - begin) - simple_message_header_length)
+            break;
+        _buffer_handler(_identifier, begin + simple_message_header_length, length);
+        begin += simple_message_header_length + length;
+    }
+    if (begin != end)
+        spdlog::warn(LOG_PREFIX "[{:016x}] {} trailing bytes in decompressed chunk.", _identifier, end - begin);
 }
 
 void worker_session::disconnect(bool callback)
@@ -74,6 +119,9 @@ worker_connection_manager::worker_connection_manager(
       _guard(_context.get_executor()),
       _acceptor(_context, boost::asio::ip::tcp::v4()),
       _timer(std::make_unique<boost::asio::deadline_timer>(_context)),
+      _link_dictionary(load_link_dictionary(config->worker.link_dictionary)),
+      _link_dictionary_id(worker_supervisor::link_dictionary_id(_link_dictionary)),
+      _last_statistics(std::chrono::steady_clock::now()),
       _buffer_handler(std::move(buffer_handler)),
       _tick_handler(std::move(tick_handler)),
       _new_worker_handler(std::move(new_worker_handler)),
@@ -197,6 +245,14 @@ void worker_connection_manager::on_timer_tick(const boost::system::error_code& e
     }
 
     _tick_handler();
+
+    auto now = std::chrono::steady_clock::now();
+    auto stats_interval = _config->diag.stats_interval_sec;
+    if (stats_interval > 0 && now - _last_statistics >= std::chrono::seconds(stats_interval))
+    {
+        _last_statistics = now;
+        report_link_compression_statistics();
+    }
     reschedule_timer();
 }
 
@@ -220,4 +276,13 @@ void worker_connection_manager::disconnect_worker(identifier_t identifier, bool
     session->disconnect(callback);
     _sockets.erase(socket_iter);
 }
+
+void worker_connection_manager::enable_link_compression(identifier_t identifier)
+{
+    auto socket_iter = _sockets.find(identifier);
+    if (socket_iter == _sockets.end())
+        return;
+
+    socket_iter->second->enable_link_compression(_link_dictionary);
+}
 }
@@ -3,8 +3,10 @@
 #include "config_sv.h"
 #include "simple_worker_proto_handler.h"
 #include "asio_socket_write_helper.h"
+#include "link_compression.h"
 #include "type.h"
 
+#include <chrono>
 #include <memory>
 #include <random>
 #include <deque>
@@ -17,7 +19,6 @@ namespace vNerve::bilibili::worker_supervisor
 using supervisor_buffer_handler =
     std::function<void(identifier_t,
                        unsigned char* , size_t )>;
-using supervisor_buffer_deleter = std::function<void(unsigned char*)>;
 using supervisor_tick_handler = std::function<void()>;
 using supervisor_new_worker_handler = std::function<void(identifier_t)>;
 using supervisor_worker_disconnect_handler = std::function<void(identifier_t)>;
@@ -31,10 +32,12 @@ private:
     std::shared_ptr<simple_worker_proto_handler> _read_handler;
     supervisor_buffer_handler _buffer_handler;
     supervisor_worker_disconnect_handler _disconnect_handler;
-    std::deque<std::tuple<unsigned char*, size_t, supervisor_buffer_deleter>> _write_queue;
+    std::unique_ptr<link_inflater> _inflater;  // 协商启用链路压缩后才创建
 
     int _read_buffer_size;
 
+    void on_buffer(unsigned char* payload, size_t len);
+
 public:
     worker_session(
         identifier_t identifier,
@@ -46,6 +49,9 @@ public:
     void init();
     void send(unsigned char*, size_t, supervisor_buffer_deleter);
     void disconnect(bool callback);
+    ///
+    /// 此后收到的 COMPRESSED CHUNK 使用新的解压流解压。
+    void enable_link_compression(const link_dictionary_t& dictionary);
     std::shared_ptr<boost::asio::ip::tcp::socket> socket() { return _socket; }
 
     worker_session(const worker_session& other) = delete;
@@ -55,8 +61,7 @@ public:
           _socket(std::move(other._socket)),
           _read_handler(std::move(other._read_handler)),
           _write_helper(std::move(other._write_helper)),
-          _disconnect_handler(std::move(other._disconnect_handler)),
-          _write_queue(std::move(other._write_queue))
+          _disconnect_handler(std::move(other._disconnect_handler))
     {
     }
 
@@ -69,7 +74,6 @@ public:
         _read_handler = std::move(other._read_handler);
         _write_helper = std::move(other._write_helper);
         _disconnect_handler = std::move(other._disconnect_handler);
-        _write_queue = std::move(other._write_queue);
         return *this;
     }
 };
@@ -87,6 +91,9 @@ private:
     std::unique_ptr<boost::asio::deadline_timer> _timer;
 
     boost::thread _thread;
+    link_dictionary_t _link_dictionary;
+    uint32_t _link_dictionary_id;
+    std::chrono::steady_clock::time_point _last_statistics;
     supervisor_buffer_handler _buffer_handler;
     supervisor_tick_handler _tick_handler;
     supervisor_new_worker_handler _new_worker_handler;
@@ -119,6 +126,8 @@ public:
     /// @param msg Message to be sent. Taking ownership of msg
     void send_message(identifier_t identifier, unsigned char* msg, size_t len, supervisor_buffer_deleter deleter);
     void disconnect_worker(identifier_t identifier, bool callback = false);
+    void enable_link_compression(identifier_t identifier);
+    uint32_t link_dictionary_id() const { return _link_dictionary_id; }
 
     boost::asio::io_context& context() { return _context; }
     void join();
@@ -16,10 +16,10 @@
 
 namespace vNerve::bilibili::worker_supervisor
 {
-supervisor_buffer_deleter unsigned_char_array_deleter = [](unsigned char* buf) -> void
+void unsigned_char_array_deleter(unsigned char* buf)
 {
     delete[] buf;
-};
+}
 
 bool compare_worker(const worker_status* lhs, const worker_status* rhs)
 {
@@ -37,6 +37,7 @@ scheduler_session::scheduler_session(
       _diag_data_handler(std::move(diag_data_handler)),
       _tick_handler(std::move(tick_handler))
 {
+    _assign_after = std::chrono::system_clock::now() + std::chrono::seconds(_config->worker.startup_grace_sec);
     _worker_session = std::make_shared<worker_connection_manager>(
         config,
         std::bind(&scheduler_session::handle_buffer, this,
@@ -78,6 +79,7 @@ void scheduler_session::update_room_lists(std::vector<int>& rooms)
             }
         if (counter1 + counter2 > 0)
             spdlog::info(LOG_PREFIX "Updating room list: deleting {}, adding {}", counter1, counter2);
+        _room_list_loaded = true;
     });
 }
 
@@ -115,8 +117,11 @@ void scheduler_session::reset_worker(worker_status* worker)
     worker->initialized = false;
     worker->current_connections = 0;
     worker->max_rooms = -1;
+    worker->capabilities = 0;
     worker->allow_new_task_after = std::chrono::system_clock::now();
     worker->punished = false;
+    worker->session_id = 0;
+    worker->detached = false;
 }
 
 void scheduler_session::delete_worker(worker_status* worker)
@@ -217,28 +222,103 @@ void scheduler_session::check_worker_task_interval()
     VN_PROFILE_SCOPED(WorkerTaskIntervalCheck)
     auto now = std::chrono::system_clock::now();
     auto threshold = std::chrono::seconds(_config->worker.worker_timeout_sec);
+    std::vector<worker_status*> expired_workers, timeout_workers;
     for (auto& [_, worker] : _workers)
-        if (now - worker.last_received > threshold)
+        if (worker.detached)
         {
-            spdlog::warn(LOG_PREFIX "[{0:016x}] Worker exceeding max interval, disconnecting!", worker.current_connections);
-            delete_and_disconnect_worker(&worker);
+            if (now > worker.detached_until)
+                expired_workers.push_back(&worker);
         }
+        else if (now - worker.last_received > threshold)
+            timeout_workers.push_back(&worker);
+    for (auto worker : expired_workers)
+    {
+        spdlog::warn(LOG_PREFIX "[{0:016x}] Session {1:016x} didn't come back. Releasing its tasks.", worker->identifier, worker->session_id);
+        delete_worker(worker);
+    }
+    for (auto worker : timeout_workers)
+    {
+        spdlog::warn(LOG_PREFIX "[{0:016x}] Worker exceeding max interval, disconnecting!", worker->identifier);
+        delete_and_disconnect_worker(worker);
+    }
     for (auto it = _tasks.begin(); it != _tasks.end();)
     {
         auto last_recv = it->last_received;
         if (now - last_recv < threshold)
+        {
             ++it;
-        else
+            continue;
+        }
+        auto worker_iter = _workers.find(it->identifier);
+        if (worker_iter != _workers.end() && worker_iter->second.detached)
         {
-            auto identifier = it->identifier;
-            auto room_id = it->room_id;
-            it = delete_task<tasks_by_identifier_and_room_id>(it);
-            send_unassign(identifier, room_id);
-            spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Task exceeding max interval, unassigning!", identifier, room_id);
+            ++it;  // 等待会话恢复
+            continue;
         }
+        auto identifier = it->identifier;
+        auto room_id = it->room_id;
+        it = delete_task<tasks_by_identifier_and_room_id>(it);
+        send_unassign(identifier, room_id);
+        spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Task exceeding max interval, unassigning!", identifier, room_id);
     }
 }
 
+void scheduler_session::adopt_session(worker_status* worker, uint64_t session_id, const unsigned char* rooms, size_t room_count,
+                                      std::chrono::system_clock::time_point now)
+{
+    worker->session_id = session_id;
+
+    // 同一会话之前的连接，可能已断开等待恢复，也可能还没有发现断开
+    worker_status* previous = nullptr;
+    for (auto& [_, other] : _workers)
+        if (&other != worker && other.session_id == session_id)
+        {
+            previous = &other;
+            break;
+        }
+    if (previous != nullptr)
+    {
+        auto previous_identifier = previous->identifier;
+        auto detached = previous->detached;
+        spdlog::info(LOG_PREFIX "[{0:016x}] Resuming session {1:016x} from worker {2:016x}.", worker->identifier, session_id, previous_identifier);
+        worker->allow_new_task_after = previous->allow_new_task_after;
+        worker->punished = previous->punished;
+        delete_worker(previous);
+        if (!detached)
+            _worker_session->disconnect_worker(previous_identifier);
+    }
+
+    int adopted = 0, rejected = 0;
+    for (size_t i = 0; i < room_count; i++)
+    {
+        room_id_t room_id = boost::asio::detail::socket_ops::network_to_host_long(
+            *reinterpret_cast<const uint32_t*>(rooms + i * room_id_length));
+        auto room_iter = _rooms.find(room_id);
+        if (room_iter == _rooms.end() && !_room_list_loaded)
+        {
+            // 刚启动，房间列表还没有拉取，先接管，等列表更新后再清理
+            room_iter = _rooms.emplace(
+                std::piecewise_construct,
+                std::forward_as_tuple(room_id),
+                std::forward_as_tuple(room_id)).first;
+        }
+        if (room_iter == _rooms.end() || !room_iter->second.active || worker->current_connections >= worker->max_rooms)
+        {
+            send_unassign(worker->identifier, room_id);
+            rejected++;
+            continue;
+        }
+        auto [task_iter, inserted] = _tasks.emplace(worker->identifier, room_id, now);
+        if (!inserted)
+            continue;
+        worker->current_connections++;
+        room_iter->second.current_connections++;
+        adopted++;
+    }
+    spdlog::info(LOG_PREFIX "[{0:016x}] Session {1:016x} resumed. Adopted {2} rooms, rejected {3} rooms.",
+                 worker->identifier, session_id, adopted, rejected);
+}
+
 void scheduler_session::send_assign(identifier_t identifier, room_id_t room_id)
 {
     SPDLOG_TRACE(LOG_PREFIX "[<{0:016x},{1}>] Sending assign packet.", identifier, room_id);
@@ -285,7 +365,8 @@ void scheduler_session::check_all_states()
     auto max_new_per_bunch = _config->worker.max_new_tasks_per_bunch;
     std::vector<worker_status*> workers_available;
     for (auto& [_, worker] : _workers)
-        if (worker.current_connections < worker.max_rooms
+        if (!worker.detached
+            && worker.current_connections < worker.max_rooms
             && worker.allow_new_task_after < current_time)
         {
             workers_available.push_back(&worker);
@@ -333,6 +414,12 @@ void scheduler_session::check_all_states()
     std::sort(room_need_proc.begin(), room_need_proc.end(), room_status_less_tasks);
     VN_PROFILE_END()
 
+    if (current_time < _assign_after)
+    {
+        SPDLOG_DEBUG(LOG_PREFIX "In startup grace period. Waiting for workers resuming sessions.");
+        return;
+    }
+
     SPDLOG_DEBUG(LOG_PREFIX "Use max t/rm: {}, current min t/rm:", max_tasks_per_room, current_min_tasks_per_room);
     VN_PROFILE_BEGIN(AssignTask)
     for (auto it = room_need_proc.begin(); it != room_need_proc.end(); ++it)
@@ -454,14 +541,67 @@ void scheduler_session::handle_buffer(
             spdlog::info(LOG_PREFIX "[{:016x}] Auth failed. Disconnecting worker.", identifier);
             delete_worker(worker_ptr);
             _worker_session->disconnect_worker(identifier);
+            return;
         }
         // see simple_worker_proto.h
         auto max_rooms = room_id; // max_rooms is in the place of room_id
-        spdlog::info(LOG_PREFIX "[{0:016x}] Worker ready. rmax={1}", identifier, max_rooms);
+        // 旧版本的 worker 不发送 FLAGS，也不认识 SUPERVISOR READY
+        bool has_flags = payload_len >= worker_ready_payload_length + worker_ready_flags_length;
+        uint32_t flags = 0, dictionary_id = 0;
+        if (has_flags)
+        {
+            flags = boost::asio::detail::socket_ops::network_to_host_long(
+                *reinterpret_cast<uint32_t*>(payload_data + worker_ready_payload_length));
+            dictionary_id = boost::asio::detail::socket_ops::network_to_host_long(
+                *reinterpret_cast<uint32_t*>(payload_data + worker_ready_payload_length + sizeof(uint32_t)));
+        }
+        uint64_t session_id = 0;
+        const unsigned char* resume_rooms = nullptr;
+        size_t resume_room_count = 0;
+        auto session_offset = worker_ready_payload_length + worker_ready_flags_length;
+        if ((flags & capability_session_resume) && payload_len >= session_offset + worker_ready_session_header_length)
+        {
+            resume_room_count = boost::asio::detail::socket_ops::network_to_host_long(
+                *reinterpret_cast<uint32_t*>(payload_data + session_offset + sizeof(uint64_t)));
+            if (payload_len >= session_offset + worker_ready_session_header_length + resume_room_count * room_id_length)
+            {
+                session_id = network_to_host_longlong(*reinterpret_cast<uint64_t*>(payload_data + session_offset));
+                resume_rooms = payload_data + session_offset + worker_ready_session_header_length;
+            }
+            else
+            {
+                spdlog::warn(LOG_PREFIX "[{:016x}] Malformed session in worker ready packet. Ignoring.", identifier);
+                resume_room_count = 0;
+            }
+        }
+        spdlog::info(LOG_PREFIX "[{0:016x}] Worker ready. rmax={1}, flags={2:08x}, dict={3:08x}, session={4:016x}, rooms={5}",
+                     identifier, max_rooms, flags, dictionary_id, session_id, resume_room_count);
         // Reset worker.
         reset_worker(worker_ptr);
         worker_ptr->initialized = true;
         worker_ptr->max_rooms = max_rooms;
+        worker_ptr->capabilities = flags & capability_data_batch;
+        if ((flags & capability_link_compression) && _config->worker.link_compression)
+        {
+            if (dictionary_id == _worker_session->link_dictionary_id())
+            {
+                worker_ptr->capabilities |= capability_link_compression;
+                _worker_session->enable_link_compression(identifier);
+            }
+            else
+                spdlog::warn(LOG_PREFIX "[{0:016x}] Link compression dictionary mismatch: {1:08x} != {2:08x}. Compression disabled.",
+                             identifier, dictionary_id, _worker_session->link_dictionary_id());
+        }
+        bool resume = session_id != 0 && _config->worker.session_resume;
+        if (resume)
+            worker_ptr->capabilities |= capability_session_resume;
+        if (has_flags)
+        {
+            auto [buf, siz] = generate_supervisor_ready_packet(worker_ptr->capabilities);  // regular unsigned char[]
+            send_to_identifier(identifier, buf, siz, unsigned_char_array_deleter);
+        }
+        if (resume)
+            adopt_session(worker_ptr, session_id, resume_rooms, resume_room_count, current_time);
         check_all_states();
     }
     else if (op_code == room_failed_code)
@@ -472,52 +612,125 @@ void scheduler_session::handle_buffer(
     }
     else if (op_code == worker_data_code)
     {
-        if (payload_len < worker_data_payload_header_length)  // 1 + 4 + 4 + 32
+        if (payload_len < worker_data_payload_header_length)  // 1 + 4 + 8 + 32
         {
-            SPDLOG_TRACE(LOG_PREFIX "Malformed data packet: wrong payload len {}!=41!", payload_len);
+            SPDLOG_TRACE(LOG_PREFIX "Malformed data packet: wrong payload len {}<45!", payload_len);
             return;
         }
 
-        tasks_by_identifier_and_room_id_t& idx = _tasks.get<0>();
-        auto task_iter = idx.find(boost::make_tuple(identifier, room_id));
-        if (task_iter == idx.end())
+        checksum_t checksum = network_to_host_longlong(*reinterpret_cast<checksum_t*>(payload_data + 1 + room_id_length));
+        auto routing_key = reinterpret_cast<char*>(payload_data) + 1 + room_id_length + checksum_length;
+        auto routing_key_len = strnlen(routing_key, routing_key_max_size);
+        handle_worker_data(
+            identifier, room_id, checksum,
+            std::string_view(routing_key, routing_key_len),
+            payload_data + worker_data_payload_header_length,
+            payload_len - worker_data_payload_header_length,
+            current_time);
+    }
+    else if (op_code == worker_data_batch_code)
+    {
+        if (!(worker_ptr->capabilities & capability_data_batch))
+        {
+            SPDLOG_TRACE(LOG_PREFIX "[{:016x}] Unexpected data batch: batching not negotiated.", identifier);
             return;
+        }
+        handle_worker_data_batch(identifier, payload_data + worker_data_batch_header_length,
+                                 payload_len - worker_data_batch_header_length, current_time);
+    }
+}
 
-        idx.modify(task_iter, [current_time](room_task& it) -> void
+void scheduler_session::handle_worker_data_batch(identifier_t identifier, const unsigned char* data, size_t len,
+                                                 std::chrono::system_clock::time_point now)
+{
+    VN_PROFILE_SCOPED(HandleWorkerDataBatch)
+    using boost::asio::detail::socket_ops::network_to_host_long;
+    auto ptr = data;
+    auto end = data + len;
+    while (ptr < end)
+    {
+        if (static_cast<size_t>(end - ptr) < worker_data_entry_header_length)
         {
-            it.last_received = current_time;
-        });
-        auto crc32 = *reinterpret_cast<checksum_t*>(payload_data + 5);
-
-        if (crc32 == 0)
+            SPDLOG_TRACE(LOG_PREFIX "[{:016x}] Malformed data batch: truncated entry header.", identifier);
+            return;
+        }
+        room_id_t room_id = network_to_host_long(*reinterpret_cast<const simple_message_header*>(ptr));
+        ptr += room_id_length;
+        checksum_t checksum = network_to_host_longlong(*reinterpret_cast<const checksum_t*>(ptr));
+        ptr += checksum_length;
+        size_t routing_key_len = *(ptr++);
+        if (routing_key_len > routing_key_max_size
+            || static_cast<size_t>(end - ptr) < routing_key_len + worker_data_entry_payload_length_length)
         {
-            auto room_iter = _rooms.find(room_id);
-            if (room_iter == _rooms.end())
-                return;
-            auto& room = room_iter->second;
-            if ((current_time - room.last_empty_crc_received) < std::chrono::seconds(_config->message.min_interval_popularity_sec))
-                return;
-            room.last_empty_crc_received = current_time;
+            SPDLOG_TRACE(LOG_PREFIX "[{:016x}] Malformed data batch: bad routing key.", identifier);
+            return;
+        }
+        auto routing_key = reinterpret_cast<const char*>(ptr);
+        ptr += routing_key_len;
+        size_t entry_payload_len = network_to_host_long(*reinterpret_cast<const uint32_t*>(ptr));
+        ptr += worker_data_entry_payload_length_length;
+        if (static_cast<size_t>(end - ptr) < entry_payload_len)
+        {
+            SPDLOG_TRACE(LOG_PREFIX "[{:016x}] Malformed data batch: truncated payload.", identifier);
+            return;
         }
 
-        auto routing_key = reinterpret_cast<char*>(payload_data) + 9;
-        auto routing_key_len = strnlen(routing_key, routing_key_max_size);
-        spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Received data packet. payload_len={2}, CRC32={3}, rk={4}",
-            identifier, room_id, payload_len - 33, crc32, std::string_view(routing_key, routing_key_len));
+        handle_worker_data(identifier, room_id, checksum, std::string_view(routing_key, routing_key_len),
+                           ptr, entry_payload_len, now);
+        ptr += entry_payload_len;
+    }
+}
 
-        _data_handler(
-            crc32,
-            std::string_view(routing_key, routing_key_len),
-            reinterpret_cast<unsigned char*>(payload_data) + worker_data_payload_header_length,
-            payload_len - worker_data_payload_header_length);
+void scheduler_session::handle_worker_data(identifier_t identifier, room_id_t room_id, checksum_t checksum, std::string_view routing_key,
+                                           const unsigned char* payload, size_t payload_len, std::chrono::system_clock::time_point now)
+{
+    tasks_by_identifier_and_room_id_t& idx = _tasks.get<0>();
+    auto task_iter = idx.find(boost::make_tuple(identifier, room_id));
+    if (task_iter == idx.end())
+        return;
+
+    idx.modify(task_iter, [now](room_task& it) -> void
+    {
+        it.last_received = now;
+    });
+
+    if (checksum == 0)
+    {
+        auto room_iter = _rooms.find(room_id);
+        if (room_iter == _rooms.end())
+            return;
+        auto& room = room_iter->second;
+        if ((now - room.last_empty_checksum_received) < std::chrono::seconds(_config->message.min_interval_popularity_sec))
+            return;
+        room.last_empty_checksum_received = now;
     }
+
+    spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Received data packet. payload_len={2}, checksum={3:016x}, rk={4}",
+        identifier, room_id, payload_len, checksum, routing_key);
+
+    _data_handler(checksum, routing_key, payload, payload_len);
 }
 
 void scheduler_session::handle_worker_disconnect(identifier_t identifier)
 {
+    auto iter = _workers.find(identifier);
+    if (iter != _workers.end())
+    {
+        auto& worker = iter->second;
+        auto grace = std::chrono::seconds(_config->worker.session_grace_sec);
+        if (worker.initialized && worker.session_id != 0 && grace.count() > 0)
+        {
+            // 保留任务，房间不会被重新分配，等待 worker 恢复会话
+            spdlog::warn(LOG_PREFIX "[{0:016x}] Worker disconnected. Keeping {1} tasks of session {2:016x} for {3}s.",
+                         identifier, worker.current_connections, worker.session_id, grace.count());
+            worker.detached = true;
+            worker.detached_until = std::chrono::system_clock::now() + grace;
+            return;
+        }
+    }
+
     spdlog::warn(LOG_PREFIX "[{0:016x}] Worker disconnected. Deleting.", identifier);
     clear_worker_tasks(identifier);
-    auto iter = _workers.find(identifier);
     if (iter != _workers.end())
         delete_worker(&(iter->second));
 }
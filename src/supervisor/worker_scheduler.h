@@ -29,6 +29,10 @@ private:
     supervisor_diagnostics_context _diag_context;
 
     std::chrono::system_clock::time_point _last_checked;
+    ///
+    /// 启动后的一段时间内不分配新任务，等待原有的 worker 恢复会话。
+    std::chrono::system_clock::time_point _assign_after;
+    bool _room_list_loaded = false;
 
     supervisor_data_handler _data_handler;
     supervisor_diag_data_handler _diag_data_handler;
@@ -90,15 +94,29 @@ private:
     void check_all_states();
     void update_diagnostics(int max_tasks_per_room);
 
+    ///
+    /// 恢复会话：接管同一 SESSION_ID 之前的连接，把 WORKER READY 中列出的房间作为该 worker 的任务。\n
+    /// 不接管的房间会发送 UNASSIGN。
+    /// @param rooms WORKER READY 中的 ROOM_ID 列表，网络字节序
+    void adopt_session(worker_status* worker, uint64_t session_id, const unsigned char* rooms, size_t room_count,
+                       std::chrono::system_clock::time_point now);
+
     void send_assign(identifier_t identifier, room_id_t room);
     void send_unassign(identifier_t identifier, room_id_t room);
     ///
     /// Called when a new worker connected but didn't sent WORKER_READY packet yet.
     void handle_new_worker(identifier_t identifier);
     void handle_buffer(identifier_t identifier, unsigned char* payload_data, size_t payload_len);
+    ///
+    /// 处理一条弹幕数据。payload 指向读取缓冲区内部，不复制。
+    void handle_worker_data(identifier_t identifier, room_id_t room_id, checksum_t checksum, std::string_view routing_key,
+                            const unsigned char* payload, size_t payload_len, std::chrono::system_clock::time_point now);
+    ///
+    /// 逐项拆开 WORKER DATA BATCH。
+    void handle_worker_data_batch(identifier_t identifier, const unsigned char* data, size_t len, std::chrono::system_clock::time_point now);
     void handle_worker_disconnect(identifier_t identifier);
     void send_to_identifier(identifier_t identifier, unsigned char* payload,
-                            size_t size, std::function<void(unsigned char*)> deleter);
+                            size_t size, supervisor_buffer_deleter deleter);
 
 public:
     scheduler_session(
@@ -37,6 +37,9 @@ struct worker_status
     bool initialized = false;
     int max_rooms = -1;
     ///
+    /// WORKER READY 中协商确认的功能，见 simple_worker_proto.h
+    uint32_t capabilities = 0;
+    ///
     /// Not necessarily real-time!
     int current_connections = 0;
     /// <summary>
@@ -51,6 +54,14 @@ struct worker_status
     /// 用于判断是将断线惩罚累加到 allow_new_task_after 还是从当前时间开始计算。
     bool punished = false;
 
+    ///
+    /// WORKER READY 中的 SESSION_ID，0 为不支持会话恢复。
+    uint64_t session_id = 0;
+    ///
+    /// 连接已断开，但在 detached_until 之前保留任务，等待同一会话重新连接。
+    bool detached = false;
+    std::chrono::system_clock::time_point detached_until;
+
     worker_status(identifier_t identifier, std::chrono::system_clock::time_point first_received)
         : identifier(identifier), last_received(first_received)
     {
@@ -62,7 +73,7 @@ struct room_status
     room_id_t room_id;
 
     bool active = true;
-    std::chrono::system_clock::time_point last_empty_crc_received;
+    std::chrono::system_clock::time_point last_empty_checksum_received;
     ///
     /// Not necessarily real-time!
     int current_connections = 0;
@@ -0,0 +1,267 @@
+#include "admission_controller.h"
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <random>
+
+namespace vNerve::bilibili
+{
+namespace
+{
+const size_t max_latency_samples = 4096;
+
+/// samples 会被重新排列
+uint32_t percentile(std::vector<uint32_t>& samples, const double ratio)
+{
+    if (samples.empty())
+        return 0;
+    auto index = std::min(static_cast<size_t>(ratio * samples.size()), samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+}  // namespace
+
+admission_controller::admission_controller(boost::asio::io_context& context, const config::config_t& options, admit_handler admit)
+    : _admit(std::move(admit)),
+      _timer(context),
+      _max_handshakes(std::max((*options)["max-concurrent-handshakes"].as<int>(), 1)),
+      _rate(std::max((*options)["connect-rate"].as<double>(), 0.0)),
+      _burst(std::max((*options)["connect-burst"].as<double>(), 1.0)),
+      _tokens(_burst),
+      _last_refill(clock::now()),
+      _backoff_base((*options)["connect-backoff-ms"].as<int>()),
+      _backoff_max((*options)["connect-backoff-max-ms"].as<int>())
+{
+}
+
+void admission_controller::request(const int room_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending_rooms.count(room_id) || _handshaking.count(room_id))
+        {
+            SPDLOG_DEBUG("[admit] Room {} is already connecting.", room_id);
+            return;
+        }
+
+        auto now = clock::now();
+        auto not_before = now;
+        auto backoff_iter = _backoff.find(room_id);
+        if (backoff_iter != _backoff.end() && backoff_iter->second.not_before > now)
+        {
+            not_before = backoff_iter->second.not_before;
+            _deferred_count++;
+            spdlog::debug("[admit] Deferring room {} for {}ms after {} failures.", room_id,
+                          std::chrono::duration_cast<std::chrono::milliseconds>(not_before - now).count(),
+                          backoff_iter->second.failures);
+        }
+        _pending.push_back(pending_room{room_id, now, not_before});
+        _pending_rooms.insert(room_id);
+    }
+    pump();
+}
+
+bool admission_controller::cancel(const int room_id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_pending_rooms.erase(room_id))
+        return false;
+    _pending.remove_if([room_id](const pending_room& room) -> bool { return room.room_id == room_id; });
+    return true;
+}
+
+std::vector<int> admission_controller::cancel_all()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<int> rooms(_pending_rooms.begin(), _pending_rooms.end());
+    _pending.clear();
+    _pending_rooms.clear();
+    return rooms;
+}
+
+void admission_controller::pump()
+{
+    std::vector<int> admitted;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto now = clock::now();
+        if (_rate > 0)
+        {
+            _tokens = std::min(_burst, _tokens + _rate * std::chrono::duration<double>(now - _last_refill).count());
+            _last_refill = now;
+        }
+
+        auto wake = clock::time_point::max();
+        for (auto iter = _pending.begin(); iter != _pending.end() && _handshaking.size() < _max_handshakes;)
+        {
+            if (iter->not_before > now)
+            {
+                wake = std::min(wake, iter->not_before);
+                ++iter;
+                continue;
+            }
+            if (_rate > 0)
+            {
+                if (_tokens < 1)
+                {
+                    wake = std::min(wake, now + std::chrono::duration_cast<clock::duration>(
+                                                    std::chrono::duration<double>((1 - _tokens) / _rate)));
+                    break;
+                }
+                _tokens -= 1;
+            }
+
+            _handshaking[iter->room_id] = now;
+            record(_queue_ms, now - iter->requested);
+            _admitted_count++;
+            admitted.push_back(iter->room_id);
+            _pending_rooms.erase(iter->room_id);
+            iter = _pending.erase(iter);
+        }
+        // 握手名额用完时由握手结束的事件唤醒，这里只等退避和令牌
+        if (wake != clock::time_point::max())
+            arm_timer(wake);
+    }
+    for (auto room_id : admitted)
+        _admit(room_id);
+}
+
+void admission_controller::arm_timer(const clock::time_point deadline)
+{
+    if (_timer_armed && _timer_deadline <= deadline)
+        return;
+    _timer_armed = true;
+    _timer_deadline = deadline;
+    _timer.expires_at(deadline);  // 会取消之前的等待
+    _timer.async_wait(boost::bind(&admission_controller::on_timer, this, boost::asio::placeholders::error));
+}
+
+void admission_controller::on_timer(const boost::system::error_code& ec)
+{
+    if (ec)
+        return;  // 被更早的期限取代，或者正在关闭
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _timer_armed = false;
+    }
+    pump();
+}
+
+admission_controller::clock::duration admission_controller::next_backoff(const int failures)
+{
+    thread_local std::minstd_rand engine(std::random_device{}());
+    auto delay = _backoff_base;
+    for (int i = 1; i < failures && delay < _backoff_max; i++)
+        delay *= 2;
+    delay = std::min(delay, _backoff_max);
+    if (delay.count() <= 1)
+        return delay;
+    // 抖动：在 [delay / 2, delay] 中均匀取值，让同时失败的房间错开重连
+    return std::chrono::milliseconds(
+        std::uniform_int_distribution<long long>(delay.count() / 2, delay.count())(engine));
+}
+
+void admission_controller::record(latency_samples& samples, const clock::duration elapsed)
+{
+    auto ms = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    if (samples.values.size() < max_latency_samples)
+        samples.values.push_back(ms);
+    else
+        samples.values[samples.seen % max_latency_samples] = ms;
+    samples.seen++;
+}
+
+bool admission_controller::release_locked(const int room_id)
+{
+    return _handshaking.erase(room_id) > 0;
+}
+
+void admission_controller::on_established(const int room_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto iter = _handshaking.find(room_id);
+        if (iter == _handshaking.end())
+            return;
+        record(_handshake_ms, clock::now() - iter->second);
+        _handshaking.erase(iter);
+        _backoff.erase(room_id);
+        _established_count++;
+    }
+    pump();
+}
+
+void admission_controller::on_failed(const int room_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        release_locked(room_id);
+        _failed_count++;
+        if (_backoff_base.count() > 0)
+        {
+            auto& backoff = _backoff[room_id];
+            backoff.failures++;
+            backoff.not_before = clock::now() + next_backoff(backoff.failures);
+        }
+    }
+    pump();
+}
+
+void admission_controller::release(const int room_id)
+{
+    bool released;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        released = release_locked(room_id);
+    }
+    if (released)
+        pump();
+}
+
+void admission_controller::report_statistics()
+{
+    std::vector<uint32_t> handshake_ms, queue_ms;
+    size_t pending, handshaking, backing_off;
+    uint64_t admitted, established, failed, deferred;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // 退避早已结束的房间不再需要记录
+        auto expired = clock::now() - _backoff_max;
+        for (auto iter = _backoff.begin(); iter != _backoff.end();)
+        {
+            if (iter->second.not_before < expired)
+                iter = _backoff.erase(iter);
+            else
+                ++iter;
+        }
+
+        handshake_ms.swap(_handshake_ms.values);
+        queue_ms.swap(_queue_ms.values);
+        _handshake_ms.seen = _queue_ms.seen = 0;
+        pending = _pending.size();
+        handshaking = _handshaking.size();
+        backing_off = _backoff.size();
+        admitted = std::exchange(_admitted_count, 0);
+        established = std::exchange(_established_count, 0);
+        failed = std::exchange(_failed_count, 0);
+        deferred = std::exchange(_deferred_count, 0);
+    }
+
+    spdlog::info("[admit] {} admitted, {} established, {} failed, {} deferred by backoff; {} pending, {} handshaking, {} rooms backing off now.",
+                 admitted, established, failed, deferred, pending, handshaking, backing_off);
+    if (!handshake_ms.empty())
+    {
+        auto max = *std::max_element(handshake_ms.begin(), handshake_ms.end());
+        spdlog::info("[admit] Handshake latency(ms): p50={} p90={} p99={} max={}",
+                     percentile(handshake_ms, 0.5), percentile(handshake_ms, 0.9), percentile(handshake_ms, 0.99), max);
+    }
+    if (!queue_ms.empty())
+    {
+        auto max = *std::max_element(queue_ms.begin(), queue_ms.end());
+        spdlog::info("[admit] Admission wait(ms): p50={} p90={} p99={} max={}",
+                     percentile(queue_ms, 0.5), percentile(queue_ms, 0.9), percentile(queue_ms, 0.99), max);
+    }
+}
+}  // namespace vNerve::bilibili
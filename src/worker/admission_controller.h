@@ -0,0 +1,112 @@
+#pragma once
+
+#include "config.h"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+///
+/// 打开房间连接的准入控制，避免冷启动或 Bilibili 故障恢复后所有房间同时握手。
+/// - 同时进行中的握手（获取配置、DNS、TCP、TLS、WebSocket）不超过 max-concurrent-handshakes 个；
+/// - 开始握手的速率受令牌桶限制（connect-rate 个每秒，容量 connect-burst）；
+/// - 连接失败的房间按指数退避加随机抖动延迟下一次打开（connect-backoff-ms 起，最多 connect-backoff-max-ms）。
+/// 等待中的房间按请求顺序排队，退避未结束的房间不阻塞后面的房间。
+/// 线程安全。准入回调在调用 request 或握手结束的线程、或定时器所在的线程上调用，调用时不持有锁。
+class admission_controller
+{
+public:
+    using admit_handler = std::function<void(int)>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct pending_room
+    {
+        int room_id;
+        clock::time_point requested;
+        clock::time_point not_before;  // 退避结束的时间
+    };
+
+    struct room_backoff
+    {
+        int failures;
+        clock::time_point not_before;
+    };
+
+    /// 统计周期内的耗时样本，超过上限后循环覆盖
+    struct latency_samples
+    {
+        std::vector<uint32_t> values;
+        uint64_t seen = 0;
+    };
+
+    std::mutex _mutex;
+    admit_handler _admit;
+    boost::asio::steady_timer _timer;
+    bool _timer_armed = false;
+    clock::time_point _timer_deadline;
+
+    size_t _max_handshakes;
+    double _rate;   // 每秒令牌数，0 为不限速
+    double _burst;
+    double _tokens;
+    clock::time_point _last_refill;
+    std::chrono::milliseconds _backoff_base;
+    std::chrono::milliseconds _backoff_max;
+
+    std::list<pending_room> _pending;
+    std::unordered_set<int> _pending_rooms;
+    std::unordered_map<int, clock::time_point> _handshaking;  // 房间号 -> 开始握手的时间
+    std::unordered_map<int, room_backoff> _backoff;
+
+    // 以下统计在锁内写入，report_statistics 读取后清空
+    latency_samples _handshake_ms;  // 开始握手到握手成功
+    latency_samples _queue_ms;      // 请求打开到获得准入
+    uint64_t _admitted_count = 0;
+    uint64_t _established_count = 0;
+    uint64_t _failed_count = 0;
+    uint64_t _deferred_count = 0;  // 因退避而延后的打开请求
+
+    void pump();
+    void on_timer(const boost::system::error_code& ec);
+    void arm_timer(clock::time_point deadline);
+    clock::duration next_backoff(int failures);
+    void record(latency_samples& samples, clock::duration elapsed);
+    /// 释放房间占用的握手名额，在锁内调用
+    bool release_locked(int room_id);
+
+public:
+    /// @param context 定时器所在的 io_context
+    admission_controller(boost::asio::io_context& context, const config::config_t& options, admit_handler admit);
+
+    ///
+    /// 请求打开房间，房间会排队直到获得准入。
+    void request(int room_id);
+    ///
+    /// 取消排队中的房间。
+    /// @return 房间还在排队中（因此从未开始连接）时返回 true
+    bool cancel(int room_id);
+    ///
+    /// 取消所有排队中的房间。
+    /// @return 被取消的房间
+    std::vector<int> cancel_all();
+
+    /// 握手成功，释放名额并清除房间的退避
+    void on_established(int room_id);
+    /// 连接失败（无论是否完成了握手），释放名额并增加房间的退避
+    void on_failed(int room_id);
+    /// 连接关闭，如果还在握手则释放名额
+    void release(int room_id);
+
+    void report_statistics();
+};
+}  // namespace vNerve::bilibili
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+///
+/// 所有会被处理的 cmd。新增 cmd 时需要在这里登记，并在 bili_json.cpp 中用 CMD(name) 定义处理函数。
+#define BILI_COMMANDS(X)             \
+    X(DANMU_MSG)                     \
+    X(SUPER_CHAT_MESSAGE)            \
+    X(SEND_GIFT)                     \
+    X(USER_TOAST_MSG)                \
+    X(WELCOME)                       \
+    X(WELCOME_GUARD)                 \
+    X(ROOM_BLOCK_MSG)                \
+    X(LIVE)                          \
+    X(PREPARING)                     \
+    X(ROUND)                         \
+    X(CUT_OFF)                       \
+    X(ROOM_CHANGE)                   \
+    X(CHANGE_ROOM_INFO)              \
+    X(ROOM_SKIN_MSG)                 \
+    X(ROOM_ADMINS)                   \
+    X(ROOM_LOCK)                     \
+    X(WARNING)                       \
+    X(ROOM_LIMIT)                    \
+    X(SUPER_CHAT_MESSAGE_DELETE)
+
+///
+/// 编译期生成的 cmd 完美哈希表：
+/// 寻找一个种子，使得所有 cmd 的 FNV-1a 哈希值在表中互不冲突，查找时只需一次哈希和一次比较。
+/// @tparam Size 表的大小，2 的幂，且大于 cmd 数量的两倍以减少找种子的次数
+/// @tparam Entry 含有 std::string_view name 成员的表项
+template <size_t Size, class Entry, size_t Count>
+class command_table
+{
+    static_assert((Size & (Size - 1)) == 0, "Command table size must be a power of 2.");
+    static_assert(Size >= Count * 2, "Command table too small.");
+
+private:
+    const Entry* _entries;
+    uint32_t _seed = 0;
+    int8_t _slots[Size] = {};
+
+    ///
+    /// 只取长度、前 4 个和后 4 个字符：已登记的 cmd 靠这些就能区分开，
+    /// 很长的未知 cmd（如 ROOM_REAL_TIME_MESSAGE_UPDATE）也不必逐字节哈希。
+    static constexpr uint32_t hash(std::string_view str, uint32_t seed)
+    {
+        uint32_t result = (2166136261u ^ seed) + static_cast<uint32_t>(str.size()) * 0x9E3779B1u;
+        auto mix = [&result](char ch) {
+            result ^= static_cast<unsigned char>(ch);
+            result *= 16777619u;
+        };
+        auto head = str.size() < 4 ? str.size() : 4;
+        for (size_t i = 0; i < head; i++)
+            mix(str[i]);
+        for (size_t i = str.size() < 8 ? head : str.size() - 4; i < str.size(); i++)
+            mix(str[i]);
+        return result ^ (result >> 15);
+    }
+
+    constexpr bool try_seed(uint32_t seed) const
+    {
+        bool used[Size] = {};
+        for (size_t i = 0; i < Count; i++)
+        {
+            auto slot = hash(_entries[i].name, seed) & (Size - 1);
+            if (used[slot])
+                return false;
+            used[slot] = true;
+        }
+        return true;
+    }
+
+public:
+    constexpr explicit command_table(const Entry (&entries)[Count])
+        : _entries(entries)
+    {
+        for (size_t i = 0; i < Count; i++)
+            if (_entries[i].name.find(':') != std::string_view::npos)
+                throw "Registered cmd must not contain ':'.";
+        while (!try_seed(_seed))
+            _seed++;
+        for (auto& slot : _slots)
+            slot = -1;
+        for (size_t i = 0; i < Count; i++)
+            _slots[hash(_entries[i].name, _seed) & (Size - 1)] = static_cast<int8_t>(i);
+    }
+
+    constexpr const Entry* find_exact(std::string_view cmd) const
+    {
+        auto index = _slots[hash(cmd, _seed) & (Size - 1)];
+        if (index < 0 || _entries[index].name != cmd)
+            return nullptr;
+        return &_entries[index];
+    }
+
+    ///
+    /// 查找 cmd 对应的表项。
+    /// b站会发送带后缀的 cmd（如 DANMU_MSG:4:0:2:2:2:0）。已登记的 cmd 都不含 ':'，
+    /// 所以精确匹配失败时只需再查一次第一个 ':' 之前的部分。
+    /// @return 未找到时返回 nullptr
+    constexpr const Entry* find(std::string_view cmd) const
+    {
+        auto entry = find_exact(cmd);
+        if (entry)
+            return entry;
+        auto colon = cmd.find(':');
+        if (colon == std::string_view::npos)
+            return nullptr;
+        return find_exact(cmd.substr(0, colon));
+    }
+};
+}  // namespace vNerve::bilibili
@@ -0,0 +1,370 @@
+#include "bili_conn.h"
+
+#include "bili_packet.h"
+#include "bilibili_connection_manager.h"
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bin_to_hex.h>
+
+#include <algorithm>
+
+namespace vNerve::bilibili
+{
+bilibili_connection::bilibili_connection(
+    bilibili_connection_manager* session, connection_shard* shard, int room_id)
+    : _framer(session->get_options()["max-read-buffer"].as<size_t>()),
+      _session(session),
+      _shard(shard),
+      _room_id(room_id)
+{
+    _parse_producer = _session->create_parse_producer(room_id);
+    _data_handler = std::bind(&bilibili_connection_manager::on_room_data, _session, _room_id, std::placeholders::_1);
+}
+
+void bilibili_connection::init()
+{
+    // 从获取配置到传输层握手完成的总超时，代替各个步骤自己的定时器
+    _handshake_timer = _shard->wheel.schedule(
+        _session->handshake_timeout(),
+        [weak = weak_from_this()]() -> void {
+            if (auto self = weak.lock())
+                self->on_handshake_timeout();
+        });
+    _shard->live_config.fetch(_room_id,
+                              std::bind(&bilibili_connection::on_config_fetched, shared_from_this(), std::placeholders::_1),
+                              [weak = weak_from_this()]() -> void {
+                                  if (auto self = weak.lock())
+                                      self->close(true);
+                              });
+}
+
+void bilibili_connection::on_config_fetched(bilibili_live_config const& config)
+{
+    if (_closed)
+        return;  // 获取配置期间超时或被关闭
+    _user_agent = &config.user_agent;
+    _token = config.token;
+    _servers = servers_of(config);
+    _tried.assign(_servers->size(), false);
+    if (!connect_next_server())
+        close(true);
+}
+
+bool bilibili_connection::connect_next_server()
+{
+    auto& servers = *_servers;
+    auto index = _session->server_selector().pick(servers, _tried);
+    if (index >= servers.size())
+        return false;
+    if (std::find(_tried.begin(), _tried.end(), true) != _tried.end())
+    {
+        spdlog::info("[conn] [room={}] Failing over to chat server {}:{}.",
+                     _room_id, servers[index].host, servers[index].port);
+        reset_transport();
+    }
+    _server_index = index;
+    _tried[index] = true;
+
+    auto& server = servers[index];
+    spdlog::debug(
+        "[session] Connecting room {} with server {}:{}, resolving DN.",
+        _room_id, server.host, server.port);
+    _session->dns().resolve(
+        _shard->context,
+        server.host,
+        std::to_string(server.port),
+        std::bind(&bilibili_connection::on_resolved, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    return true;
+}
+
+void bilibili_connection::fail_over()
+{
+    if (_closed)
+        return;
+    _session->server_selector().on_failed(current_server());
+    if (!connect_next_server())
+        close(true);
+}
+
+void bilibili_connection::on_resolved(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::results_type endpoints)
+{
+    if (_closed)
+    {
+        // 解析由 dns_cache 共享，不能取消，结果回来时再放弃
+        spdlog::debug(
+            "[conn] Cancelling connecting(resolving) to room {}.",
+            _room_id);
+        return;
+    }
+    if (err)
+    {
+        spdlog::warn(
+            "[conn] Failed resolving DN connecting to room {}! err: {}:{}",
+            _room_id, err.value(), err.message());
+        fail_over();
+        return;
+    }
+    _connect_started = std::chrono::steady_clock::now();
+    async_connect(socket(), endpoints,
+        boost::bind(&bilibili_connection::on_connected, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void bilibili_connection::on_connected(const boost::system::error_code& err)
+{
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+        {
+            spdlog::debug("[conn] Cancelling connecting to room {}.",
+                          _room_id);
+            return;
+        }
+        spdlog::warn("[conn] Failed connecting to room {}! Unable to establish tcp connection. err: {}:{}",
+                     _room_id, err.value(), err.message());
+        fail_over();
+        return;
+    }
+    auto& server = current_server();
+    _session->server_selector().record_rtt(server, std::chrono::steady_clock::now() - _connect_started);
+
+    spdlog::debug("[conn] [room={}] Connected to {}:{}. Setting up protocol.", _room_id, server.host, server.port);
+    handshake();
+}
+
+void bilibili_connection::on_transport_established()
+{
+    _established = true;
+    _session->on_room_established(_room_id);
+    _session->server_selector().on_established(current_server());
+    _shard->wheel.cancel(_handshake_timer);
+    _handshake_timer = 0;
+    _last_received = std::chrono::steady_clock::now();
+
+    start_read();
+
+    auto str = new std::string(generate_join_room_packet(
+        _room_id, _session->get_options()["protocol-ver"].as<int>(), _token));
+    std::string().swap(_token);
+    auto buffer = boost::asio::buffer(*str);
+    SPDLOG_TRACE(
+        "[conn] [room={}] Sending handshake packet with payload(len={}): {:Xs}",
+        _room_id, str->length(),
+        spdlog::to_hex(str->c_str(), str->c_str() + str->length()));
+    async_write(
+        buffer, boost::bind(&bilibili_connection::on_join_room_sent, shared_from_this(),
+                            boost::asio::placeholders::error,
+                            boost::asio::placeholders::bytes_transferred, str));
+    // Don't need a sending queue
+    // Because the sending frequency is low.
+}
+
+void bilibili_connection::on_join_room_sent(
+    const boost::system::error_code& err, const size_t transferred,
+    std::string* buf)
+{
+    delete buf;  // delete sending buffer.
+    if (err)
+    {
+        if (_closed)
+        {
+            SPDLOG_DEBUG("[conn] Cancelling handshake sending.");
+            return;  // closing socket.
+        }
+        spdlog::warn(
+            "[conn] [room={}] Failed sending handshake packet! err:{}: {}",
+            _room_id, err.value(), err.message());
+        close(true);
+        return;
+    }
+
+    SPDLOG_DEBUG(
+        "[conn] [room={}] Sent handshake packet. Bytes transferred: {}",
+        _room_id, transferred);
+    schedule_heartbeat(true);
+}
+
+void bilibili_connection::schedule_heartbeat(const bool first)
+{
+    auto delay = _session->next_heartbeat_delay(first);
+    SPDLOG_DEBUG("[conn] [room={}] Scheduling heartbeat, delay={}ms",
+                 _room_id, delay.count());
+    _heartbeat_timer = _shard->wheel.schedule(
+        delay,
+        [weak = weak_from_this()]() -> void {
+            if (auto self = weak.lock())
+                self->on_heartbeat_tick();
+        });
+}
+
+void bilibili_connection::on_handshake_timeout()
+{
+    _handshake_timer = 0;
+    if (_closed || _established)
+        return;
+    spdlog::warn("[conn] [room={}] Connecting timed out after {}s.",
+                 _room_id, std::chrono::duration_cast<std::chrono::seconds>(_session->handshake_timeout()).count());
+    close(true);
+}
+
+void bilibili_connection::on_heartbeat_tick()
+{
+    _heartbeat_timer = 0;
+    if (_closed)
+        return;
+
+    // 服务器会回复每个心跳，长时间没有数据说明连接已经失效。因背压暂停读取时不检查。
+    auto idle = _session->idle_timeout();
+    if (!_read_parked && idle.count() > 0 && std::chrono::steady_clock::now() - _last_received > idle)
+    {
+        spdlog::warn("[conn] [room={}] No data received in {}s. Reconnecting.",
+                     _room_id, std::chrono::duration_cast<std::chrono::seconds>(idle).count());
+        close(true);
+        return;
+    }
+
+    auto& buf = _session->get_heartbeat_buffer();
+    auto buf_ptr = reinterpret_cast<const char*>(buf.data());
+    SPDLOG_DEBUG(
+        "[conn] [room={}] Sending heartbeat packet with payload(len={}): {:Xs}",
+        _room_id, buf.size(), spdlog::to_hex(buf_ptr, buf_ptr + buf.size()));
+    _heartbeat_sent = std::chrono::steady_clock::now();
+    async_write(
+        buf, boost::bind(&bilibili_connection::on_heartbeat_sent, shared_from_this(),
+                         boost::asio::placeholders::error,
+                         boost::asio::placeholders::bytes_transferred));
+
+    schedule_heartbeat(false);
+}
+
+void bilibili_connection::on_heartbeat_sent(
+    const boost::system::error_code& err, const size_t transferred)
+{
+    if (err)
+    {
+        if (_closed)
+        {
+            SPDLOG_DEBUG("[conn] Cancelling heartbeat sending.");
+            return;  // closing socket.
+        }
+        spdlog::warn(
+            "[conn] [room={}] Failed sending heartbeat packet! err:{}: {}",
+            _room_id, err.value(), err.message());
+        close(true);
+        return;
+    }
+    // nothing to do.
+    SPDLOG_DEBUG(
+        "[conn] [room={}] Sent heartbeat packet. Bytes transferred: {}",
+        _room_id, transferred);
+}
+
+void bilibili_connection::start_read()
+{
+    if (_session->read_paused(_room_id) || (_parse_producer && _session->get_parse_pool()->congested(*_parse_producer)))
+    {
+        SPDLOG_TRACE("[conn] [room={}] Reading paused by backpressure.", _room_id);
+        _read_parked = true;
+        _shard->parked_connections.fetch_add(1, std::memory_order_relaxed);
+        _shard->reads_parked.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto limit = _framer.read_limit();
+    if (limit == 0)
+    {
+        spdlog::warn("[conn] [room={}] Read buffer is full! Reconnecting.", _room_id);
+        close(true);
+        return;
+    }
+    SPDLOG_TRACE("[conn] [room={}] Starting next async read. limit={}", _room_id, limit);
+    async_read(limit);
+}
+
+void bilibili_connection::on_receive(
+    const boost::system::error_code& err, const size_t transferred)
+{
+    if (err)
+    {
+        if (_closed)
+        {
+            SPDLOG_DEBUG("[conn] Cancelling async reading.");
+            return;  // closing socket.
+        }
+        // 包括服务器关闭了连接（eof 或 WebSocket 关闭帧）：房间不会再收到数据，按失败处理以便重新分配
+        spdlog::warn("[conn] [room={}] Error in async recv! err:{}: {}",
+                     _room_id, err.value(), err.message());
+        close(true);
+        return;
+    }
+
+    SPDLOG_DEBUG("[conn] [room={}] Received data block(len={})", _room_id,
+                 transferred);
+    _last_received = std::chrono::steady_clock::now();
+    _shard->reads.fetch_add(1, std::memory_order_relaxed);
+    _shard->bytes_received.fetch_add(transferred, std::memory_order_relaxed);
+    try
+    {
+        _framer.on_data([this](unsigned char* packet) -> void {
+            if (reinterpret_cast<bilibili_packet_header*>(packet)->op_code() == heartbeat_resp)
+                on_heartbeat_response();
+            if (_parse_producer)
+                _session->get_parse_pool()->submit(*_parse_producer, _room_id, packet);
+            else
+                handle_packet(packet, _room_id, _data_handler);
+        });
+    }
+    catch (malformed_packet&)
+    {
+        close(true);
+        return;
+    }
+
+    start_read();
+}
+
+void bilibili_connection::on_heartbeat_response()
+{
+    if (_heartbeat_sent == std::chrono::steady_clock::time_point{})
+        return;
+    _session->server_selector().record_rtt(current_server(), std::chrono::steady_clock::now() - _heartbeat_sent);
+    _heartbeat_sent = {};
+}
+
+void bilibili_connection::resume_read()
+{
+    if (!_read_parked || _closed)
+        return;
+    _read_parked = false;
+    _shard->parked_connections.fetch_sub(1, std::memory_order_relaxed);
+    _last_received = std::chrono::steady_clock::now();  // 暂停期间不算空闲
+    _heartbeat_sent = {};  // 回复可能在内核缓冲区里放了很久，不计入延迟
+    start_read();
+}
+
+void bilibili_connection::close(const bool failed)
+{
+    if (_closed)
+        return;
+    _closed = true;
+    if (_read_parked)
+    {
+        _read_parked = false;
+        _shard->parked_connections.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    _shard->wheel.cancel(_heartbeat_timer);
+    _shard->wheel.cancel(_handshake_timer);
+    _heartbeat_timer = _handshake_timer = 0;
+
+    shutdown(_established && !failed);
+
+    if (failed)
+    {
+        // 缓存的 token 或服务器可能已经失效，下次重新获取
+        if (!_established)
+            _shard->live_config.invalidate(_room_id);
+        _session->on_room_failed(_room_id);
+    }
+    _session->on_room_closed(_room_id);
+}
+}  // namespace vNerve::bilibili
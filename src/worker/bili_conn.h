@@ -0,0 +1,116 @@
+#pragma once
+
+#include "bilibili_live_config.h"
+#include "bili_packet.h"
+#include "bili_parse_pool.h"
+#include "timing_wheel.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace vNerve::bilibili
+{
+class bilibili_connection_manager;
+struct connection_shard;
+///
+/// 到弹幕服务器的一个房间连接，由 WebSocket (bilibili_connection_websocket) 和纯 TCP (bilibili_connection_plain_tcp) 实现。
+/// 连接属于一个分片，所有方法都只在分片的线程上调用。
+/// 连接自己获取弹幕服务器配置、选择服务器并发送心跳，结果通过 bilibili_connection_manager 的 on_room_* 回调报告。
+/// 这些都在基类中完成，派生类只负责传输层：TCP 连接之后的握手、读、写和关闭。
+class bilibili_connection : public std::enable_shared_from_this<bilibili_connection>
+{
+protected:
+    using write_handler = std::function<void(const boost::system::error_code&, size_t)>;
+
+    bili_packet_framer _framer;
+    bilibili_connection_manager* _session;
+    connection_shard* _shard;
+    int _room_id;
+    std::string const* _user_agent = nullptr;
+
+    bool _established = false;  // 传输层握手已完成
+    bool _closed = false;
+
+    bilibili_connection(bilibili_connection_manager* session, connection_shard* shard, int room_id);
+
+    template <typename T>
+    std::shared_ptr<T> shared_from_base() { return std::static_pointer_cast<T>(shared_from_this()); }
+
+    /// 正在连接的服务器
+    const chat_server& current_server() const { return (*_servers)[_server_index]; }
+    /// 当前服务器连接失败，换下一个服务器，都试过了则关闭连接
+    void fail_over();
+    /// 传输层握手完成后由派生类调用，开始读取并发送进房数据包
+    void on_transport_established();
+    /// 派生类的读取完成后调用，数据已经在 _framer.buffer() 中
+    void on_receive(const boost::system::error_code&, size_t);
+
+    /// 房间可用的弹幕服务器中本传输方式使用的列表
+    virtual const chat_server_list& servers_of(const bilibili_live_config& config) const = 0;
+    /// 最底层的 TCP socket，由基类解析域名后连接
+    virtual boost::asio::ip::tcp::socket& socket() = 0;
+    /// 换服务器重连前重新创建传输层
+    virtual void reset_transport() = 0;
+    /// TCP 连接建立后完成传输层自己的握手，成功调用 on_transport_established，失败调用 fail_over
+    virtual void handshake() = 0;
+    /// 读取最多 limit 字节到 _framer.buffer()，完成后调用 on_receive
+    virtual void async_read(size_t limit) = 0;
+    /// 发送一个数据包，buffer 在 handler 调用前保持有效
+    virtual void async_write(boost::asio::const_buffer buffer, write_handler handler) = 0;
+    /// 关闭传输层并取消进行中的操作。graceful 为 true 时连接仍然正常，可以进行关闭握手；
+    /// 在析构函数中调用时 weak_from_this() 已经为空。
+    virtual void shutdown(bool graceful) = 0;
+
+private:
+    std::unique_ptr<bili_parse_pool::room_producer> _parse_producer;  // 为空时在 IO 线程上直接解析
+    message_handler _data_handler;
+
+    // 分片时间轮中的定时器，0 为没有
+    timing_wheel::timer_id _heartbeat_timer = 0;
+    timing_wheel::timer_id _handshake_timer = 0;
+    std::chrono::steady_clock::time_point _last_received;
+    std::chrono::steady_clock::time_point _connect_started;
+    std::chrono::steady_clock::time_point _heartbeat_sent;  // 等待回复的心跳的发送时间，没有为默认值
+
+    std::string _token;  // 发送进房数据包后释放
+    chat_server_list _servers;  // 房间可用的弹幕服务器
+    std::vector<bool> _tried;   // 与 _servers 对应，本次连接已尝试过的服务器
+    size_t _server_index = 0;   // 正在连接的服务器
+
+    bool _read_parked = false;  // 因背压暂停读取，等待 resume_read
+
+    void schedule_heartbeat(bool first);
+    void on_handshake_timeout();
+    void start_read();
+
+    void on_config_fetched(const bilibili_live_config& config);
+    /// 挑选一个还没尝试过的服务器开始连接，都试过了返回 false
+    bool connect_next_server();
+    void on_heartbeat_response();
+    void on_resolved(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::results_type endpoints);
+    void on_connected(const boost::system::error_code& err);
+    void on_join_room_sent(const boost::system::error_code&, size_t,
+                           std::string*);
+    void on_heartbeat_sent(const boost::system::error_code&, size_t);
+    void on_heartbeat_tick();
+
+public:
+    /// 派生类的析构函数需要调用 close(false)，基类析构时传输层已经销毁
+    virtual ~bilibili_connection() = default;
+
+    bilibili_connection(const bilibili_connection& other) = delete;
+    bilibili_connection& operator=(const bilibili_connection& other) = delete;
+
+    /// 开始连接，需要在连接被 shared_ptr 持有之后调用
+    void init();
+    void close(bool failed = false);
+    bool closed() const { return _closed; }
+    /// 恢复因背压暂停的读取
+    void resume_read();
+};
+}  // namespace vNerve::bilibili
@@ -1,116 +1,54 @@
 #include "bili_conn_ws.h"
 
-#include "bili_packet.h"
 #include "bilibili_connection_manager.h"
+#include "tls_context.h"
 
-#include <boost/bind.hpp>
 #include <spdlog/spdlog.h>
-#include <spdlog/fmt/bin_to_hex.h>
 
 namespace vNerve::bilibili
 {
-boost::asio::ssl::context* ssl_context = nullptr;
-
-bool configure_ssl_context()
+namespace
 {
-    ssl_context = new boost::asio::ssl::context{boost::asio::ssl::context::tls_client};
-    try
-    {
-        ssl_context->load_verify_file("cacert.pem");
-    }
-    catch (boost::system::system_error& err)
-    {
-        spdlog::critical("[conn] Failed to initialize ssl_context from file cacert.pem! Ensure you have a valid CA cert file. err:{}:{}", err.code().value(), err.code().message());
-        throw;
-    }
-    spdlog::info("[conn] Initialized SSL Context from cacert.pem.");
-    return true;
-}
-static const bool ssl_context_configured = configure_ssl_context();
+const size_t ws_write_buffer_bytes = 512;
+// 正常关闭时等待服务器回应关闭握手的最长时间，超时后直接关闭 socket
+const std::chrono::milliseconds ws_close_timeout(5000);
+}  // namespace
 
 bilibili_connection_websocket::bilibili_connection_websocket(
-    bilibili_connection_manager* session, int room_id)
-    : _resolver(session->get_io_context()),
-      _read_buffer(session->get_options()["read-buffer"].as<size_t>()),
-      _session(session),
-      _ws_stream(make_strand(session->get_io_context()), *ssl_context),
-      _heartbeat_timer(std::make_unique<boost::asio::deadline_timer>(_session->get_io_context())),
-      _room_id(room_id),
-      _heartbeat_interval_sec(_session->get_options()["heartbeat-timeout"].as<int>())
+    bilibili_connection_manager* session, connection_shard* shard, int room_id)
+    : bilibili_connection(session, shard, room_id)
 {
+    _ws_stream.emplace(shard->context, client_tls_context());  // 分片只由一个线程运行，不需要 strand
 }
 
 bilibili_connection_websocket::~bilibili_connection_websocket()
-{\
+{
     close(false);
 }
 
-void bilibili_connection_websocket::init()
+boost::asio::ip::tcp::socket& bilibili_connection_websocket::socket()
 {
-    async_fetch_bilibili_live_config(_session->get_io_context(), _resolver, _session->get_options_ptr(), _room_id,
-                                     std::bind(&bilibili_connection_websocket::on_config_fetched, shared_from_this(), std::placeholders::_1),
-                                     [&]() -> void {
-                                         _session->on_room_failed(_room_id);
-                                     });
+    return get_lowest_layer(*_ws_stream).socket();
 }
 
-void bilibili_connection_websocket::on_config_fetched(bilibili_live_config const& config)
+void bilibili_connection_websocket::reset_transport()
 {
-    _user_agent = &config.user_agent;
-    _token = config.token;
-    spdlog::debug(
-        "[session] Connecting room {} with server {}:{}, resolving DN.",
-        _room_id, config.host, config.port);
-    _resolver.async_resolve(
-            config.host,
-            std::to_string(config.port),
-            boost::bind(&bilibili_connection_websocket::on_resolved, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::iterator));
+    _ws_stream.emplace(_shard->context, client_tls_context());
 }
 
-void bilibili_connection_websocket::on_resolved(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::results_type endpoints)
+void bilibili_connection_websocket::handshake()
 {
-    if (err)
+    auto& host = current_server().host;  // 用作 SNI 和 TLS 会话缓存的键
+    if (!prepare_tls_session(_ws_stream->next_layer().native_handle(), host))
     {
-        if (err.value() == boost::asio::error::operation_aborted)
-        {
-            spdlog::debug(
-                "[conn] Cancelling connecting(resolving) to room {}.",
-                _room_id);
-            return;
-        }
-        spdlog::warn(
-            "[conn] Failed resolving DN connecting to room {}! err: {}:{}",
-            _room_id, err.value(), err.message());
-        _session->on_room_failed(_room_id);
+        spdlog::warn("[conn] Failed connecting to room {}! Unable to set SNI {}.", _room_id, host);
+        fail_over();
         return;
     }
-    auto& lowest = get_lowest_layer(_ws_stream);
-    lowest.expires_after(std::chrono::seconds(10));
-    async_connect(lowest.socket(), endpoints, boost::bind(&bilibili_connection_websocket::on_connected, shared_from_this(), boost::asio::placeholders::error));
-}
-
-void bilibili_connection_websocket::on_connected(const boost::system::error_code& err)
-{
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted)
-        {
-            spdlog::debug("[conn] Cancelling connecting to room {}.",
-                          _room_id);
-            return;
-        }
-        spdlog::warn("[conn] Failed connecting to room {}! Unable to establish tcp connection. err: {}:{}",
-                     _room_id, err.value(), err.message());
-        close(true);
-        return;
-    }
-
-    spdlog::debug("[conn] Connected to room {}. Setting up SSL & websocket protocol.", _room_id);
-
-    get_lowest_layer(_ws_stream).expires_after(std::chrono::seconds(10));
-    _ws_stream.next_layer().async_handshake(
+    _tls_handshake_started = std::chrono::steady_clock::now();
+    _ws_stream->next_layer().async_handshake(
         boost::asio::ssl::stream_base::client,
-        boost::bind(&bilibili_connection_websocket::on_ssl_handshake, shared_from_this(), boost::asio::placeholders::error));
+        boost::beast::bind_front_handler(&bilibili_connection_websocket::on_ssl_handshake, shared_from_base<bilibili_connection_websocket>()));
 }
 
 void bilibili_connection_websocket::on_ssl_handshake(const boost::system::error_code& err)
@@ -125,25 +63,35 @@ void bilibili_connection_websocket::on_ssl_handshake(const boost::system::error_
         }
         spdlog::warn("[conn] Failed connecting to room {}! Unable to perform SSL handshake. err: {}:{}",
                      _room_id, err.value(), err.message());
-        close(true);
+        record_tls_handshake_failure(_ws_stream->next_layer().native_handle());
+        fail_over();
         return;
     }
+    record_tls_handshake(_ws_stream->next_layer().native_handle(), std::chrono::steady_clock::now() - _tls_handshake_started);
 
     spdlog::debug("[conn] [room={}] SSL handshake succeeded. Setting up websocket protocol.", _room_id);
 
-    get_lowest_layer(_ws_stream).expires_never();
-    _ws_stream.set_option(boost::beast::websocket::stream_base::timeout::suggested(boost::beast::role_type::client));
-    _ws_stream.set_option(boost::beast::websocket::stream_base::decorator(
+    // 握手超时和空闲检测都由分片时间轮负责
+    _ws_stream->set_option(boost::beast::websocket::stream_base::timeout{
+        boost::beast::websocket::stream_base::none(),
+        boost::beast::websocket::stream_base::none(),
+        false});
+    // 客户端只发送心跳和进房数据包，用不到默认 4KB 的掩码缓冲区。
+    // 超过缓冲区的消息分段掩码，但仍作为一帧发送。
+    _ws_stream->auto_fragment(false);
+    _ws_stream->write_buffer_bytes(ws_write_buffer_bytes);
+    _ws_stream->set_option(boost::beast::websocket::stream_base::decorator(
         [this](boost::beast::websocket::request_type& req) {
-            req.set(boost::beast::http::field::user_agent, _user_agent);
+            req.set(boost::beast::http::field::user_agent, *_user_agent);
             req.set(boost::beast::http::field::accept_language, "zh-CN,zh;q=0.9");
             req.set(boost::beast::http::field::accept_encoding, "gzip, deflate");
             req.set(boost::beast::http::field::pragma, "no-cache");
             req.set(boost::beast::http::field::cache_control, "no-cache");
         }));
     auto config = _session->get_options();
-    auto host = config["chat-server"].as<std::string>() + ':' + std::to_string(config["chat-server-port"].as<int>());
-    _ws_stream.async_handshake(host, config["chat-server-endpoint"].as<std::string>(), boost::beast::bind_front_handler(&bilibili_connection_websocket::on_handshake, shared_from_this()));
+    auto& server = current_server();
+    auto host = server.host + ':' + std::to_string(server.port);
+    _ws_stream->async_handshake(host, config["chat-server-endpoint"].as<std::string>(), boost::beast::bind_front_handler(&bilibili_connection_websocket::on_handshake, shared_from_base<bilibili_connection_websocket>()));
 }
 
 void bilibili_connection_websocket::on_handshake(const boost::system::error_code& err)
@@ -158,174 +106,57 @@ void bilibili_connection_websocket::on_handshake(const boost::system::error_code
         }
         spdlog::warn("[conn] Failed connecting to room {} when WebSocket handshaking! err: {}:{}",
                      _room_id, err.value(), err.message());
-        close(true);
+        fail_over();
         return;
     }
 
     spdlog::debug("[conn] [room={}] WebSocket handshake completed. Setting up protocol.", _room_id);
-
-    start_read();
-
-    auto str = new std::string(generate_join_room_packet(
-        _room_id, _session->get_options()["protocol-ver"].as<int>(), _token));
-    auto buffer = boost::asio::buffer(*str);
-    SPDLOG_TRACE(
-        "[conn] [room={}] Sending handshake packet with payload(len={}): {:Xs}",
-        _room_id, str->length(),
-        spdlog::to_hex(str->c_str(), str->c_str() + str->length()));
-    _ws_stream.async_write(
-        buffer, boost::bind(&bilibili_connection_websocket::on_join_room_sent, shared_from_this(),
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred, str));
-    // Don't need a sending queue
-    // Because the sending frequency is low.
-}
-
-void bilibili_connection_websocket::on_join_room_sent(
-    const boost::system::error_code& err, const size_t transferred,
-    std::string* buf)
-{
-    delete buf;  // delete sending buffer.
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted || err == boost::beast::websocket::error::closed)
-        {
-            SPDLOG_DEBUG("[conn] Cancelling handshake sending.");
-            return;  // closing socket.
-        }
-        spdlog::warn(
-            "[conn] [room={}] Failed sending handshake packet! err:{}: {}",
-            _room_id, err.value(), err.message());
-        close(true);
-    }
-
-    SPDLOG_DEBUG(
-        "[conn] [room={}] Sent handshake packet. Bytes transferred: {}",
-        _room_id, transferred);
-    reschedule_timer();
+    on_transport_established();
 }
 
-void bilibili_connection_websocket::reschedule_timer()
+void bilibili_connection_websocket::async_read(const size_t limit)
 {
-    SPDLOG_DEBUG("[conn] [room={}] Scheduling heartbeat, interval={}",
-                 _room_id, _heartbeat_interval_sec);
-    _heartbeat_timer->expires_from_now(
-        boost::posix_time::seconds(_heartbeat_interval_sec));
-    _heartbeat_timer->async_wait(
-        boost::bind(&bilibili_connection_websocket::on_heartbeat_tick, shared_from_this(),
-                    boost::asio::placeholders::error));
+    // 每次只读取消息中能放进缓冲区的部分，不等整条消息读完。
+    // 整条读取时，超过 max-read-buffer 的消息会在分包器看到任何数据之前就让 beast 以 buffer_overflow 失败；
+    // 分段读取则由分包器逐段丢弃其中过大的数据包，和纯 TCP 连接一样。
+    _ws_stream->async_read_some(
+        _framer.buffer(), limit,
+        boost::beast::bind_front_handler(&bilibili_connection_websocket::on_receive, shared_from_base<bilibili_connection_websocket>()));
 }
 
-void bilibili_connection_websocket::on_heartbeat_tick(
-    const boost::system::error_code& err)
+void bilibili_connection_websocket::async_write(boost::asio::const_buffer buffer, write_handler handler)
 {
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted || err == boost::beast::websocket::error::closed)
-        {
-            SPDLOG_DEBUG("[conn] Cancelling heartbeat timer.");
-            return;  // closing socket.
-        }
-        spdlog::warn("[conn] [room={}] Error in heartbeat tick! err:{}: {}",
-                     _room_id, err.value(), err.message());
-        return;  // closing socket.
-    }
-
-    auto& buf = _session->get_heartbeat_buffer();
-    auto buf_ptr = reinterpret_cast<const char*>(buf.data());
-    SPDLOG_DEBUG(
-        "[conn] [room={}] Sending heartbeat packet with payload(len={}): {:Xs}",
-        _room_id, buf.size(), spdlog::to_hex(buf_ptr, buf_ptr + buf.size()));
-    _ws_stream.async_write(
-        buf, boost::bind(&bilibili_connection_websocket::on_heartbeat_sent, shared_from_this(),
-                         boost::asio::placeholders::error,
-                         boost::asio::placeholders::bytes_transferred));
-
-    reschedule_timer();
-}
-
-void bilibili_connection_websocket::on_heartbeat_sent(
-    const boost::system::error_code& err, const size_t transferred)
-{
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted || err == boost::beast::websocket::error::closed)
-        {
-            SPDLOG_DEBUG("[conn] Cancelling heartbeat sending.");
-            return;  // closing socket.
-        }
-        spdlog::warn(
-            "[conn] [room={}] Failed sending heartbeat packet! err:{}: {}",
-            _room_id, err.value(), err.message());
-        close(true);
-    }
-    // nothing to do.
-    SPDLOG_DEBUG(
-        "[conn] [room={}] Sent heartbeat packet. Bytes transferred: {}",
-        _room_id, transferred);
+    _ws_stream->async_write(buffer, std::move(handler));
 }
 
-void bilibili_connection_websocket::start_read()
+void bilibili_connection_websocket::shutdown(const bool graceful)
 {
-    SPDLOG_TRACE("[conn] [room={}] Starting next async read.", _room_id);
-    _read_buffer.clear();
-    _ws_stream.async_read(
-        _read_buffer,
-        boost::bind(&bilibili_connection_websocket::on_receive, shared_from_this(),
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred));
-}
-
-void bilibili_connection_websocket::on_receive(
-    const boost::system::error_code& err, const size_t transferred)
-{
-    if (err)
+    auto self = std::static_pointer_cast<bilibili_connection_websocket>(weak_from_this().lock());  // 在析构函数中为空
+    if (!graceful || !self)
     {
-        if (err.value() == boost::asio::error::operation_aborted || err == boost::beast::websocket::error::closed || err == boost::asio::error::eof)
-        {
-            SPDLOG_DEBUG("[conn] Cancelling async reading.");
-            return;  // closing socket.
-        }
-        spdlog::warn("[conn] [room={}] Error in async recv! err:{}: {}",
-                     _room_id, err.value(), err.message());
-        close(true);
-    }
-
-    SPDLOG_DEBUG("[conn] [room={}] Received data block(len={})", _room_id,
-                 transferred);
-    try
-    {
-        _read_buffer.reserve(_read_buffer.size() + 1); // Add space for '\0'
-        handle_buffer(reinterpret_cast<unsigned char*>(_read_buffer.data().data()), transferred, _read_buffer.size(), 0, 0,  // No need to concat packets ourselves
-                      _room_id, std::bind(&bilibili_connection_manager::on_room_data, _session, _room_id, std::placeholders::_1));
-    }
-    catch (malformed_packet&)
-    {
-        close(true);
+        // 还在连接或握手，或者连接已经失效（出错、空闲超时，服务器多半不会回应关闭握手）：
+        // 直接关闭 socket 取消进行中的操作，读取的回调随之结束并释放连接
+        boost::system::error_code ec;
+        socket().close(ec);
         return;
     }
-
-    start_read();
-}
-
-void bilibili_connection_websocket::close(const bool failed)
-{
-    if (_closed)
-        return;
-    _closed = true;
-
-    boost::system::error_code ec;
-    _heartbeat_timer->cancel(ec);
-
-    _ws_stream.async_close(boost::beast::websocket::close_code::normal, [room_id = _room_id](const boost::system::error_code& err) -> void
+    // beast 自己的超时已经关闭，关闭握手由时间轮限时
+    _close_timer = _shard->wheel.schedule(ws_close_timeout, [weak = std::weak_ptr<bilibili_connection_websocket>(self)]() -> void {
+        auto self = weak.lock();
+        if (!self)
+            return;
+        self->_close_timer = 0;
+        spdlog::debug("[conn] [room={}] Closing handshake timed out.", self->_room_id);
+        boost::system::error_code ec;
+        self->socket().close(ec);
+    });
+    _ws_stream->async_close(boost::beast::websocket::close_code::normal, [self](const boost::system::error_code& err) -> void
     {
-        if (err.value() != boost::asio::error::operation_aborted || err == boost::beast::websocket::error::closed)
-            spdlog::warn("[conn] [room={}] Error when closing: {}:{}", room_id, err.value(), err.message());
+        self->_shard->wheel.cancel(self->_close_timer);
+        self->_close_timer = 0;
+        if (err && err != boost::asio::error::operation_aborted && err != boost::beast::websocket::error::closed)
+            spdlog::warn("[conn] [room={}] Error when closing: {}:{}", self->_room_id, err.value(), err.message());
         // whatever, closed.
     });
-
-    if (failed)
-        _session->on_room_failed(_room_id);
-    _session->on_room_closed(_room_id);
-}
 }
+}  // namespace vNerve::bilibili
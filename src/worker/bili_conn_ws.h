@@ -1,7 +1,8 @@
 #pragma once
 
-#include "bilibili_live_config.h"
+#include "bili_conn.h"
 #include <memory>
+#include <optional>
 
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
@@ -9,49 +10,32 @@
 
 namespace vNerve::bilibili
 {
-class bilibili_connection_manager;
-class bilibili_connection_websocket : public std::enable_shared_from_this<bilibili_connection_websocket>
+///
+/// WebSocket over TLS 的弹幕连接（服务器列表中的 wss_port）。
+class bilibili_connection_websocket : public bilibili_connection
 {
 private:
-    boost::asio::ip::tcp::resolver _resolver;
-    boost::beast::flat_buffer _read_buffer;
+    // 换服务器重连时重新创建，TLS 流在失败的握手之后不能复用。
+    // 不协商 permessage-deflate（Bilibili 的数据包自己压缩），省掉流中压缩相关的状态。
+    std::optional<boost::beast::websocket::stream<boost::beast::ssl_stream<boost::beast::tcp_stream>, false>> _ws_stream;
 
-    bilibili_connection_manager* _session;
-    boost::beast::websocket::stream<boost::beast::ssl_stream<boost::beast::tcp_stream>> _ws_stream;
-    //std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
+    timing_wheel::timer_id _close_timer = 0;  // 等待关闭握手，0 为没有
+    std::chrono::steady_clock::time_point _tls_handshake_started;
 
-    std::unique_ptr<boost::asio::deadline_timer> _heartbeat_timer;
-
-    int _room_id;
-    std::string _token;
-    std::string const* _user_agent = nullptr;
-    int _heartbeat_interval_sec;
-
-    bool _closed = false;
-
-    void reschedule_timer();
-    void start_read();
-
-    void on_config_fetched(const bilibili_live_config& config);
-    void on_resolved(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::results_type endpoints);
-    void on_connected(const boost::system::error_code& err);
     void on_ssl_handshake(const boost::system::error_code& err);
     void on_handshake(const boost::system::error_code& err);
-    void on_join_room_sent(const boost::system::error_code&, size_t,
-                           std::string*);
-    void on_heartbeat_sent(const boost::system::error_code&, size_t);
-    void on_heartbeat_tick(const boost::system::error_code&);
-    void on_receive(const boost::system::error_code&, size_t);
 
-public:
-    bilibili_connection_websocket(bilibili_connection_manager* session, int room_id);
-    ~bilibili_connection_websocket();
-
-    bilibili_connection_websocket(const bilibili_connection_websocket& other) = delete;
-    bilibili_connection_websocket& operator=(const bilibili_connection_websocket& other) = delete;
+protected:
+    const chat_server_list& servers_of(const bilibili_live_config& config) const override { return config.servers; }
+    boost::asio::ip::tcp::socket& socket() override;
+    void reset_transport() override;
+    void handshake() override;
+    void async_read(size_t limit) override;
+    void async_write(boost::asio::const_buffer buffer, write_handler handler) override;
+    void shutdown(bool graceful) override;
 
-    void init();
-    void close(bool failed = false);
-    bool closed() const { return _closed; }
+public:
+    bilibili_connection_websocket(bilibili_connection_manager* session, connection_shard* shard, int room_id);
+    ~bilibili_connection_websocket() override;
 };
 }  // namespace vNerve::bilibili
@@ -0,0 +1,374 @@
+#include "bili_decompress.h"
+
+#include <boost/thread/tss.hpp>
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+#include <brotli/decode.h>
+#include <libdeflate.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace vNerve::bilibili
+{
+size_t decompress_buffer_max_size = 256 * 1024;
+const size_t decompress_buffer_initial_size = 16 * 1024;
+
+enum class zlib_backend
+{
+    zlib,
+    libdeflate
+};
+zlib_backend selected_zlib_backend = zlib_backend::zlib;
+
+void packet_decompressor::grow(size_t capacity)
+{
+    auto buffer = std::make_unique<unsigned char[]>(capacity + 1);
+    if (_buffer)
+        std::memcpy(buffer.get(), _buffer.get(), _capacity);
+    _buffer = std::move(buffer);
+    _capacity = capacity;
+}
+
+void packet_decompressor::dispatch_packets(const unsigned char* buf, size_t filled, size_t& parsed, size_t& skipping,
+                                           worker_supervisor::room_id_t room_id, const message_handler& handler)
+{
+    while (true)
+    {
+        if (skipping > 0)
+        {
+            auto dropping = std::min(skipping, filled - parsed);
+            skipping -= dropping;
+            parsed += dropping;
+            if (skipping > 0)
+                return;
+        }
+        if (filled - parsed < sizeof(bilibili_packet_header))
+            return;
+        auto begin = _buffer.get() + parsed;
+        auto header = reinterpret_cast<bilibili_packet_header*>(begin);
+        auto length = header->length();
+        if (header->header_length() != sizeof(bilibili_packet_header) || length < sizeof(bilibili_packet_header))
+        {
+            spdlog::warn(
+                "[{}] [{:p}] Malformed packet: Bad header length(!=16): {}, length={}",
+                name(), static_cast<const void*>(buf), header->header_length(), length);
+            throw malformed_packet();
+        }
+        if (length > decompress_buffer_max_size)
+        {
+            spdlog::warn(
+                "[{}] [{:p}] Decompressed packet too big: {} > max size({}). Disposing.",
+                name(), static_cast<const void*>(buf), length, decompress_buffer_max_size);
+            skipping = length;
+            continue;
+        }
+        if (length > filled - parsed)
+            return;  // 等待更多解压数据
+
+        handle_packet(begin, room_id, handler);
+        parsed += length;
+    }
+}
+
+decompress_result packet_decompressor::decompress(const unsigned char* buf, size_t size,
+                                                  worker_supervisor::room_id_t room_id, const message_handler& handler)
+{
+    if (_in_use)
+    {
+        // 压缩包里又套了一层压缩包，缓冲区正在被外层使用
+        return decompress_result::nested;
+    }
+    if (!_buffer)
+        grow(std::min(decompress_buffer_initial_size, decompress_buffer_max_size));
+
+    struct in_use_guard
+    {
+        bool& flag;
+        in_use_guard(bool& flag) : flag(flag) { flag = true; }
+        ~in_use_guard() { flag = false; }
+    } guard(_in_use);
+    return do_decompress(buf, size, room_id, handler);
+}
+
+///
+/// 流式解压器：每次解压一段，立即处理其中完整的数据包。
+/// 输出缓冲区按需增长到 zlib-buffer 为止，因此这里限制的是单个内层数据包的大小。
+class streaming_decompressor : public packet_decompressor
+{
+protected:
+    enum class step_result
+    {
+        more_output,
+        finished,
+        truncated,
+        malformed,
+        failed
+    };
+
+    virtual bool begin(const unsigned char* buf, size_t size) = 0;
+    /// 解压到 [out, out + avail) 中，produced 为本次写出的字节数
+    virtual step_result step(unsigned char* out, size_t avail, size_t& produced) = 0;
+
+    decompress_result do_decompress(const unsigned char* buf, size_t size,
+                                    worker_supervisor::room_id_t room_id, const message_handler& handler) override
+    {
+        if (!begin(buf, size))
+            return decompress_result::failed;
+
+        size_t filled = 0;    // 缓冲区中已解压的字节数
+        size_t parsed = 0;    // 缓冲区中已处理完的字节数
+        size_t skipping = 0;  // 过大的数据包还需要丢弃的字节数
+        step_result result;
+        do
+        {
+            if (filled == _capacity)
+            {
+                if (parsed > 0)
+                {
+                    std::memmove(_buffer.get(), _buffer.get() + parsed, filled - parsed);
+                    filled -= parsed;
+                    parsed = 0;
+                }
+                else if (_capacity < decompress_buffer_max_size)
+                    grow(std::min(_capacity * 2, decompress_buffer_max_size));
+                else
+                    return decompress_result::too_big;
+            }
+
+            size_t produced = 0;
+            result = step(_buffer.get() + filled, _capacity - filled, produced);
+            filled += produced;
+            SPDLOG_TRACE("[{}] [{:p}] Decompressed to {}/{} bytes.", name(), static_cast<const void*>(buf), filled, _capacity);
+
+            switch (result)
+            {
+            case step_result::malformed:
+                return decompress_result::malformed;
+            case step_result::failed:
+                return decompress_result::failed;
+            default:
+                break;
+            }
+            dispatch_packets(buf, filled, parsed, skipping, room_id, handler);
+            if (result == step_result::truncated)
+                return decompress_result::truncated;
+        } while (result != step_result::finished);
+
+        if (parsed != filled)
+            spdlog::warn("[{}] [{:p}] {} trailing bytes after the last decompressed packet.",
+                         name(), static_cast<const void*>(buf), filled - parsed);
+        return decompress_result::ok;
+    }
+};
+
+///
+/// zlib：z_stream 在同一线程内通过 inflateReset 复用。
+class zlib_decompressor : public streaming_decompressor
+{
+private:
+    z_stream _stream = {};
+    bool _initialized = false;
+
+protected:
+    bool begin(const unsigned char* buf, size_t size) override
+    {
+        if (!_initialized)
+        {
+            auto result = inflateInit(&_stream);
+            if (result != Z_OK)
+            {
+                spdlog::error("[zlib] Failed initializing z_stream: {}", result);
+                return false;
+            }
+            _initialized = true;
+        }
+        else
+            inflateReset(&_stream);
+        _stream.next_in = const_cast<unsigned char*>(buf);
+        _stream.avail_in = static_cast<uInt>(size);
+        return true;
+    }
+
+    step_result step(unsigned char* out, size_t avail, size_t& produced) override
+    {
+        _stream.next_out = out;
+        _stream.avail_out = static_cast<uInt>(avail);
+        auto result = inflate(&_stream, Z_NO_FLUSH);
+        produced = avail - _stream.avail_out;
+        switch (result)
+        {
+        case Z_STREAM_END:
+            return step_result::finished;
+        case Z_OK:
+            return _stream.avail_out == 0 ? step_result::more_output : step_result::truncated;
+        case Z_BUF_ERROR:  // 输出缓冲区有空间却没有进展，说明输入用完了
+            return step_result::truncated;
+        case Z_DATA_ERROR:
+            return step_result::malformed;
+        default:
+            spdlog::warn("[zlib] inflate failed! errno={}. Please refer to zlib documentation.", result);
+            return step_result::failed;
+        }
+    }
+
+public:
+    ~zlib_decompressor() override
+    {
+        if (_initialized)
+            inflateEnd(&_stream);
+    }
+    const char* name() const override { return "zlib"; }
+};
+
+///
+/// brotli：解码器状态没有重置接口，每个数据包新建一个。
+class brotli_decompressor : public streaming_decompressor
+{
+private:
+    struct state_deleter
+    {
+        void operator()(BrotliDecoderState* state) const { BrotliDecoderDestroyInstance(state); }
+    };
+    std::unique_ptr<BrotliDecoderState, state_deleter> _state;
+    const uint8_t* _next_in = nullptr;
+    size_t _avail_in = 0;
+
+protected:
+    bool begin(const unsigned char* buf, size_t size) override
+    {
+        _state.reset(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+        if (!_state)
+        {
+            spdlog::error("[brotli] Failed creating brotli decoder.");
+            return false;
+        }
+        _next_in = buf;
+        _avail_in = size;
+        return true;
+    }
+
+    step_result step(unsigned char* out, size_t avail, size_t& produced) override
+    {
+        auto avail_out = avail;
+        auto result = BrotliDecoderDecompressStream(_state.get(), &_avail_in, &_next_in, &avail_out, &out, nullptr);
+        produced = avail - avail_out;
+        switch (result)
+        {
+        case BROTLI_DECODER_RESULT_SUCCESS:
+            return step_result::finished;
+        case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+            return step_result::more_output;
+        case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+            return step_result::truncated;
+        default:
+            SPDLOG_DEBUG("[brotli] Decoding failed: {}",
+                         BrotliDecoderErrorString(BrotliDecoderGetErrorCode(_state.get())));
+            return step_result::malformed;
+        }
+    }
+
+public:
+    const char* name() const override { return "brotli"; }
+};
+
+///
+/// libdeflate：只支持一次性解压，整个压缩包解压后的大小受 zlib-buffer 限制。
+class libdeflate_zlib_decompressor : public packet_decompressor
+{
+private:
+    ::libdeflate_decompressor* _decompressor = nullptr;
+
+protected:
+    decompress_result do_decompress(const unsigned char* buf, size_t size,
+                                    worker_supervisor::room_id_t room_id, const message_handler& handler) override
+    {
+        if (!_decompressor)
+        {
+            _decompressor = libdeflate_alloc_decompressor();
+            if (!_decompressor)
+            {
+                spdlog::error("[libdeflate] Failed allocating decompressor.");
+                return decompress_result::failed;
+            }
+        }
+
+        size_t filled = 0;
+        while (true)
+        {
+            auto result = libdeflate_zlib_decompress(_decompressor, buf, size, _buffer.get(), _capacity, &filled);
+            if (result == LIBDEFLATE_SUCCESS)
+                break;
+            if (result == LIBDEFLATE_INSUFFICIENT_SPACE)
+            {
+                if (_capacity >= decompress_buffer_max_size)
+                    return decompress_result::too_big;
+                grow(std::min(_capacity * 2, decompress_buffer_max_size));
+                continue;
+            }
+            return decompress_result::malformed;
+        }
+
+        size_t parsed = 0, skipping = 0;
+        dispatch_packets(buf, filled, parsed, skipping, room_id, handler);
+        if (parsed != filled)
+            spdlog::warn("[libdeflate] [{:p}] {} trailing bytes after the last decompressed packet.",
+                         static_cast<const void*>(buf), filled - parsed);
+        return decompress_result::ok;
+    }
+
+public:
+    ~libdeflate_zlib_decompressor() override
+    {
+        if (_decompressor)
+            libdeflate_free_decompressor(_decompressor);
+    }
+    const char* name() const override { return "libdeflate"; }
+};
+
+struct thread_decompressors
+{
+    std::unique_ptr<packet_decompressor> zlib;
+    std::unique_ptr<packet_decompressor> brotli;
+};
+boost::thread_specific_ptr<thread_decompressors> decompressors;
+
+packet_decompressor* get_decompressor(uint16_t protocol_version)
+{
+    if (!decompressors.get())
+        decompressors.reset(new thread_decompressors);
+    auto set = decompressors.get();
+
+    switch (protocol_version)
+    {
+    case zlib_compressed:
+        if (!set->zlib)
+        {
+            if (selected_zlib_backend == zlib_backend::libdeflate)
+                set->zlib = std::make_unique<libdeflate_zlib_decompressor>();
+            else
+                set->zlib = std::make_unique<zlib_decompressor>();
+        }
+        return set->zlib.get();
+    case brotli_compressed:
+        if (!set->brotli)
+            set->brotli = std::make_unique<brotli_decompressor>();
+        return set->brotli.get();
+    default:
+        return nullptr;
+    }
+}
+
+void setup_decompressors(const config::config_t options)
+{
+    decompress_buffer_max_size = (*options)["zlib-buffer"].as<size_t>();
+
+    auto backend = (*options)["zlib-backend"].as<std::string>();
+    if (backend == "libdeflate")
+        selected_zlib_backend = zlib_backend::libdeflate;
+    else if (backend == "zlib")
+        selected_zlib_backend = zlib_backend::zlib;
+    else
+        spdlog::warn("[packet] Unknown zlib backend {}, falling back to zlib.", backend);
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "bili_packet.h"
+#include "config.h"
+#include "type.h"
+
+#include <memory>
+
+namespace vNerve::bilibili
+{
+enum class decompress_result
+{
+    ok,
+    truncated,   // 压缩数据不完整
+    malformed,   // 压缩数据损坏
+    too_big,     // 超过了 zlib-buffer 的限制
+    nested,      // 压缩包中又套了同种压缩包
+    failed       // 解压库内部错误
+};
+
+///
+/// 压缩数据包的解压器。
+/// 解压得到的数据中的每个完整数据包都会被交给 handle_packet。
+/// 实例不是线程安全的，应当由线程独占，见 get_decompressor。
+class packet_decompressor
+{
+private:
+    bool _in_use = false;
+
+protected:
+    std::unique_ptr<unsigned char[]> _buffer;
+    size_t _capacity = 0;  // 不含末尾为 '\0' 预留的 1 字节，见 handle_packet 中对 JSON 的处理
+
+    void grow(size_t capacity);
+
+    ///
+    /// 把 [parsed, filled) 中完整的数据包交给 handle_packet。
+    /// @param parsed 已处理到的位置，会被更新
+    /// @param skipping 过大的数据包还需要丢弃的字节数，会被更新
+    void dispatch_packets(const unsigned char* buf, size_t filled, size_t& parsed, size_t& skipping,
+                          worker_supervisor::room_id_t room_id, const message_handler& handler);
+
+    virtual decompress_result do_decompress(const unsigned char* buf, size_t size,
+                                            worker_supervisor::room_id_t room_id, const message_handler& handler) = 0;
+
+public:
+    packet_decompressor() = default;
+    packet_decompressor(const packet_decompressor&) = delete;
+    packet_decompressor& operator=(const packet_decompressor&) = delete;
+    virtual ~packet_decompressor() = default;
+
+    ///
+    /// 解压 [buf, buf + size)，并处理其中包含的所有数据包。
+    decompress_result decompress(const unsigned char* buf, size_t size,
+                                 worker_supervisor::room_id_t room_id, const message_handler& handler);
+    virtual const char* name() const = 0;
+};
+
+///
+/// 获取当前线程中处理指定协议版本（zlib_compressed / brotli_compressed）的解压器。
+/// @return 不支持的协议版本返回 nullptr
+packet_decompressor* get_decompressor(uint16_t protocol_version);
+
+///
+/// 读取解压相关的配置（zlib-buffer、zlib-backend）。
+void setup_decompressors(const config::config_t options);
+}  // namespace vNerve::bilibili
@@ -1,16 +1,16 @@
 #include "bili_json.h"
 
+#include "bili_command_table.h"
 #include "borrowed_message.h"
 #include "vNerve/bilibili/live/room_message.pb.h"
 #include "vNerve/bilibili/live/user_message.pb.h"
 
-#define CRCPP_USE_CPP11
-#define CRCPP_BRANCHLESS
-#include <CRC.h>
+#include <xxhash.h>
 #include <robin_hood.h>
 #include <boost/thread/tss.hpp>
 #include <rapidjson/allocators.h>
 #include <rapidjson/document.h>
+#include <rapidjson/reader.h>
 #include <rapidjson/encodings.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
@@ -27,6 +27,12 @@
 #include <locale>
 #include <iomanip>
 #include <sstream>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <initializer_list>
+#include <stdexcept>
 #include "robin_hood_ext.h"
 
 using std::function;
@@ -37,6 +43,7 @@ using vNerve::bilibili::live::RoomMessage;
 
 using MemoryPoolAllocator = rapidjson::MemoryPoolAllocator<>;
 using Document = rapidjson::GenericDocument<rapidjson::UTF8<>, MemoryPoolAllocator, MemoryPoolAllocator>;
+using Reader = rapidjson::GenericReader<rapidjson::UTF8<>, rapidjson::UTF8<>, MemoryPoolAllocator>;
 
 namespace vNerve::bilibili
 {
@@ -50,20 +57,403 @@ public:
     borrowed_bilibili_message(RoomMessage* message)
         : _message(message) {}
     ~borrowed_bilibili_message() {}
+    /// ByteSizeLong 会顺便把每个子消息的大小缓存下来，
+    /// 所以 write 时可以直接按缓存的大小写出，不必再遍历一遍计算大小。
     size_t size() const override { return _message->ByteSizeLong(); }
-    void write(void* data, int size) const override { _message->SerializeToArray(data, size); }
+    void write(void* data, int size) const override
+    {
+        // 没有先调用 size()，或者之后又修改了消息：缓存的大小不可信，重新计算
+        if (_message->GetCachedSize() != size)
+        {
+            _message->SerializeToArray(data, size);
+            return;
+        }
+        _message->SerializeWithCachedSizesToArray(static_cast<google::protobuf::uint8*>(data));
+    }
 };
 
 const size_t JSON_BUFFER_SIZE = 128 * 1024;
 const size_t PARSE_BUFFER_SIZE = 32 * 1024;
-const CRC::Table<uint32_t, 32> crc_lookup_table(CRC::CRC_32());
+
+///
+/// 消息指纹，供 Supervisor 去重。
+/// 以房间号为种子，不同房间中内容相同的消息不会被当作重复消息。
+/// 0 表示总是发送（见 simple_worker_proto.h），因此不会返回 0。
+checksum_t calculate_checksum(const char* buf, const size_t length, const unsigned int room_id)
+{
+    auto checksum = XXH3_64bits_withSeed(buf, length, room_id);
+    return checksum == 0 ? 1 : checksum;
+}
 
 class parse_context;
-using command_handler = function<bool(const unsigned int&, const Document&, borrowed_bilibili_message&, Arena*, parse_context*)>;
-util::unordered_map_string<command_handler> command;
+using command_handler = bool (*)(const unsigned int&, const Document&, borrowed_bilibili_message&, Arena*, parse_context*);
+
+#define DECLARE_COMMAND_HANDLER(name) \
+    bool cmd_##name(const unsigned int&, const Document&, borrowed_bilibili_message&, Arena*, parse_context*);
+BILI_COMMANDS(DECLARE_COMMAND_HANDLER)
+#undef DECLARE_COMMAND_HANDLER
+
+enum command_id : size_t
+{
+#define COMMAND_ID(name) command_##name,
+    BILI_COMMANDS(COMMAND_ID)
+#undef COMMAND_ID
+    command_count
+};
+
+struct command_entry
+{
+    std::string_view name;
+    command_handler handler;
+};
+
+constexpr command_entry commands[] = {
+#define COMMAND_ENTRY(name) {#name, cmd_##name},
+    BILI_COMMANDS(COMMAND_ENTRY)
+#undef COMMAND_ENTRY
+};
+
+constexpr command_table<64, command_entry, command_count> commands_by_name(commands);
+
+///
+/// 查找 cmd 对应的处理函数，带后缀的 cmd 匹配最长的已知前缀，见 command_table::find。
+/// @return 未找到时返回 nullptr
+const command_entry* find_command(std::string_view cmd)
+{
+    return commands_by_name.find(cmd);
+}
+
+static_assert(commands_by_name.find_exact("DANMU_MSG") == &commands[command_DANMU_MSG], "Command table broken.");
+static_assert(commands_by_name.find("DANMU_MSG:4:0:2:2:2:0") == &commands[command_DANMU_MSG], "Command table broken.");
 
 std::string_view document_to_string(Document const& document, parse_context* context);
 
+///
+/// 某个 cmd 的处理函数需要用到的 JSON 路径组成的树。
+/// SAX 引擎只会把树上的节点放进 Document，其余子树直接跳过。
+struct json_path_node
+{
+    /// 为 true 时保留整棵子树
+    bool keep_all = false;
+    util::unordered_map_string<std::unique_ptr<json_path_node>> members;
+    std::vector<std::unique_ptr<json_path_node>> elements;
+
+    const json_path_node* find_member(std::string_view key) const
+    {
+        auto iter = members.find(key);
+        return iter == members.end() ? nullptr : iter->second.get();
+    }
+
+    const json_path_node* find_element(const size_t index) const
+    {
+        return index < elements.size() ? elements[index].get() : nullptr;
+    }
+
+    json_path_node* add_member(std::string_view key)
+    {
+        auto iter = members.find(key);
+        if (iter == members.end())
+            iter = members.emplace(std::string(key), std::make_unique<json_path_node>()).first;
+        return iter->second.get();
+    }
+
+    json_path_node* add_element(const size_t index)
+    {
+        if (elements.size() <= index)
+            elements.resize(index + 1);
+        if (!elements[index])
+            elements[index] = std::make_unique<json_path_node>();
+        return elements[index].get();
+    }
+};
+
+///
+/// 把形如 "info[2][1]"、"data.user_info" 的路径加入路径树。
+/// 路径指向的值会被完整保留。
+void add_json_path(json_path_node* root, std::string_view path)
+{
+    auto node = root;
+    size_t pos = 0;
+    while (pos < path.size())
+    {
+        if (path[pos] == '.')
+        {
+            pos++;
+            continue;
+        }
+        if (path[pos] == '[')
+        {
+            auto close = path.find(']', pos);
+            if (close == std::string_view::npos)
+                throw std::invalid_argument(fmt::format("Invalid JSON path: {}", path));
+            auto index = std::strtoul(std::string(path.substr(pos + 1, close - pos - 1)).c_str(), nullptr, 10);
+            node = node->add_element(index);
+            pos = close + 1;
+            continue;
+        }
+        auto end = path.find_first_of(".[", pos);
+        if (end == std::string_view::npos)
+            end = path.size();
+        node = node->add_member(path.substr(pos, end - pos));
+        pos = end;
+    }
+    node->keep_all = true;
+}
+
+json_path_node make_json_path_tree(std::initializer_list<std::string_view> paths)
+{
+    json_path_node root;
+    add_json_path(&root, "cmd");
+    for (auto path : paths)
+        add_json_path(&root, path);
+    return root;
+}
+
+/// 按 command_id 索引，未声明路径的 cmd 为空
+std::unique_ptr<json_path_node> command_paths[command_count];
+
+///
+/// rapidjson SAX Handler：按照路径树过滤事件后转发给 Document。
+/// 数组中被跳过的元素用 null 占位，保证下标和 Size() 与完整解析一致；
+/// 对象中被跳过的成员直接丢弃。
+class json_path_filter
+{
+private:
+    struct frame
+    {
+        const json_path_node* node;
+        bool is_array;
+        rapidjson::SizeType count;
+    };
+
+    Document* _target = nullptr;
+    const json_path_node* _root = nullptr;
+    std::vector<frame> _stack;
+    unsigned int _skip_depth = 0;
+
+    const char* _pending_key = nullptr;
+    rapidjson::SizeType _pending_key_length = 0;
+    bool _pending_key_copy = false;
+
+    /// 决定即将开始的值是否需要保留，返回对应的路径节点，nullptr 表示跳过
+    const json_path_node* begin_value()
+    {
+        if (_stack.empty())
+            return _root;
+        auto& parent = _stack.back();
+        const json_path_node* node;
+        if (parent.is_array)
+        {
+            node = parent.node->keep_all ? parent.node : parent.node->find_element(parent.count);
+            parent.count++;
+            if (!node)
+                _target->Null();  // 占位
+        }
+        else
+        {
+            node = parent.node->keep_all ? parent.node : parent.node->find_member(std::string_view(_pending_key, _pending_key_length));
+            if (node)
+            {
+                _target->Key(_pending_key, _pending_key_length, _pending_key_copy);
+                parent.count++;
+            }
+        }
+        return node;
+    }
+
+    template <class Forward>
+    bool scalar(Forward&& forward)
+    {
+        if (_skip_depth || !begin_value())
+            return true;
+        return forward();
+    }
+
+    bool start_container(const bool is_array)
+    {
+        if (_skip_depth)
+        {
+            _skip_depth++;
+            return true;
+        }
+        auto node = begin_value();
+        if (!node)
+        {
+            _skip_depth = 1;
+            return true;
+        }
+        _stack.push_back({node, is_array, 0});
+        return is_array ? _target->StartArray() : _target->StartObject();
+    }
+
+    bool end_container(const bool is_array)
+    {
+        if (_skip_depth)
+        {
+            _skip_depth--;
+            return true;
+        }
+        auto count = _stack.back().count;
+        _stack.pop_back();
+        return is_array ? _target->EndArray(count) : _target->EndObject(count);
+    }
+
+public:
+    json_path_filter() { _stack.reserve(16); }
+
+    void reset(Document* target, const json_path_node* root)
+    {
+        _target = target;
+        _root = root;
+        _stack.clear();
+        _skip_depth = 0;
+    }
+
+    bool Null() { return scalar([this]() { return _target->Null(); }); }
+    bool Bool(bool b) { return scalar([&]() { return _target->Bool(b); }); }
+    bool Int(int i) { return scalar([&]() { return _target->Int(i); }); }
+    bool Uint(unsigned u) { return scalar([&]() { return _target->Uint(u); }); }
+    bool Int64(int64_t i) { return scalar([&]() { return _target->Int64(i); }); }
+    bool Uint64(uint64_t u) { return scalar([&]() { return _target->Uint64(u); }); }
+    bool Double(double d) { return scalar([&]() { return _target->Double(d); }); }
+    bool RawNumber(const char* str, rapidjson::SizeType length, bool copy) { return scalar([&]() { return _target->RawNumber(str, length, copy); }); }
+    bool String(const char* str, rapidjson::SizeType length, bool copy) { return scalar([&]() { return _target->String(str, length, copy); }); }
+    bool Key(const char* str, rapidjson::SizeType length, bool copy)
+    {
+        if (_skip_depth)
+            return true;
+        _pending_key = str;
+        _pending_key_length = length;
+        _pending_key_copy = copy;
+        return true;
+    }
+    bool StartObject() { return start_container(false); }
+    bool EndObject(rapidjson::SizeType) { return end_container(false); }
+    bool StartArray() { return start_container(true); }
+    bool EndArray(rapidjson::SizeType) { return end_container(true); }
+};
+
+enum class json_engine
+{
+    dom,
+    sax
+};
+json_engine selected_json_engine = json_engine::dom;
+
+///
+/// 在完整解析之前，直接从原始 JSON 缓冲区中找出顶层的 cmd 字段。
+/// 只处理最常见的形式（顶层 key、值中没有转义字符），其余情况返回空，交给完整解析兜底。
+/// @param buf JSON 缓冲区，不会被修改
+/// @param length JSON 长度
+/// @return cmd 的值（指向 buf 内部），未找到时为空
+std::string_view peek_cmd(const char* buf, const size_t length)
+{
+    using namespace std::literals;
+    auto const end = buf + length;
+    auto is_space = [](char c) -> bool { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+    int depth = 0;
+    for (auto p = buf; p < end; ++p)
+    {
+        switch (*p)
+        {
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            depth--;
+            break;
+        case '"':
+        {
+            auto str_begin = ++p;
+            for (; p < end && *p != '"'; ++p)
+                if (*p == '\\')
+                    ++p;  // 跳过被转义的字符
+            if (p >= end)
+                return {};
+            if (depth != 1 || std::string_view(str_begin, p - str_begin) != "cmd"sv)
+                break;
+
+            // 找到了顶层的 "cmd"，接下来应该是 : "VALUE"
+            auto q = p + 1;
+            while (q < end && is_space(*q))
+                ++q;
+            if (q >= end || *q != ':')
+                break;
+            ++q;
+            while (q < end && is_space(*q))
+                ++q;
+            if (q >= end || *q != '"')
+                return {};
+            auto value_begin = ++q;
+            for (; q < end && *q != '"'; ++q)
+                if (*q == '\\')
+                    return {};  // 带转义的 cmd 交给完整解析
+            if (q >= end)
+                return {};
+            return std::string_view(value_begin, q - value_begin);
+        }
+        default:
+            break;
+        }
+    }
+    return {};
+}
+
+///
+/// 被预扫描直接丢弃的 cmd 的统计。
+/// 各线程先在 parse_context 中本地累加，攒够一批后再合并进这里，避免每条消息都抢锁。
+class cmd_skip_statistics
+{
+private:
+    std::mutex _mutex;
+    util::unordered_map_string<std::pair<size_t, size_t>> _counters;  // cmd -> (count, bytes)
+
+public:
+    void merge(util::unordered_map_string<std::pair<size_t, size_t>>& local)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& [cmd, counter] : local)
+        {
+            auto& [count, bytes] = _counters[cmd];
+            count += counter.first;
+            bytes += counter.second;
+        }
+        local.clear();
+    }
+
+    void report()
+    {
+        std::vector<std::pair<std::string, std::pair<size_t, size_t>>> counters;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            counters.reserve(_counters.size());
+            for (auto& [cmd, counter] : _counters)
+                counters.emplace_back(cmd, counter);
+            _counters.clear();
+        }
+        if (counters.empty())
+            return;
+        std::sort(counters.begin(), counters.end(), [](auto const& lhs, auto const& rhs) -> bool {
+            return lhs.second.first > rhs.second.first;
+        });
+
+        size_t total_count = 0, total_bytes = 0;
+        fmt::memory_buffer details;
+        for (auto const& [cmd, counter] : counters)
+        {
+            total_count += counter.first;
+            total_bytes += counter.second;
+            fmt::format_to(details, " {}={}({}B)", cmd, counter.first, counter.second);
+        }
+        spdlog::info("[bili_json] Skipped {} messages ({} bytes) with unhandled cmd without parsing:{}",
+                     total_count, total_bytes, fmt::to_string(details));
+    }
+};
+cmd_skip_statistics skip_statistics;
+const size_t SKIP_STATISTICS_FLUSH_THRESHOLD = 256;
+
 class parse_context
 {
 private:
@@ -75,6 +465,41 @@ private:
     borrowed_bilibili_message _borrowed_bilibili_message;
     rapidjson::StringBuffer _temp_string_buffer;
 
+    util::unordered_map_string<std::pair<size_t, size_t>> _skipped_cmds;
+    size_t _skipped_since_flush = 0;
+
+    json_path_filter _path_filter;
+
+    ///
+    /// 使用 SAX 接口解析，只把 paths 中需要的部分放进 document。
+    rapidjson::ParseResult parse_filtered(Document& document, char* buf, const json_path_node* paths, MemoryPoolAllocator* stack_allocator)
+    {
+        rapidjson::ParseResult result;
+        auto generator = [&](Document& target) -> bool {
+            _path_filter.reset(&target, paths);
+            Reader reader(stack_allocator, PARSE_BUFFER_SIZE);
+            rapidjson::InsituStringStream stream(buf);
+            result = reader.Parse<rapidjson::kParseInsituFlag>(stream, _path_filter);
+            return !result.IsError();
+        };
+        document.Populate(generator);
+        return result;
+    }
+
+    void count_skipped_cmd(std::string_view cmd, const size_t length)
+    {
+        auto iter = _skipped_cmds.find(cmd);
+        if (iter == _skipped_cmds.end())
+            iter = _skipped_cmds.emplace(std::string(cmd), std::pair<size_t, size_t>(0, 0)).first;
+        iter->second.first++;
+        iter->second.second += length;
+        if (++_skipped_since_flush >= SKIP_STATISTICS_FLUSH_THRESHOLD)
+        {
+            skip_statistics.merge(_skipped_cmds);
+            _skipped_since_flush = 0;
+        }
+    }
+
 public:
     parse_context()
         : _borrowed_bilibili_message(Arena::CreateMessage<RoomMessage>(&_arena))
@@ -83,18 +508,37 @@ public:
     ///
     /// 用于处理拆开数据包获得的json。
     /// @param buf json的缓冲区，将在函数中复用。
-    /// @param length 原始json的长度，生成CRC时使用。
+    /// @param length 原始json的长度，生成校验值时使用。
     /// @param room_id 消息所在的房间号。
     /// @return json转换为的protobuf序列化后的buffer。
     const borrowed_bilibili_message* serialize(char* buf, const size_t& length, const unsigned int& room_id)
     {
+        // 大部分消息的 cmd 我们并不处理，先扫一眼 cmd，省掉校验值计算和完整解析
+        auto peeked_cmd = peek_cmd(buf, length);
+        const command_entry* peeked_command = nullptr;
+        if (!peeked_cmd.empty())
+        {
+            peeked_command = find_command(peeked_cmd);
+            if (!peeked_command)
+            {
+                SPDLOG_TRACE("[bili_json] Skipping unhandled cmd: {}", peeked_cmd);
+                count_skipped_cmd(peeked_cmd.substr(0, peeked_cmd.find(':')), length);
+                return nullptr;
+            }
+        }
+
         _borrowed_bilibili_message._message->Clear();
-        _borrowed_bilibili_message.crc32 = CRC::Calculate(buf, length, crc_lookup_table);  // 这个库又会做多少内存分配呢（已经不在乎了.
+        _borrowed_bilibili_message.checksum = calculate_checksum(buf, length, room_id);
 
         MemoryPoolAllocator value_allocator(_json_buffer, JSON_BUFFER_SIZE);
         MemoryPoolAllocator stack_allocator(_parse_buffer, PARSE_BUFFER_SIZE);
         Document document(&value_allocator, PARSE_BUFFER_SIZE, &stack_allocator);
-        rapidjson::ParseResult result = document.ParseInsitu(buf);
+        const json_path_node* paths = nullptr;
+        if (selected_json_engine == json_engine::sax && peeked_command)
+            paths = command_paths[peeked_command - commands].get();
+        rapidjson::ParseResult result = paths
+            ? parse_filtered(document, buf, paths, &stack_allocator)
+            : document.ParseInsitu(buf);
         if (result.IsError())
         {
             spdlog::warn("[bili_json] Bilibili JSON: Failed to parse JSON:{} ({}) \n{}",
@@ -114,13 +558,13 @@ public:
             spdlog::warn("[bili_json] bilibili json cmd type check failed: No cmd provided. \n{}", document_to_string(document, this));
             return nullptr;
         }
-        auto cmd_func_iter = command.find(std::string_view(cmd_iter->value.GetString(), cmd_iter->value.GetStringLength()));
-        if (cmd_func_iter == command.end())
+        auto cmd_entry = find_command(std::string_view(cmd_iter->value.GetString(), cmd_iter->value.GetStringLength()));
+        if (!cmd_entry)
         {
             spdlog::trace("[bili_json] bilibili json unknown cmd field: {}", cmd_iter->value.GetString());
             return nullptr;
         }
-        if (cmd_func_iter->second(room_id, document, _borrowed_bilibili_message, &_arena, this))
+        if (cmd_entry->handler(room_id, document, _borrowed_bilibili_message, &_arena, this))
             return &_borrowed_bilibili_message;
 
         SPDLOG_TRACE("[bili_json] Failed serializing message.");
@@ -130,7 +574,7 @@ public:
     const borrowed_bilibili_message* serialize(const long long int popularity, const unsigned int& room_id)
     {
         //_borrowed_bilibili_message.routing_key = "";
-        _borrowed_bilibili_message.crc32 = 0; // see simple_worker_proto.h
+        _borrowed_bilibili_message.checksum = 0; // see simple_worker_proto.h
         auto message = _borrowed_bilibili_message._message;
         auto [_, routing_key_size] = fmt::format_to_n(_borrowed_bilibili_message.routing_key,
             worker_supervisor::routing_key_max_size,
@@ -152,7 +596,10 @@ public:
 
         return &_borrowed_bilibili_message;
     }
-    ~parse_context() {}
+    ~parse_context()
+    {
+        skip_statistics.merge(_skipped_cmds);
+    }
 
     rapidjson::StringBuffer& get_temp_string_buffer() { return _temp_string_buffer; }
 };
@@ -178,6 +625,23 @@ const borrowed_message* serialize_popularity(const long long popularity, const u
     return get_parse_context()->serialize(popularity, room_id);
 }
 
+void setup_json_parser(const config::config_t options)
+{
+    auto engine = (*options)["json-engine"].as<std::string>();
+    if (engine == "sax")
+        selected_json_engine = json_engine::sax;
+    else if (engine == "dom")
+        selected_json_engine = json_engine::dom;
+    else
+        spdlog::warn("[bili_json] Unknown JSON engine {}, falling back to dom.", engine);
+    spdlog::info("[bili_json] Using {} JSON engine.", selected_json_engine == json_engine::sax ? "sax" : "dom");
+}
+
+void report_json_statistics()
+{
+    skip_statistics.report();
+}
+
 std::string_view document_to_string(Document const& document, parse_context* context)
 {
     auto& buffer = context->get_temp_string_buffer();
@@ -188,13 +652,18 @@ std::string_view document_to_string(Document const& document, parse_context* con
     return std::string_view(buffer.GetString(), buffer.GetSize());
 }
 
+/// cmd 需要先在 BILI_COMMANDS 中登记
 #define CMD(name)                                                                   \
-    bool cmd_##name(const unsigned int&, const Document&,                           \
-        borrowed_bilibili_message&, Arena*, parse_context*);                        \
-    bool cmd_##name##_inited = command.emplace(#name, cmd_##name).second;           \
     bool cmd_##name(const unsigned int& room_id, const Document& document,          \
         borrowed_bilibili_message& message, Arena* arena, parse_context* context)
 
+///
+/// 声明 cmd 的处理函数会用到的 JSON 路径，供 SAX 引擎使用。"cmd" 总是会被保留。
+/// 没有声明路径的 cmd 仍然完整解析。
+#define CMD_PATHS(name, ...)                                                        \
+    bool cmd_##name##_paths_inited = (command_paths[command_##name] =               \
+        std::make_unique<json_path_node>(make_json_path_tree({__VA_ARGS__}))) != nullptr;
+
 #define ASSERT_TRACE(expr)                                                   \
     if (!(expr))                                                             \
     {                                                                        \
@@ -246,6 +715,7 @@ live::LiveVipLevel convert_live_vip_level(int vip, int svip)
     return live::LiveVipLevel::NO_VIP;
 }
 
+CMD_PATHS(DANMU_MSG, "info[0][9]", "info[1]", "info[2]", "info[3]", "info[4]", "info[5]", "info[7]")
 CMD(DANMU_MSG)
 {
     // 尽管所有UserMessage都需要设置UserInfo
@@ -383,6 +853,8 @@ CMD(DANMU_MSG)
     return true;
 }
 
+CMD_PATHS(SUPER_CHAT_MESSAGE, "data.uid", "data.user_info", "data.medal_info", "data.id", "data.message",
+    "data.price", "data.rate", "data.token", "data.time", "data.start_time", "data.end_time")
 CMD(SUPER_CHAT_MESSAGE)
 {
     ROUTING_KEY("blv.{}.sc")
@@ -518,6 +990,8 @@ CMD(SUPER_CHAT_MESSAGE)
     return true;
 }
 
+CMD_PATHS(SEND_GIFT, "data.uid", "data.uname", "data.face", "data.coin_type", "data.total_coin",
+    "data.price", "data.giftId", "data.giftName", "data.num")
 CMD(SEND_GIFT)
 {
     ROUTING_KEY("blv.{}.gift")
@@ -556,6 +1030,7 @@ CMD(SEND_GIFT)
     return true;
 }
 
+CMD_PATHS(USER_TOAST_MSG, "data.uid", "data.username", "data.guard_level", "data.op_type", "data.unit", "data.num", "data.price")
 CMD(USER_TOAST_MSG)
 {
     ROUTING_KEY("blv.{}.new_guard")
@@ -609,6 +1084,7 @@ CMD(USER_TOAST_MSG)
     return true;
 }
 
+CMD_PATHS(WELCOME, "data.uid", "data.uname", "data.is_admin", "data.vip", "data.svip")
 CMD(WELCOME)
 {
     ROUTING_KEY("blv.{}.welcome_vip")
@@ -632,6 +1108,7 @@ CMD(WELCOME)
     return true;
 }
 
+CMD_PATHS(WELCOME_GUARD, "data.uid", "data.username", "data.guard_level")
 CMD(WELCOME_GUARD)
 {
     ROUTING_KEY("blv.{}.welcome_guard")
@@ -652,6 +1129,7 @@ CMD(WELCOME_GUARD)
     return true;
 }
 
+CMD_PATHS(ROOM_BLOCK_MSG, "uid", "uname")
 CMD(ROOM_BLOCK_MSG)
 {
     ROUTING_KEY("blv.{}.user_blocked")
@@ -683,6 +1161,7 @@ CMD(ROOM_BLOCK_MSG)
     return true;
 }
 
+CMD_PATHS(LIVE)
 CMD(LIVE)
 {
     ROUTING_KEY("blv.{}.live_status")
@@ -691,6 +1170,7 @@ CMD(LIVE)
     return true;
 }
 
+CMD_PATHS(PREPARING)
 CMD(PREPARING)
 {
     ROUTING_KEY("blv.{}.live_status")
@@ -699,6 +1179,7 @@ CMD(PREPARING)
     return true;
 }
 
+CMD_PATHS(ROUND)
 CMD(ROUND)
 {
     ROUTING_KEY("blv.{}.live_status")
@@ -707,6 +1188,7 @@ CMD(ROUND)
     return true;
 }
 
+CMD_PATHS(CUT_OFF, "msg")
 CMD(CUT_OFF)
 {
     ROUTING_KEY("blv.{}.live_status")
@@ -722,6 +1204,7 @@ CMD(CUT_OFF)
     return true;
 }
 
+CMD_PATHS(ROOM_CHANGE, "data.title", "data.area_id", "data.area_name", "data.parent_area_id", "data.parent_area_name")
 CMD(ROOM_CHANGE)
 {
     ROUTING_KEY("blv.{}.room_info")
@@ -745,6 +1228,7 @@ CMD(ROOM_CHANGE)
     return true;
 }
 
+CMD_PATHS(CHANGE_ROOM_INFO, "background")
 CMD(CHANGE_ROOM_INFO)
 {
     ROUTING_KEY("blv.{}.room_info")
@@ -755,6 +1239,7 @@ CMD(CHANGE_ROOM_INFO)
     return true;
 }
 
+CMD_PATHS(ROOM_SKIN_MSG, "skin_id")
 CMD(ROOM_SKIN_MSG)
 {
     ROUTING_KEY("blv.{}.room_info")
@@ -765,6 +1250,7 @@ CMD(ROOM_SKIN_MSG)
     return true;
 }
 
+CMD_PATHS(ROOM_ADMINS, "uids")
 CMD(ROOM_ADMINS)
 {
     ROUTING_KEY("blv.{}.room_info")
@@ -780,6 +1266,7 @@ CMD(ROOM_ADMINS)
     return true;
 }
 
+CMD_PATHS(ROOM_LOCK, "expire")
 CMD(ROOM_LOCK)
 {
     ROUTING_KEY("blv.{}.room_locked")
@@ -800,6 +1287,7 @@ CMD(ROOM_LOCK)
     return true;
 }
 
+CMD_PATHS(WARNING, "msg")
 CMD(WARNING)
 {
     ROUTING_KEY("blv.{}.room_warning")
@@ -811,6 +1299,7 @@ CMD(WARNING)
     return true;
 }
 
+CMD_PATHS(ROOM_LIMIT, "type", "delay_range")
 CMD(ROOM_LIMIT)
 {
     ROUTING_KEY("blv.{}.room_limited")
@@ -824,6 +1313,7 @@ CMD(ROOM_LIMIT)
     return true;
 }
 
+CMD_PATHS(SUPER_CHAT_MESSAGE_DELETE, "data.ids")
 CMD(SUPER_CHAT_MESSAGE_DELETE)
 {
     ROUTING_KEY("blv.{}.sc_delete")
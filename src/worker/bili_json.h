@@ -1,6 +1,7 @@
 #pragma once
 
 #include "borrowed_message.h"
+#include "config.h"
 
 namespace vNerve::bilibili
 {
@@ -10,4 +11,9 @@ namespace vNerve::bilibili
 /// @param roomid 房间号
 const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int& room_id);
 const borrowed_message* serialize_popularity(const long long popularity, const unsigned int& room_id);
+
+/// 根据配置选择 JSON 解析引擎（json-engine: dom / sax），需要在开始解析前调用
+void setup_json_parser(const config::config_t options);
+/// 输出并清空 JSON 解析相关的统计（例如被预扫描丢弃的 cmd）
+void report_json_statistics();
 }  // namespace vNerve::bilibili
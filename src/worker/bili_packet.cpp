@@ -1,20 +1,17 @@
 #include "bili_packet.h"
 
 #include "bili_json.h"
+#include "bili_decompress.h"
 #include "borrowed_message.h"
 
 #include <boost/thread.hpp>
 #include <spdlog/spdlog.h>
-#include <zlib.h>
 
 #include <cstdio>  // for sprintf()
+#include <algorithm>
 
 namespace vNerve::bilibili
 {
-const size_t zlib_buffer_size = 256 * 1024;
-
-void handle_packet(unsigned char* buf, worker_supervisor::room_id_t, const message_handler&);
-
 std::pair<size_t, size_t> handle_buffer(unsigned char* buf,
                                         const size_t transferred,
                                         const size_t buffer_size,
@@ -94,26 +91,78 @@ std::pair<size_t, size_t> handle_buffer(unsigned char* buf,
     return std::pair(0, 0);  // read from starting, and skip no bytes.
 }
 
-boost::thread_specific_ptr<unsigned char> zlib_buffer =
-    boost::thread_specific_ptr<unsigned char>([](unsigned char* buf) -> void {
-        delete[] buf;
-    });
-unsigned char* get_zlib_buffer()
+size_t decode_packets(unsigned char* buf, const size_t size, const size_t max_packet_size, size_t& skipping,
+                      const packet_handler& on_packet)
+{
+    size_t consumed = 0;
+    while (true)
+    {
+        if (skipping > 0)
+        {
+            auto dropping = std::min(skipping, size - consumed);
+            skipping -= dropping;
+            consumed += dropping;
+            if (skipping > 0)
+                return consumed;
+        }
+        if (size - consumed < sizeof(bilibili_packet_header))
+            return consumed;
+
+        auto begin = buf + consumed;
+        auto header = reinterpret_cast<bilibili_packet_header*>(begin);
+        auto length = header->length();
+        if (header->header_length() != sizeof(bilibili_packet_header) || length < sizeof(bilibili_packet_header))
+        {
+            spdlog::warn(
+                "[bili_buffer] [{:p}] Malformed packet: Bad header length(!=16): {}, length={}",
+                static_cast<const void*>(buf), header->header_length(), length);
+            throw malformed_packet();
+        }
+        if (length > max_packet_size)
+        {
+            spdlog::info(
+                "[bili_buffer] [{:p}] Packet too big: {} > max size({}). Disposing.",
+                static_cast<const void*>(buf), length, max_packet_size);
+            skipping = length;
+            continue;
+        }
+        if (length > size - consumed)
+            return consumed;  // 等待下一帧
+
+        on_packet(begin);
+        consumed += length;
+    }
+}
+
+bili_packet_framer::bili_packet_framer(const size_t max_size)
+    : _buffer(max_size)
+{
+}
+
+void bili_packet_framer::on_data(const packet_handler& on_packet)
 {
-    if (!zlib_buffer.get())
-        zlib_buffer.reset(new unsigned char[zlib_buffer_size]);
-    return zlib_buffer.get();
+    // 为 handle_packet 在 JSON 末尾临时写入的 '\0' 预留空间
+    if (_buffer.size() == _buffer.capacity() && _buffer.size() < _buffer.max_size())
+        _buffer.reserve(_buffer.size() + 1);
+    auto data = _buffer.data();
+    // 缓冲区已经用满到上限时，最后一个字节留到下一次处理
+    auto decoding_size = _buffer.size() < _buffer.capacity() ? data.size() : data.size() - 1;
+    auto consumed = decode_packets(static_cast<unsigned char*>(data.data()), decoding_size,
+                                   _buffer.max_size() - 1, _skipping, on_packet);
+    _buffer.consume(consumed);
+
+    // 大多数房间大部分时间都没有数据，不为它们各自保留缓冲区。
+    // 下一次读取会先从池中取一块小缓冲区，数据多时再按需增长。
+    if (_buffer.size() == 0 && _buffer.capacity() > 0)
+    {
+        SPDLOG_TRACE("[bili_buffer] Releasing read buffer, capacity={}", _buffer.capacity());
+        _buffer.shrink_to_fit();
+    }
 }
 
-std::tuple<unsigned char*, int, unsigned long> decompress_buffer(
-    unsigned char* buf, size_t size)
+void setup_packet_decoder(const config::config_t options)
 {
-    auto zlib_buf = get_zlib_buffer();
-    unsigned long out_size = zlib_buffer_size;
-    auto result = uncompress(zlib_buf, &out_size, buf, size);
-    SPDLOG_TRACE("[zlib] [{:p}] Packet decompressed to {:p}. code={}, size={}",
-                  buf, zlib_buf, result, out_size);
-    return {result == Z_OK ? zlib_buf : nullptr, result, out_size};
+    setup_decompressors(options);
 }
 
 void handle_packet(unsigned char* buf, worker_supervisor::room_id_t room_id, const message_handler& handler)
@@ -136,33 +185,41 @@ void handle_packet(unsigned char* buf, worker_supervisor::room_id_t room_id, con
     switch (header->protocol_version())
     {
     case zlib_compressed:
+    case brotli_compressed:
     {
-        SPDLOG_TRACE("[packet] [{:p}] Decompressing zlib-zipped packet.", buf);
-        auto [decompressed, err_code, out_size] = decompress_buffer(
-            buf + sizeof(bilibili_packet_header), payload_size);
-        if (!decompressed)
+        auto decompressor = get_decompressor(header->protocol_version());
+        SPDLOG_TRACE("[packet] [{:p}] Decompressing {} packet.", buf, decompressor->name());
+        auto result = decompressor->decompress(
+            buf + sizeof(bilibili_packet_header), payload_size, room_id, handler);
+        switch (result)
         {
-            switch (err_code)
-            {
-            case Z_BUF_ERROR:
-                spdlog::warn(
-                    "[packet] [{:p}] Failed decompressing zlib-zipped packet! Packet too big.",
-                    buf);
-                break;
-            case Z_DATA_ERROR:
-                spdlog::warn(
-                    "[packet] [{:p}] Failed decompressing zlib-zipped packet! Malformed data.",
-                    buf);
-                break;
-            default:
-                spdlog::warn(
-                    "[packet] [{:p}] Failed decompressing zlib-zipped packet! errno={}. Please refer to zlib documentation.",
-                    buf, err_code);
-            }
-            return;
+        case decompress_result::ok:
+            break;
+        case decompress_result::truncated:
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing {} packet! Truncated data.",
+                buf, decompressor->name());
+            break;
+        case decompress_result::malformed:
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing {} packet! Malformed data.",
+                buf, decompressor->name());
+            break;
+        case decompress_result::too_big:
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing {} packet! Packet too big.",
+                buf, decompressor->name());
+            break;
+        case decompress_result::nested:
+            spdlog::warn(
+                "[packet] [{:p}] Nested {} packet is not supported. Disposing.",
+                buf, decompressor->name());
+            break;
+        default:
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing {} packet!",
+                buf, decompressor->name());
         }
-        handle_buffer(decompressed, out_size, out_size, 0, 0, room_id, handler);
-        //handle_packet(decompressed);
     }
     break;
     default:
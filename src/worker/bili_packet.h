@@ -1,10 +1,13 @@
 #pragma once
 
 #include "borrowed_message.h"
+#include "read_buffer_pool.h"
 #include "type.h"
+#include "config.h"
 
 #include <cstdint>
 #include <boost/asio.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
 
 namespace vNerve::bilibili
 {
@@ -77,6 +80,8 @@ struct bilibili_packet_header
 };
 
 using message_handler = std::function<void(const borrowed_message*)>;
+/// 处理一个完整的数据包（含头部），数据包的末尾之后至少还有 1 字节可写
+using packet_handler = std::function<void(unsigned char*)>;
 
 ///
 /// 用于处理一次读取获得的缓冲区。
@@ -96,6 +101,50 @@ std::pair<size_t, size_t> handle_buffer(unsigned char* buf, size_t transferred,
                                         size_t skipping_size,
                                         worker_supervisor::room_id_t room_id, message_handler data_handler);
 
+///
+/// 就地处理 [buf, buf + size) 中所有完整的数据包，不移动数据。
+/// @param max_packet_size 超过此大小的数据包会被丢弃
+/// @param skipping 正在丢弃的过大数据包还剩余的字节数，跨调用保持，会被更新
+/// @param on_packet 每个完整的数据包的回调
+/// @return 已处理（包括已丢弃）的字节数，剩余部分是不完整的数据包
+size_t decode_packets(unsigned char* buf, size_t size, size_t max_packet_size, size_t& skipping,
+                      const packet_handler& on_packet);
+
+using read_buffer = boost::beast::basic_flat_buffer<read_buffer_allocator<char>>;
+
+///
+/// 单个连接的分包器。
+/// 读取的数据追加在缓冲区末尾，处理完的部分通过 consume 丢弃，帧之间不清空缓冲区也不搬移数据，
+/// 不完整的数据包留到下一帧再处理。缓冲区按需增长到上限，数据全部处理完后立即还给 read_buffer_pool。
+class bili_packet_framer
+{
+private:
+    read_buffer _buffer;
+    size_t _skipping = 0;
+
+public:
+    explicit bili_packet_framer(size_t max_size);
+
+    /// 供 async_read 写入的缓冲区
+    read_buffer& buffer() { return _buffer; }
+    size_t capacity() const { return _buffer.capacity(); }
+    /// 下一次读取最多可以写入的字节数。on_data 之后总是大于 0
+    size_t read_limit() const { return _buffer.max_size() - _buffer.size(); }
+
+    ///
+    /// 把缓冲区中完整的数据包交给 on_packet，在 async_read 完成后调用。
+    /// @throw malformed_packet
+    void on_data(const packet_handler& on_packet);
+};
+
+///
+/// 读取解包相关的配置（zlib-buffer 等），需要在开始处理数据前调用。
+void setup_packet_decoder(const config::config_t options);
+
+///
+/// 处理一个完整的数据包（包括其头部），压缩数据包会被解压后逐个处理。
+void handle_packet(unsigned char* buf, worker_supervisor::room_id_t room_id, const message_handler& handler);
+
 std::string generate_heartbeat_packet();
 std::string generate_join_room_packet(int room_id_t, int proto_ver, std::string_view token);
 
@@ -114,5 +163,6 @@ enum bilibili_packet_protocol_version : uint16_t
     json_protocol = 0,
     popularity = 1,
     zlib_compressed = 2,
+    brotli_compressed = 3,
 };
 }  // namespace vNerve::bilibili
@@ -0,0 +1,113 @@
+#include "bili_parse_pool.h"
+#include "frame_pool.h"
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace vNerve::bilibili
+{
+const size_t parse_bulk_size = 32;
+const auto parse_wait_timeout = std::chrono::milliseconds(200);
+
+bili_parse_pool::bili_parse_pool(const int threads, const size_t max_depth, room_data_handler on_room_data, room_event_handler on_room_malformed, std::function<void()> on_drained)
+    : _max_depth(std::max<size_t>(max_depth, 1)),
+      _on_room_data(std::move(on_room_data)),
+      _on_room_malformed(std::move(on_room_malformed)),
+      _on_drained(std::move(on_drained))
+{
+    spdlog::info("[parse] Creating parse thread pool with size={}, max depth={}", threads, _max_depth);
+    for (int i = 0; i < threads; i++)
+        _workers.emplace_back(std::make_unique<worker>());
+    for (auto& worker : _workers)
+        _threads.create_thread(boost::bind(&bili_parse_pool::run, this, worker.get()));
+}
+
+bili_parse_pool::~bili_parse_pool()
+{
+    _running = false;
+    _threads.join_all();
+
+    parse_task task;
+    for (auto& worker : _workers)
+        while (worker->queue.try_dequeue(task))
+            worker_supervisor::release_frame(task.data);
+}
+
+std::unique_ptr<bili_parse_pool::room_producer> bili_parse_pool::create_producer(worker_supervisor::room_id_t room_id)
+{
+    auto index = static_cast<size_t>(std::hash<worker_supervisor::room_id_t>()(room_id)) % _workers.size();
+    return std::make_unique<room_producer>(index, _workers[index]->queue);
+}
+
+void bili_parse_pool::submit(room_producer& producer, worker_supervisor::room_id_t room_id, const unsigned char* packet)
+{
+    auto length = reinterpret_cast<const bilibili_packet_header*>(packet)->length();
+    auto data = worker_supervisor::allocate_frame(length + 1);
+    std::memcpy(data, packet, length);
+    auto& worker = *_workers[producer._queue_index];
+    // 已经读到的数据包总是入队，超过上限时让这个队列的房间在下一次读取前停下
+    if (worker.depth.fetch_add(1, std::memory_order_relaxed) + 1 >= _max_depth
+        && !worker.congested.exchange(true, std::memory_order_relaxed))
+        worker.congested_events.fetch_add(1, std::memory_order_relaxed);
+    worker.queue.enqueue(producer._token, parse_task{room_id, data, length, std::chrono::steady_clock::now()});
+}
+
+void bili_parse_pool::run(worker* self)
+{
+    parse_task tasks[parse_bulk_size];
+    while (_running)
+    {
+        auto count = self->queue.wait_dequeue_bulk_timed(tasks, parse_bulk_size, parse_wait_timeout);
+        for (size_t i = 0; i < count; i++)
+            process(self, tasks[i]);
+    }
+}
+
+void bili_parse_pool::process(worker* self, parse_task& task)
+{
+    auto queued_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - task.enqueued)
+                         .count();
+    self->processed.fetch_add(1, std::memory_order_relaxed);
+    self->queued_time_total_us.fetch_add(queued_us, std::memory_order_relaxed);
+    auto max = self->queued_time_max_us.load(std::memory_order_relaxed);
+    while (queued_us > max && !self->queued_time_max_us.compare_exchange_weak(max, queued_us, std::memory_order_relaxed))
+        ;
+
+    auto room_id = task.room_id;
+    try
+    {
+        handle_packet(task.data, room_id, [this, room_id](const borrowed_message* msg) -> void {
+            _on_room_data(room_id, msg);
+        });
+    }
+    catch (malformed_packet&)
+    {
+        _on_room_malformed(room_id);
+    }
+    worker_supervisor::release_frame(task.data);
+
+    if (self->depth.fetch_sub(1, std::memory_order_relaxed) - 1 <= _max_depth / 2
+        && self->congested.load(std::memory_order_relaxed)
+        && self->congested.exchange(false, std::memory_order_relaxed))
+        _on_drained();
+}
+
+void bili_parse_pool::report_statistics()
+{
+    for (size_t i = 0; i < _workers.size(); i++)
+    {
+        auto& worker = _workers[i];
+        auto processed = worker->processed.exchange(0, std::memory_order_relaxed);
+        auto total_us = worker->queued_time_total_us.exchange(0, std::memory_order_relaxed);
+        auto max_us = worker->queued_time_max_us.exchange(0, std::memory_order_relaxed);
+        spdlog::info("[parse] Parse thread #{}: depth={}, processed={}, avg_queued={}us, max_queued={}us, congested {} times{}",
+                     i, worker->depth.load(std::memory_order_relaxed), processed, processed ? total_us / static_cast<long long>(processed) : 0, max_us,
+                     worker->congested_events.exchange(0, std::memory_order_relaxed),
+                     worker->congested.load(std::memory_order_relaxed) ? " (reading paused)" : "");
+    }
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "bili_packet.h"
+#include "type.h"
+
+#include <blockingconcurrentqueue.h>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+using room_data_handler = std::function<void(int, const borrowed_message*)>;
+using room_event_handler = std::function<void(int)>;
+
+///
+/// 解析线程池。
+/// IO 线程只负责分包，把完整的原始数据包交给解析线程进行解压、JSON 解析和 protobuf 序列化，
+/// 避免一个热门房间的突发流量拖慢同一 IO 线程上其他房间的心跳和读取。
+///
+/// 每个房间固定投递到同一个队列，并使用自己的 ProducerToken，因此同一房间内的消息保持顺序。
+/// 队列深度达到上限时，投递到该队列的房间在下一次读取前暂停（见 congested），降到一半时通过 on_drained 恢复。
+class bili_parse_pool
+{
+public:
+    struct parse_task
+    {
+        worker_supervisor::room_id_t room_id;
+        unsigned char* data;  // 完整的数据包，末尾多分配 1 字节给 '\0'。由 frame_pool 分配
+        size_t length;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+    using queue_t = moodycamel::BlockingConcurrentQueue<parse_task>;
+
+    ///
+    /// 房间的投递端，由单个连接持有，不能被多个线程同时使用。
+    class room_producer
+    {
+        friend class bili_parse_pool;
+    private:
+        size_t _queue_index;
+        moodycamel::ProducerToken _token;
+
+    public:
+        room_producer(size_t queue_index, queue_t& queue)
+            : _queue_index(queue_index), _token(queue) {}
+    };
+
+private:
+    struct worker
+    {
+        queue_t queue;
+        std::atomic<size_t> depth{0};  // 已投递还没有处理完的数据包
+        std::atomic<bool> congested{false};
+        std::atomic<size_t> congested_events{0};
+        std::atomic<size_t> processed{0};
+        std::atomic<long long> queued_time_total_us{0};
+        std::atomic<long long> queued_time_max_us{0};
+    };
+
+    std::vector<std::unique_ptr<worker>> _workers;
+    boost::thread_group _threads;
+    std::atomic<bool> _running{true};
+    size_t _max_depth;
+
+    room_data_handler _on_room_data;
+    room_event_handler _on_room_malformed;
+    std::function<void()> _on_drained;
+
+    void run(worker* self);
+    void process(worker* self, parse_task& task);
+
+public:
+    ///
+    /// @param max_depth 每个队列的深度上限（数据包数）
+    /// @param on_drained 队列从上限降到一半时在解析线程上调用，用于恢复暂停的读取
+    bili_parse_pool(int threads, size_t max_depth, room_data_handler on_room_data, room_event_handler on_room_malformed, std::function<void()> on_drained);
+    ~bili_parse_pool();
+
+    bili_parse_pool(const bili_parse_pool&) = delete;
+    bili_parse_pool& operator=(const bili_parse_pool&) = delete;
+
+    std::unique_ptr<room_producer> create_producer(worker_supervisor::room_id_t room_id);
+
+    ///
+    /// 复制数据包并投递到房间对应的解析线程。
+    /// @param packet 完整的数据包（含头部）
+    void submit(room_producer& producer, worker_supervisor::room_id_t room_id, const unsigned char* packet);
+
+    ///
+    /// 房间对应的队列是否已达到深度上限。为 true 时连接应暂停读取，等待 on_drained。
+    bool congested(const room_producer& producer) const
+    {
+        return _workers[producer._queue_index]->congested.load(std::memory_order_relaxed);
+    }
+
+    /// 输出并清空队列深度和排队时间的统计
+    void report_statistics();
+};
+}  // namespace vNerve::bilibili
@@ -1,39 +1,155 @@
 #include "bilibili_connection_manager.h"
 
 #include "bili_packet.h"
+#include "bili_json.h"
+#include "frame_pool.h"
+#include "link_compression.h"
+#include "read_buffer_pool.h"
+#include "replay_ring.h"
+#include "tls_context.h"
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <boost/range/algorithm/copy.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/algorithm/algorithm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <utility>
 #include <spdlog/spdlog.h>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fstream>
+#endif
+
+namespace
+{
+void pin_current_thread(const size_t cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    auto result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result != 0)
+        spdlog::warn("[session] Failed pinning thread to CPU {}: {}", cpu, result);
+#elif defined(_WIN32)
+    if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu))
+        spdlog::warn("[session] Failed pinning thread to CPU {}: {}", cpu, GetLastError());
+#else
+    spdlog::warn("[session] Thread pinning is not supported on this platform.");
+#endif
+}
+
+/// 进程的常驻内存（字节），不支持的平台返回 0
+size_t resident_memory()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(statm >> total >> resident))
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+}  // namespace
+
 vNerve::bilibili::bilibili_connection_manager::bilibili_connection_manager(const config::config_t options, room_event_handler on_room_failed, room_data_handler on_room_data)
-    : _context((*options)["threads"].as<int>()),
-      _guard(_context.get_executor()),
-      _max_connections((*options)["max-rooms"].as<int>()),
+    : _max_connections((*options)["max-rooms"].as<int>()),
       _on_room_failed(std::move(on_room_failed)),
       _on_room_data(std::move(on_room_data)),
       _options(options),
+      _server_selector(std::chrono::seconds((*options)["chat-server-cooldown-sec"].as<int>())),
+      _dns_cache(std::chrono::seconds((*options)["dns-cache-ttl-sec"].as<int>()),
+                 std::chrono::seconds((*options)["dns-negative-ttl-sec"].as<int>())),
+      _heartbeat_interval(std::chrono::seconds((*options)["heartbeat-timeout"].as<int>())),
+      _handshake_timeout(std::chrono::seconds((*options)["handshake-timeout-sec"].as<int>())),
+      _idle_timeout(std::chrono::seconds((*options)["idle-timeout-sec"].as<int>())),
       _shared_heartbeat_buffer_str(generate_heartbeat_packet()),
       _shared_heartbeat_buffer(
-          boost::asio::buffer(_shared_heartbeat_buffer_str))
+          boost::asio::buffer(_shared_heartbeat_buffer_str)),
+      _stats_interval((*options)["stats-interval-sec"].as<int>())
 {
-    int threads = (*_options)["threads"].as<int>();
-    spdlog::info("[session] Creating session with thread pool size={}",
-                 threads);
+    setup_json_parser(_options);
+    setup_packet_decoder(_options);
+    setup_tls_context(_options);
+    setup_read_buffer_pool((*_options)["read-buffer"].as<size_t>(), (*_options)["read-buffer-pool"].as<size_t>());
+
+    auto backpressure = (*_options)["read-backpressure"].as<std::string>();
+    if (backpressure == "all")
+        _backpressure_mode = read_backpressure_mode::all;
+    else if (backpressure == "low-priority")
+        _backpressure_mode = read_backpressure_mode::low_priority;
+    else
+    {
+        if (backpressure != "off")
+            spdlog::warn("[session] Unknown read backpressure mode {}, disabling backpressure.", backpressure);
+        _backpressure_mode = read_backpressure_mode::off;
+    }
+    auto transport = (*_options)["transport"].as<std::string>();
+    if (transport == "tcp")
+        _transport = chat_transport::tcp;
+    else
+    {
+        if (transport != "websocket")
+            spdlog::warn("[session] Unknown transport {}, using websocket.", transport);
+        _transport = chat_transport::websocket;
+    }
+    if (_options->count("tcp-rooms"))
+        for (auto room_id : (*_options)["tcp-rooms"].as<std::vector<int>>())
+            _tcp_rooms.insert(room_id);
+    if (_options->count("websocket-rooms"))
+        for (auto room_id : (*_options)["websocket-rooms"].as<std::vector<int>>())
+            _websocket_rooms.insert(room_id);
+    spdlog::info("[session] Connecting rooms in {} mode, {} rooms in TCP mode and {} rooms in WebSocket mode explicitly.",
+                 _transport == chat_transport::tcp ? "TCP" : "WebSocket", _tcp_rooms.size(), _websocket_rooms.size());
+
+    if (_options->count("low-priority-rooms"))
+        for (auto room_id : (*_options)["low-priority-rooms"].as<std::vector<int>>())
+            _low_priority_rooms.insert(room_id);
+
+    auto parse_threads = (*_options)["parse-threads"].as<int>();
+    if (parse_threads > 0)
+        _parse_pool = std::make_unique<bili_parse_pool>(
+            parse_threads,
+            (*_options)["parse-queue-max"].as<size_t>(),
+            _on_room_data,
+            std::bind(&bilibili_connection_manager::on_room_malformed, this, std::placeholders::_1),
+            std::bind(&bilibili_connection_manager::resume_parked_reads, this));
+
+    int threads = std::max((*_options)["threads"].as<int>(), 1);
+    auto pin = (*_options)["pin-threads"].as<bool>();
+    spdlog::info("[session] Creating session with {} shards, pinning={}",
+                 threads, pin);
+    auto tick = std::chrono::milliseconds((*_options)["timer-tick-ms"].as<int>());
     for (int i = 0; i < threads; i++)
+        _shards.push_back(std::make_unique<connection_shard>(i, tick, _options, _dns_cache));
+    for (auto& shard : _shards)
         _pool.create_thread(
-            boost::bind(&boost::asio::io_context::run, &_context));
+            boost::bind(&bilibili_connection_manager::run_shard, this, shard.get(), pin));
+
+    _baseline_memory = resident_memory();
+    _admission = std::make_unique<admission_controller>(
+        _shards.front()->context, _options,
+        std::bind(&bilibili_connection_manager::start_connection, this, std::placeholders::_1));
+    _stats_timer = std::make_unique<boost::asio::deadline_timer>(_shards.front()->context);
+    start_stats_timer();
 }
 
 vNerve::bilibili::bilibili_connection_manager::~bilibili_connection_manager()
 {
     try
     {
-        _context.stop();
+        for (auto& shard : _shards)
+            shard->context.stop();
+        _pool.join_all();
     }
     catch (boost::system::system_error& ex)
     {
@@ -41,48 +157,317 @@ vNerve::bilibili::bilibili_connection_manager::~bilibili_connection_manager()
             "[session] Failed shutting down session IO Context! err:{}:{}:{}",
             ex.code().value(), ex.code().message(), ex.what());
     }
+    _stats_timer.reset();
+    _admission->cancel_all();
+    for (auto& shard : _shards)
+    {
+        shard->wheel.stop();  // 分片线程已经退出
+        shard->live_config.stop();
+        // 连接析构时会回调 on_room_closed，先把连接表移出来
+        auto connections = std::move(shard->connections);
+        shard->connections.clear();
+    }
+    _admission.reset();  // 连接析构时还会释放握手名额
+}
+
+void vNerve::bilibili::bilibili_connection_manager::run_shard(connection_shard* shard, const bool pin)
+{
+    if (pin)
+    {
+        auto cores = std::max(boost::thread::hardware_concurrency(), 1u);
+        pin_current_thread(shard->index % cores);
+    }
+    spdlog::debug("[session] Shard {} started.", shard->index);
+    shard->context.run();
+}
+
+std::chrono::milliseconds vNerve::bilibili::bilibili_connection_manager::next_heartbeat_delay(const bool first)
+{
+    thread_local std::minstd_rand engine(std::random_device{}());
+    auto interval = _heartbeat_interval.count();
+    auto spread = first ? interval / 2 : interval / 10;
+    if (spread <= 0)
+        return _heartbeat_interval;
+    return std::chrono::milliseconds(interval - std::uniform_int_distribution<long long>(1, spread)(engine));
+}
+
+vNerve::bilibili::connection_shard& vNerve::bilibili::bilibili_connection_manager::shard_of(const int room_id)
+{
+    // 房间号往往是连续的，先打散再取模
+    auto hash = (static_cast<uint64_t>(static_cast<uint32_t>(room_id)) * 0x9E3779B97F4A7C15ull) >> 32;
+    return *_shards[hash % _shards.size()];
 }
 
 void vNerve::bilibili::bilibili_connection_manager::open_connection(const int room_id)
 {
-    spdlog::info("[session] Connecting room {}", room_id);
-    std::lock_guard<std::recursive_mutex> lock(_mutex);
-    auto existing_iter = _connections.find(room_id);
-    if (existing_iter != _connections.end() && existing_iter->second->closed())
     {
-        existing_iter->second->close();
-        _connections.erase(existing_iter);
+        // 排队等待准入的房间也算已打开，会话恢复时一并报告
+        std::lock_guard<std::mutex> lock(_opened_rooms_mutex);
+        _opened_rooms.insert(room_id);
     }
-    auto [iter, inserted] = _connections.emplace(room_id, std::make_shared<enabled_bilibili_bilibili_connection>(this, room_id));
-    if (inserted)
-        iter->second->init();
+    _admission->request(room_id);
+}
+
+void vNerve::bilibili::bilibili_connection_manager::start_connection(const int room_id)
+{
+    auto& shard = shard_of(room_id);
+    spdlog::info("[session] Connecting room {} on shard {}", room_id, shard.index);
+    post(shard.context, [this, &shard, room_id]() -> void {
+        auto existing_iter = shard.connections.find(room_id);
+        if (existing_iter != shard.connections.end() && existing_iter->second->closed())
+        {
+            auto existing = existing_iter->second;
+            existing->close();
+            shard.connections.erase(room_id);
+        }
+        if (shard.connections.count(room_id))
+        {
+            // 先查再创建：没有插入的连接析构时会通过 on_room_closed 把已有的连接移除
+            _admission->release(room_id);  // 已经连接着
+            return;
+        }
+        auto connection = create_connection(shard, room_id);
+        shard.connections.emplace(room_id, connection);
+        shard.connection_count.store(shard.connections.size(), std::memory_order_relaxed);
+        connection->init();
+    });
+}
+
+vNerve::bilibili::chat_transport vNerve::bilibili::bilibili_connection_manager::transport_of(const int room_id) const
+{
+    if (_tcp_rooms.count(room_id))
+        return chat_transport::tcp;
+    if (_websocket_rooms.count(room_id))
+        return chat_transport::websocket;
+    return _transport;
+}
+
+std::shared_ptr<vNerve::bilibili::bilibili_connection> vNerve::bilibili::bilibili_connection_manager::create_connection(connection_shard& shard, const int room_id)
+{
+    if (transport_of(room_id) == chat_transport::tcp)
+        return std::make_shared<bilibili_connection_plain_tcp>(this, &shard, room_id);
+    return std::make_shared<bilibili_connection_websocket>(this, &shard, room_id);
 }
 
 void vNerve::bilibili::bilibili_connection_manager::close_connection(int room_id)
 {
-    std::lock_guard<std::recursive_mutex> lock(_mutex);
     spdlog::info("[session] Disconnecting room {}", room_id);
-    auto iter = _connections.find(room_id);
-    if (iter == _connections.end())
+    if (_admission->cancel(room_id))
     {
-        spdlog::debug("[session] Room {} not found.", room_id);
+        std::lock_guard<std::mutex> lock(_opened_rooms_mutex);
+        _opened_rooms.erase(room_id);
         return;
     }
+    auto& shard = shard_of(room_id);
+    post(shard.context, [&shard, room_id]() -> void {
+        auto iter = shard.connections.find(room_id);
+        if (iter == shard.connections.end())
+        {
+            spdlog::debug("[session] Room {} not found.", room_id);
+            return;
+        }
 
-    iter->second->close();
+        auto connection = iter->second;  // close 会把连接从表中移除
+        connection->close();
+    });
 }
 
 void vNerve::bilibili::bilibili_connection_manager::close_all_connections()
 {
-    post(_context.get_executor(), [this]() -> void {
-        spdlog::info("[session] Disconnecting all rooms.");
-        while (!_connections.empty())
-            _connections.begin()->second->close(false);
-    });
+    spdlog::info("[session] Disconnecting all rooms.");
+    {
+        auto cancelled = _admission->cancel_all();
+        std::lock_guard<std::mutex> lock(_opened_rooms_mutex);
+        for (auto room_id : cancelled)
+            _opened_rooms.erase(room_id);
+    }
+    for (auto& shard_ptr : _shards)
+    {
+        auto& shard = *shard_ptr;
+        post(shard.context, [&shard]() -> void {
+            while (!shard.connections.empty())
+            {
+                auto connection = shard.connections.begin()->second;
+                connection->close(false);
+            }
+        });
+    }
+}
+
+void vNerve::bilibili::bilibili_connection_manager::set_read_paused(const bool paused)
+{
+    if (_backpressure_mode == read_backpressure_mode::off)
+        return;
+    if (_read_paused.exchange(paused) == paused)
+        return;
+
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (paused)
+    {
+        _read_paused_since_us.store(now, std::memory_order_relaxed);
+        _read_pause_events.fetch_add(1, std::memory_order_relaxed);
+        spdlog::info("[session] Supervisor link is congested. Pausing reading {} rooms.",
+                     _backpressure_mode == read_backpressure_mode::all ? "all" : "low priority");
+        return;
+    }
+
+    auto paused_us = now - _read_paused_since_us.load(std::memory_order_relaxed);
+    _read_paused_us.fetch_add(paused_us, std::memory_order_relaxed);
+    _read_resume_events.fetch_add(1, std::memory_order_relaxed);
+    spdlog::info("[session] Supervisor link drained. Resuming reading after {}ms.", paused_us / 1000);
+    resume_parked_reads();
+}
+
+void vNerve::bilibili::bilibili_connection_manager::resume_parked_reads()
+{
+    for (auto& shard_ptr : _shards)
+    {
+        auto& shard = *shard_ptr;
+        post(shard.context, [&shard]() -> void {
+            if (shard.parked_connections.load(std::memory_order_relaxed) == 0)
+                return;
+            for (auto& [room_id, connection] : shard.connections)
+                connection->resume_read();
+        });
+    }
+}
+
+std::vector<int> vNerve::bilibili::bilibili_connection_manager::opened_rooms()
+{
+    std::lock_guard<std::mutex> lock(_opened_rooms_mutex);
+    return std::vector<int>(_opened_rooms.begin(), _opened_rooms.end());
+}
+
+void vNerve::bilibili::bilibili_connection_manager::on_room_failed(int room_id)
+{
+    _admission->on_failed(room_id);
+    _on_room_failed(room_id);
+}
+
+void vNerve::bilibili::bilibili_connection_manager::on_room_established(int room_id)
+{
+    _admission->on_established(room_id);
 }
 
 void vNerve::bilibili::bilibili_connection_manager::on_room_closed(int room_id)
 {
-    std::lock_guard<std::recursive_mutex> lock(_mutex);
-    _connections.erase(room_id);
+    _admission->release(room_id);
+    auto& shard = shard_of(room_id);
+    shard.connections.erase(room_id);
+    shard.connection_count.store(shard.connections.size(), std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(_opened_rooms_mutex);
+    _opened_rooms.erase(room_id);
+}
+
+void vNerve::bilibili::bilibili_connection_manager::on_room_malformed(int room_id)
+{
+    auto& shard = shard_of(room_id);
+    post(shard.context, [&shard, room_id]() -> void {
+        auto iter = shard.connections.find(room_id);
+        if (iter == shard.connections.end())
+            return;
+        spdlog::warn("[session] Malformed packet from room {}. Reconnecting.", room_id);
+        auto connection = iter->second;
+        connection->close(true);
+    });
+}
+
+void vNerve::bilibili::bilibili_connection_manager::start_stats_timer()
+{
+    if (_stats_interval.total_seconds() <= 0)
+        return;
+    _stats_timer->expires_from_now(_stats_interval);
+    _stats_timer->async_wait(boost::bind(&bilibili_connection_manager::on_stats_timer, this, boost::asio::placeholders::error));
+}
+
+void vNerve::bilibili::bilibili_connection_manager::on_stats_timer(const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        if (ec.value() != boost::asio::error::operation_aborted)
+            spdlog::warn("[session] Statistics timer error: {}:{}", ec.value(), ec.message());
+        return;
+    }
+    report_json_statistics();
+    report_shard_statistics();
+    report_backpressure_statistics();
+    report_memory_statistics();
+    report_tls_statistics();
+    _admission->report_statistics();
+    _server_selector.report_statistics();
+    _dns_cache.report_statistics();
+    worker_supervisor::report_frame_pool_statistics();
+    worker_supervisor::report_link_compression_statistics();
+    worker_supervisor::report_replay_ring_statistics();
+    if (_parse_pool)
+        _parse_pool->report_statistics();
+    start_stats_timer();
+}
+
+void vNerve::bilibili::bilibili_connection_manager::report_shard_statistics()
+{
+    for (auto& shard_ptr : _shards)
+    {
+        auto& shard = *shard_ptr;
+        auto reads = shard.reads.exchange(0, std::memory_order_relaxed);
+        auto bytes = shard.bytes_received.exchange(0, std::memory_order_relaxed);
+        auto parked = shard.reads_parked.exchange(0, std::memory_order_relaxed);
+        spdlog::info("[session] Shard {}: {} connections, {} reads, {} bytes received, loop lag {}us, {} reads paused, {} connections paused now.",
+                     shard.index, shard.connection_count.load(std::memory_order_relaxed),
+                     reads, bytes, shard.loop_lag_us.load(std::memory_order_relaxed),
+                     parked, shard.parked_connections.load(std::memory_order_relaxed));
+        spdlog::info("[session] Shard {} timers: {} pending, {} fired, {} late ticks.",
+                     shard.index, shard.wheel.pending.load(std::memory_order_relaxed),
+                     shard.wheel.fired.exchange(0, std::memory_order_relaxed),
+                     shard.wheel.late_ticks.exchange(0, std::memory_order_relaxed));
+        spdlog::info("[session] Shard {} chat config: {} requests, {} cache hits, {} coalesced, {} failures, {} new connections, {} connections now.",
+                     shard.index, shard.live_config.requests.exchange(0, std::memory_order_relaxed),
+                     shard.live_config.cache_hits.exchange(0, std::memory_order_relaxed),
+                     shard.live_config.coalesced.exchange(0, std::memory_order_relaxed),
+                     shard.live_config.failures.exchange(0, std::memory_order_relaxed),
+                     shard.live_config.handshakes.exchange(0, std::memory_order_relaxed),
+                     shard.live_config.connection_count());
+
+        // 探测分片事件循环的排队延迟，结果在下一次统计中输出
+        post(shard.context, [&shard, posted = std::chrono::steady_clock::now()]() -> void {
+            auto lag = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - posted);
+            shard.loop_lag_us.store(lag.count(), std::memory_order_relaxed);
+        });
+    }
+}
+
+void vNerve::bilibili::bilibili_connection_manager::report_backpressure_statistics()
+{
+    if (_backpressure_mode == read_backpressure_mode::off)
+        return;
+    auto pauses = _read_pause_events.exchange(0, std::memory_order_relaxed);
+    auto resumes = _read_resume_events.exchange(0, std::memory_order_relaxed);
+    auto paused_us = _read_paused_us.load(std::memory_order_relaxed);
+    auto paused_now = _read_paused.load(std::memory_order_relaxed);
+    if (paused_now)
+    {
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        paused_us += now - _read_paused_since_us.load(std::memory_order_relaxed);
+    }
+    spdlog::info("[session] Read backpressure: {} pauses, {} resumes, {}ms paused in total, paused now: {}.",
+                 pauses, resumes, paused_us / 1000, paused_now);
+}
+
+void vNerve::bilibili::bilibili_connection_manager::report_memory_statistics()
+{
+    size_t connections = 0;
+    for (auto& shard : _shards)
+        connections += shard->connection_count.load(std::memory_order_relaxed);
+    auto resident = resident_memory();
+    if (resident > 0)
+    {
+        // 相对于没有连接时的增长，包括连接对象、OpenSSL 和 beast 的状态、读取缓冲区以及配置缓存等
+        auto grown = resident > _baseline_memory ? resident - _baseline_memory : 0;
+        spdlog::info("[session] Memory: {}MB resident, {}MB since start, {} connections, ~{}KB per connection.",
+                     resident / (1024 * 1024), grown / (1024 * 1024), connections,
+                     connections > 0 ? grown / connections / 1024 : 0);
+    }
+    report_read_buffer_statistics();
 }
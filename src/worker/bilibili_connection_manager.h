@@ -4,36 +4,78 @@
 #include <boost/thread.hpp>
 
 #include "config.h"
+#include "admission_controller.h"
 #include "bili_conn_plain_tcp.h"
 #include "bili_conn_ws.h"
+#include "bili_parse_pool.h"
+#include "dns_cache.h"
+#include "timing_wheel.h"
 
+#include <atomic>
 #include <memory>
-#include <string>
 #include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 namespace vNerve::bilibili
 {
 class borrowed_message;
 
-using room_event_handler = std::function<void(int)>;
-using room_data_handler = std::function<void(int, const borrowed_message*)>;
+///
+/// 到弹幕服务器的传输方式，见 transport、tcp-rooms 和 websocket-rooms 选项。
+enum class chat_transport
+{
+    websocket,  // WebSocket over TLS
+    tcp         // 纯 TCP，不加密
+};
 
-using enabled_bilibili_bilibili_connection = bilibili_connection_websocket;
+///
+/// 连接分片：独立的 io_context，由一个线程运行。
+/// 房间按哈希分配到分片，分片内的连接表只在该分片的线程上访问，因此不需要加锁。
+struct connection_shard
+{
+    const size_t index;
+    boost::asio::io_context context;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> guard;
+
+    std::unordered_map<int, std::shared_ptr<bilibili_connection>> connections;
+    timing_wheel wheel;  // 分片内所有连接的心跳、握手超时和空闲检测
+    bilibili_live_config_client live_config;  // 分片内所有连接共用的弹幕服务器配置客户端
+
+    // 以下统计由分片线程写入，统计定时器读取
+    std::atomic<size_t> connection_count{0};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<int64_t> loop_lag_us{0};  // 最近一次投递到分片的探测任务的排队时间
+    std::atomic<size_t> parked_connections{0};  // 因读取背压而暂停读取的连接数
+    std::atomic<uint64_t> reads_parked{0};
+
+    connection_shard(size_t index, std::chrono::milliseconds tick, const config::config_t& options, dns_cache& dns)
+        : index(index), context(1), guard(context.get_executor()), wheel(context, tick), live_config(context, options, dns) {}
+};
+
+///
+/// supervisor 发送队列积压时暂停读取哪些房间。
+enum class read_backpressure_mode
+{
+    off,
+    low_priority,  // 只暂停 low-priority-rooms 中的房间
+    all
+};
 
 ///
 /// Global network session for Bilibili Livestream chat crawling.
 /// This should be created only once through the whole program.
 class bilibili_connection_manager
 {
-    friend class bilibili_connection_plain_tcp;
-    friend class bilibili_connection_websocket;
+    friend class bilibili_connection;
 private:
-    boost::asio::io_context _context;
-    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _guard;
-    std::recursive_mutex _mutex;
+    std::vector<std::unique_ptr<connection_shard>> _shards;
     boost::thread_group _pool;
 
-    std::unordered_map<int, std::shared_ptr<enabled_bilibili_bilibili_connection>> _connections;
+    std::unique_ptr<bili_parse_pool> _parse_pool;
+
     int _max_connections;
 
     room_event_handler _on_room_failed;
@@ -41,14 +83,61 @@ private:
 
     config::config_t _options;
 
-    void on_room_failed(int room_id) { _on_room_failed(room_id); }
+    void on_room_failed(int room_id);
+    /// called when the connection to a room is fully established, in the room's shard thread
+    void on_room_established(int room_id);
     void on_room_data(int room_id, const borrowed_message* msg) { _on_room_data(room_id, msg); }
-    /// called on a room normally closes (usually by an unassignment)
+    /// called on a room normally closes (usually by an unassignment), in the room's shard thread
     void on_room_closed(int room_id);
+    /// called by parse threads when a packet of the room is malformed
+    void on_room_malformed(int room_id);
+
+    // 所有分片中已打开的房间，供会话恢复时读取
+    std::mutex _opened_rooms_mutex;
+    std::unordered_set<int> _opened_rooms;
+
+    std::unique_ptr<admission_controller> _admission;  // 定时器运行在第 0 个分片上
+    chat_server_selector _server_selector;
+    dns_cache _dns_cache;
+    /// 房间获得准入后真正打开连接
+    void start_connection(int room_id);
+
+    chat_transport _transport;
+    std::unordered_set<int> _tcp_rooms;
+    std::unordered_set<int> _websocket_rooms;
+    chat_transport transport_of(int room_id) const;
+    std::shared_ptr<bilibili_connection> create_connection(connection_shard& shard, int room_id);
+
+    connection_shard& shard_of(int room_id);
+    void run_shard(connection_shard* shard, bool pin);
+
+    std::chrono::milliseconds _heartbeat_interval;
+    std::chrono::milliseconds _handshake_timeout;
+    std::chrono::milliseconds _idle_timeout;
 
     std::string _shared_heartbeat_buffer_str;
     boost::asio::const_buffer _shared_heartbeat_buffer; // binary string :)
 
+    std::unique_ptr<boost::asio::deadline_timer> _stats_timer;  // 运行在第 0 个分片上
+    boost::posix_time::seconds _stats_interval;
+    read_backpressure_mode _backpressure_mode;
+    std::unordered_set<int> _low_priority_rooms;
+    std::atomic<bool> _read_paused{false};
+    // 以下统计由 set_read_paused 写入，统计定时器读取
+    std::atomic<int64_t> _read_paused_since_us{0};
+    std::atomic<uint64_t> _read_pause_events{0};
+    std::atomic<uint64_t> _read_resume_events{0};
+    std::atomic<uint64_t> _read_paused_us{0};  // 累计值，不含正在进行的暂停
+    void report_backpressure_statistics();
+    /// 让所有分片中因背压暂停的连接重新检查是否可以读取，可以在任意线程调用
+    void resume_parked_reads();
+    size_t _baseline_memory = 0;  // 分片启动后、打开任何房间前的常驻内存
+    void report_memory_statistics();
+
+    void start_stats_timer();
+    void on_stats_timer(const boost::system::error_code& ec);
+    void report_shard_statistics();
+
 public:
     bilibili_connection_manager(config::config_t, room_event_handler on_room_failed, room_data_handler on_room_data);
     ~bilibili_connection_manager();
@@ -56,14 +145,43 @@ public:
     void open_connection(int room_id);
     void close_connection(int room_id);
     void close_all_connections();
+    std::vector<int> opened_rooms();
+
+    ///
+    /// 暂停或恢复读取 Bilibili 连接，用于 supervisor 发送队列的背压。
+    /// 暂停时正在进行的读取不受影响，连接在下一次 start_read 时停下，由内核缓冲区暂存数据。
+    /// 调用方需保证调用是串行的。
+    void set_read_paused(bool paused);
+    /// 在房间所在分片的线程上调用
+    bool read_paused(int room_id) const
+    {
+        if (!_read_paused.load(std::memory_order_relaxed))
+            return false;
+        return _backpressure_mode == read_backpressure_mode::all || _low_priority_rooms.count(room_id) > 0;
+    }
+
+    chat_server_selector& server_selector() { return _server_selector; }
+    dns_cache& dns() { return _dns_cache; }
 
     const boost::asio::const_buffer& get_heartbeat_buffer()
     {
         return _shared_heartbeat_buffer;
     }
+    std::chrono::milliseconds heartbeat_interval() const { return _heartbeat_interval; }
+    std::chrono::milliseconds handshake_timeout() const { return _handshake_timeout; }
+    std::chrono::milliseconds idle_timeout() const { return _idle_timeout; }
+    ///
+    /// 下一次心跳的间隔：第一次在 [interval/2, interval) 中随机，之后在 [interval*0.9, interval) 中随机，
+    /// 使同时打开的房间的心跳分散到不同的 tick 中。
+    std::chrono::milliseconds next_heartbeat_delay(bool first);
 
     boost::program_options::variables_map& get_options() { return *_options; }
     config::config_t get_options_ptr() { return _options; }
-    boost::asio::io_context& get_io_context() { return _context; }
+
+    bili_parse_pool* get_parse_pool() { return _parse_pool.get(); }
+    std::unique_ptr<bili_parse_pool::room_producer> create_parse_producer(int room_id)
+    {
+        return _parse_pool ? _parse_pool->create_producer(room_id) : nullptr;
+    }
 };
 } // namespace vNerve::bilibili
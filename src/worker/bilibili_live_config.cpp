@@ -1,6 +1,10 @@
 #include "bilibili_live_config.h"
 
+#include "tls_context.h"
+
+#include <algorithm>
 #include <functional>
+#include <random>
 #include <boost/bind.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
@@ -16,286 +20,556 @@ using boost::system::error_code;
 
 namespace live_config
 {
-ssl::context* ssl_context = nullptr;
+// 空闲超过这个时间的长连接不再复用，服务器多半已经关闭了它
+const std::chrono::seconds keep_alive_idle(20);
+// 同一个请求最多因为连接断开重试的次数
+const int max_attempts = 2;
+}
+using namespace live_config;
 
-bool configure_ssl_context()
+/// @param tcp_servers 与 servers 一一对应的 TCP 端口，没有给出 port 时使用 default_tcp_port
+bool parse_bilibili_config(const std::string& body, std::string& token, std::vector<chat_server>& servers,
+                           std::vector<chat_server>& tcp_servers, const int default_tcp_port)
 {
-    ssl_context = new ssl::context{ssl::context::tls_client};
-    try
+    using namespace rapidjson;
+
+    Document document;
+    ParseResult result = document.Parse(body.c_str());
+    if (result.IsError())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Failed to parse JSON:{}", result.Code());
+        return false;
+    }
+    if (!document.IsObject())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Root element is not JSON object.");
+        return false;
+    }
+    auto code_iter = document.FindMember("code");
+    if (code_iter == document.MemberEnd() || !code_iter->value.IsInt())
     {
-        ssl_context->load_verify_file("cacert.pem");
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: no response code.");
+        return false;
     }
-    catch (boost::system::system_error& err)
+    if (code_iter->value.GetInt() != 0)
     {
-        spdlog::critical("[live_cfg] Failed to initialize ssl_context from file cacert.pem! Ensure you have a valid CA cert file. err:{}:{}", err.code().value(), err.code().message());
-        throw;
+        auto msg_iter = document.FindMember("msg");
+        auto message_iter = document.FindMember("message");
+        if (msg_iter == document.MemberEnd() || !msg_iter->value.IsString() || message_iter == document.MemberEnd() || !message_iter->value.IsString())
+            spdlog::warn("[bili_token_upd] Error in Bilibili Live Chat Config Response: code={}", code_iter->value.GetInt());
+        else
+            spdlog::warn("[bili_token_upd] Error in Bilibili Live Chat Config Response: code={}, msg={}, message={}",
+                         code_iter->value.GetInt(), msg_iter->value.GetString(), message_iter->value.GetString());
+        return false;
+    }
+    auto data_iter = document.FindMember("data");
+    if (data_iter == document.MemberEnd() || !data_iter->value.IsObject())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: no data object.");
+        return false;
+    }
+
+    auto token_iter = data_iter->value.FindMember("token");
+    if (token_iter == data_iter->value.MemberEnd() || !token_iter->value.IsString())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Token does not exist or isn't string.");
+        return false;
+    }
+
+    auto server_list_iter = data_iter->value.FindMember("host_list");
+    if (server_list_iter == data_iter->value.MemberEnd() || !server_list_iter->value.IsArray())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Server list doesn't exist or isn't array.");
+        return false;
+    }
+    if (server_list_iter->value.GetArray().Size() <= 0)
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: No chat server provided.");
+        return false;
+    }
+
+    servers.clear();
+    tcp_servers.clear();
+    for (auto server = server_list_iter->value.Begin(); server != server_list_iter->value.End(); ++server)
+    {
+        if (!server->IsObject())
+            continue;
+        auto char_server_host_iter = server->FindMember("host");
+        auto char_server_port_iter = server->FindMember("wss_port");
+        if (char_server_host_iter == server->MemberEnd() || !char_server_host_iter->value.IsString()
+            || char_server_port_iter == server->MemberEnd() || !char_server_port_iter->value.IsInt())
+            continue;
+
+        servers.push_back(chat_server{
+            std::string(char_server_host_iter->value.GetString(), char_server_host_iter->value.GetStringLength()),
+            char_server_port_iter->value.GetInt()});
+        auto tcp_port_iter = server->FindMember("port");
+        tcp_servers.push_back(chat_server{
+            servers.back().host,
+            tcp_port_iter != server->MemberEnd() && tcp_port_iter->value.IsInt() ? tcp_port_iter->value.GetInt() : default_tcp_port});
+    }
+    if (servers.empty())
+    {
+        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: port or host doesn't exist or valid.");
+        return false;
     }
-    spdlog::info("[live_cfg] Initialized SSL Context from cacert.pem.");
+    token = std::string(token_iter->value.GetString(), token_iter->value.GetStringLength());
     return true;
 }
-static const bool ssl_context_configured = configure_ssl_context();
-}
-using namespace live_config;
 
-class bilibili_live_config_fetch_context : public std::enable_shared_from_this<bilibili_live_config_fetch_context>
+///
+/// 到 API 服务器的一个长连接。请求按发送顺序排在 _in_flight 中，写完一个就写下一个，不等待前一个的响应；
+/// 响应按 HTTP/1.1 的约定依次读取，与 _in_flight 的队首对应。
+class bilibili_live_config_client::connection : public std::enable_shared_from_this<connection>
 {
 private:
-    io_context* _context;
-    int _room_id;
-    std::string _host;
-    std::string _endpoint;
-    std::string const* _user_agent;
-    std::function<void(bilibili_live_config const&)> _on_success;
-    std::function<void()> _on_failed;
-    config::config_t _config;
-
-    std::unique_ptr<ssl_stream<tcp_stream>> _stream;
-    std::unique_ptr<http::request<http::empty_body>> _request;
+    bilibili_live_config_client* _client;
+    ssl_stream<tcp_stream> _stream;
+
+    // [0, _written) 已写完，等待响应；_written 处的请求正在写入（如果 _writing）
+    std::deque<fetch_request> _in_flight;
+    size_t _written = 0;
+    bool _writing = false;
+    bool _reading = false;
+    bool _ready = false;  // TLS 握手已完成
+    bool _closed = false;
+    std::chrono::steady_clock::time_point _last_active;
+    std::chrono::steady_clock::time_point _handshake_started;
+
+    http::request<http::empty_body> _request;
     flat_buffer _buffer;
     http::response<http::string_body> _response;
 
-    void on_resolved(const error_code& ec, const ip::tcp::resolver::results_type& resolved);
     void on_connected(const error_code& ec);
     void on_ssl_handshake(const error_code& ec);
-    void on_http_req_written(const error_code& ec);
-    void on_response(const error_code& ec);
+    void write_next();
+    void on_written(const error_code& ec);
+    void read_next();
+    void on_read(const error_code& ec);
+    void fail(const char* step, const error_code& ec);
 
-    void parse_bilibili_config();
 public:
-    bilibili_live_config_fetch_context(io_context* context, int room_id, config::config_t config,
-                                       std::function<void(bilibili_live_config const&)> on_success, std::function<void()> on_failed,
-                                       std::string host, std::string endpoint, std::string const* user_agent)
-        : _context(context), _room_id(room_id), _host(std::move(host)), _endpoint(std::move(endpoint)),
-    _user_agent(user_agent), _on_success(std::move(on_success)), _on_failed(std::move(on_failed)), _config(config)
+    connection(bilibili_live_config_client* client)
+        : _client(client), _stream(client->_context, client_tls_context())
+    {
+    }
+
+    void start(const ip::tcp::resolver::results_type& resolved);
+    void send(fetch_request request);
+    void close();
+
+    bool ready() const { return _ready && !_closed; }
+    size_t load() const { return _in_flight.size(); }
+    bool stale(std::chrono::steady_clock::time_point now) const
     {
+        return _ready && _in_flight.empty() && now - _last_active > keep_alive_idle;
     }
-    void init(ip::tcp::resolver& resolver, std::string const& port);
 };
 
-void bilibili_live_config_fetch_context::on_resolved(const error_code& ec, const ip::tcp::resolver::results_type& resolved)
+void bilibili_live_config_client::connection::start(const ip::tcp::resolver::results_type& resolved)
 {
-    if (ec)
-        return _on_failed(), spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config. Can't resolve. err: {}:{}",
-            _room_id, ec.value(), ec.message());
-    _stream = std::make_unique<ssl_stream<tcp_stream>>(*_context, *ssl_context);
-    _stream->next_layer().expires_after(std::chrono::seconds((*_config)["chat-config-timeout-sec"].as<int>()));
-    if (!SSL_set_tlsext_host_name(_stream->native_handle(), _host.c_str()))
+    if (!prepare_tls_session(_stream.native_handle(), _client->_host))
     {
-        error_code ec2 {static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category()};
-        _on_failed();
-        return spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config when setting up openssl. err: {}:{}",
-            _room_id, ec2.value(), ec2.message());
+        error_code ec{static_cast<int>(ERR_get_error()), error::get_ssl_category()};
+        return fail("setting up openssl", ec);
     }
-
-    async_connect(_stream->next_layer().socket(), resolved,
-                  boost::bind(&bilibili_live_config_fetch_context::on_connected, shared_from_this(), placeholders::error));
+    _stream.next_layer().expires_after(_client->_timeout);
+    _stream.next_layer().async_connect(
+        resolved,
+        [self = shared_from_this()](const error_code& ec, const ip::tcp::endpoint&) -> void {
+            self->on_connected(ec);
+        });
 }
 
-void bilibili_live_config_fetch_context::on_connected(const error_code& ec)
+void bilibili_live_config_client::connection::on_connected(const error_code& ec)
 {
+    if (_closed)
+        return;
     if (ec)
-        return _on_failed(), spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config can't connect. err: {}:{}",
-            _room_id, ec.value(), ec.message());
-    _stream->async_handshake(ssl::stream_base::client,
-                             boost::bind(&bilibili_live_config_fetch_context::on_ssl_handshake, shared_from_this(), placeholders::error));
+        return fail("connecting", ec);
+    _handshake_started = std::chrono::steady_clock::now();
+    _stream.next_layer().expires_after(_client->_timeout);
+    _stream.async_handshake(ssl::stream_base::client,
+                            boost::bind(&connection::on_ssl_handshake, shared_from_this(), placeholders::error));
 }
 
-void bilibili_live_config_fetch_context::on_ssl_handshake(const error_code& ec)
+void bilibili_live_config_client::connection::on_ssl_handshake(const error_code& ec)
 {
+    if (_closed)
+        return;
     if (ec)
     {
-        _stream->next_layer().close();
-        return _on_failed(), spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config when performing SSL handshake. err: {}:{}",
-            _room_id, ec.value(), ec.message());
+        if (ec.value() != error::operation_aborted)
+            record_tls_handshake_failure(_stream.native_handle());
+        return fail("performing SSL handshake", ec);
     }
+    record_tls_handshake(_stream.native_handle(), std::chrono::steady_clock::now() - _handshake_started);
+    _ready = true;
+    _last_active = std::chrono::steady_clock::now();
+    SPDLOG_DEBUG("[live_cfg] Connected to chat config server {}:{}.", _client->_host, _client->_port);
+    _client->on_connection_ready(shared_from_this());
+}
 
-    _request = std::make_unique<http::request<http::empty_body>>();
-    _request->version(11);
-    _request->target(_endpoint);
-    _request->method(http::verb::get);
-    _request->set(http::field::host, _host);
-    _request->set(http::field::accept, "application/json");
-    _request->set(http::field::user_agent, _user_agent);
-    _request->set(http::field::referer, (*_config)["chat-config-referer"].as<std::string>());
-
-    http::async_write(*_stream, *_request,
-        boost::bind(&bilibili_live_config_fetch_context::on_http_req_written, shared_from_this(), placeholders::error));
+void bilibili_live_config_client::connection::send(fetch_request request)
+{
+    _in_flight.push_back(std::move(request));
+    write_next();
 }
 
-void bilibili_live_config_fetch_context::on_http_req_written(const error_code& ec)
+void bilibili_live_config_client::connection::write_next()
 {
+    if (_writing || _closed || _written == _in_flight.size())
+        return;
+    auto& request = _in_flight[_written];
+    _writing = true;
+
+    _request = {};
+    _request.version(11);
+    _request.target(request.target);
+    _request.method(http::verb::get);
+    _request.set(http::field::host, _client->_host);
+    _request.set(http::field::accept, "application/json");
+    _request.set(http::field::user_agent, *request.user_agent);
+    _request.set(http::field::referer, _client->_referer);
+    _request.keep_alive(true);
+
+    _stream.next_layer().expires_after(_client->_timeout);
+    http::async_write(_stream, _request,
+                      boost::bind(&connection::on_written, shared_from_this(), placeholders::error));
+}
+
+void bilibili_live_config_client::connection::on_written(const error_code& ec)
+{
+    _writing = false;
+    if (_closed)
+        return;
     if (ec)
-    {
-        _stream->next_layer().close();
-        _on_failed();
-        return spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config when writing request. err: {}:{}",
-            _room_id, ec.value(), ec.message());
-    }
-    http::async_read(*_stream, _buffer, _response,
-        boost::bind(&bilibili_live_config_fetch_context::on_response, shared_from_this(), placeholders::error));
+        return fail("writing request", ec);
+    _written++;
+    read_next();
+    write_next();
+}
+
+void bilibili_live_config_client::connection::read_next()
+{
+    if (_reading || _closed || _written == 0)
+        return;
+    _reading = true;
+    _response = {};
+    _stream.next_layer().expires_after(_client->_timeout);
+    http::async_read(_stream, _buffer, _response,
+                     boost::bind(&connection::on_read, shared_from_this(), placeholders::error));
 }
 
-void bilibili_live_config_fetch_context::on_response(const error_code& ec)
+void bilibili_live_config_client::connection::on_read(const error_code& ec)
 {
+    _reading = false;
+    if (_closed)
+        return;
     if (ec)
+        return fail("receiving response", ec);
+
+    auto request = std::move(_in_flight.front());
+    _in_flight.pop_front();
+    _written--;
+    _last_active = std::chrono::steady_clock::now();
+    auto keep_alive = _response.keep_alive();
+    auto self = shared_from_this();  // 回调中可能关闭连接
+    _client->on_response(request, _response.result_int(), _response.body());
+
+    if (_closed)
+        return;
+    if (!keep_alive)
     {
-        _stream->next_layer().close();
-        _on_failed();
-        return spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config when receiving response. err: {}:{}",
-            _room_id, ec.value(), ec.message());
-    }
-    error_code ec2;
-    _stream->shutdown(ec2);
-    if (_response.result() != http::status::ok)
-    {
-        _on_failed();
-        spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config. HTTP status:{}",
-            _room_id, _response.result());
+        // 服务器不再接受这个连接上的请求，剩下的请求换一个连接重发
+        SPDLOG_DEBUG("[live_cfg] Chat config server closed keep-alive connection, {} requests to resend.", _in_flight.size());
+        close();
+        _client->on_connection_failed(self, std::move(_in_flight), true);
         return;
     }
-    parse_bilibili_config();
+    read_next();
+    write_next();
+    _client->pump();
 }
 
-void bilibili_live_config_fetch_context::parse_bilibili_config()
+void bilibili_live_config_client::connection::fail(const char* step, const error_code& ec)
 {
-    using namespace rapidjson;
+    if (_closed)
+        return;
+    if (ec.value() != error::operation_aborted)
+        spdlog::warn("[live_cfg] Failed to fetch chat config when {}, {} requests affected. err: {}:{}",
+                     step, _in_flight.size(), ec.value(), ec.message());
+    close();
+    _client->on_connection_failed(shared_from_this(), std::move(_in_flight), _ready);
+}
 
-    Document document;
-    ParseResult result = document.Parse(_response.body().c_str());
-    if (result.IsError())
+void bilibili_live_config_client::connection::close()
+{
+    if (_closed)
+        return;
+    _closed = true;
+    _stream.next_layer().close();
+}
+
+bilibili_live_config_client::bilibili_live_config_client(io_context& context, config::config_t config, dns_cache& dns)
+    : _context(context),
+      _config(config),
+      _dns(dns),
+      _url((*config)["chat-config-url"].as<std::string>()),
+      _referer((*config)["chat-config-referer"].as<std::string>()),
+      _user_agents((*config)["chat-config-user-agent"].as<std::vector<std::string>>()),
+      _max_connections(std::max((*config)["chat-config-connections"].as<int>(), 1)),
+      _pipeline(std::max((*config)["chat-config-pipeline"].as<int>(), 1)),
+      _cache_ttl((*config)["chat-config-cache-sec"].as<int>()),
+      _timeout((*config)["chat-config-timeout-sec"].as<int>()),
+      _default_tcp_port((*config)["chat-server-tcp-port"].as<int>())
+{
+    // 主机和端口与房间号无关，只解析一次
+    UriUriA uri;
+    const char* errorPos;
+    auto raw_url = fmt::format(_url, 0);
+    auto retval = uriParseSingleUriA(&uri, raw_url.c_str(), &errorPos);
+    if (retval != URI_SUCCESS)
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Failed to parse JSON:{}", result.Code());
-        return _on_failed();
+        spdlog::error("[live_cfg] Failed to parse chat config url {}!!!!!! urlparser Err:{}", raw_url, retval);
+        return;
     }
-    if (!document.IsObject())
+    _port = std::string(uri.portText.first, uri.portText.afterLast);
+    if (_port.empty())
+        _port = "443";
+    _host = std::string(uri.hostText.first, uri.hostText.afterLast);
+    uriFreeUriMembersA(&uri);
+}
+
+bilibili_live_config_client::~bilibili_live_config_client()
+{
+    stop();
+}
+
+std::string path_seg_to_string(UriPathSegmentA* xs, const std::string& delim)
+{
+    UriPathSegmentStructA* head(xs);
+    std::string ret;
+
+    while (head)
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Root element is not JSON object.");
-        return _on_failed();
+        ret += delim + std::string(head->text.first, head->text.afterLast);
+        head = head->next;
     }
-    auto code_iter = document.FindMember("code");
-    if (code_iter == document.MemberEnd() || !code_iter->value.IsInt())
+
+    return ret;
+}
+
+bool bilibili_live_config_client::parse_target(const int room_id, std::string& target) const
+{
+    UriUriA uri;
+    const char* errorPos;
+    auto raw_url = fmt::format(_url, room_id);
+    auto retval = uriParseSingleUriA(&uri, raw_url.c_str(), &errorPos);
+    if (retval != URI_SUCCESS)
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: no response code.");
-        return _on_failed();
+        spdlog::error("[live_cfg] Failed to parse chat config url {}!!!!!! urlparser Err:{}", raw_url, retval);
+        return false;
     }
-    if (code_iter->value.GetInt() != 0)
+    target = path_seg_to_string(uri.pathHead, "/") + "?" + std::string(uri.query.first, uri.query.afterLast - uri.query.first);
+    uriFreeUriMembersA(&uri);
+    return true;
+}
+
+std::string const* bilibili_live_config_client::pick_user_agent() const
+{
+    thread_local std::mt19937 rand_engine(std::random_device{}());
+    std::uniform_int_distribution<size_t> ua_dist(0, _user_agents.size() - 1);
+    return &_user_agents[ua_dist(rand_engine)];
+}
+
+void bilibili_live_config_client::fetch(const int room_id, live_config_success_handler on_success, live_config_failure_handler on_failed)
+{
+    auto cache_iter = _cache.find(room_id);
+    if (cache_iter != _cache.end())
     {
-        auto msg_iter = document.FindMember("msg");
-        auto message_iter = document.FindMember("message");
-        if (msg_iter == document.MemberEnd() || !msg_iter->value.IsString() || message_iter == document.MemberEnd() || !message_iter->value.IsString())
-            spdlog::warn("[bili_token_upd] Error in Bilibili Live Chat Config Response: code={}", code_iter->value.GetInt());
-        else
-            spdlog::warn("[bili_token_upd] Error in Bilibili Live Chat Config Response: code={}, msg={}, message={}",
-                         code_iter->value.GetInt(), msg_iter->value.GetString(), message_iter->value.GetString());
-        return _on_failed();
+        if (cache_iter->second.expires > std::chrono::steady_clock::now())
+        {
+            cache_hits.fetch_add(1, std::memory_order_relaxed);
+            post(_context, [config = cache_iter->second, on_success = std::move(on_success)]() -> void {
+                on_success(bilibili_live_config{config.servers, config.tcp_servers, config.token, *config.user_agent});
+            });
+            return;
+        }
+        _cache.erase(cache_iter);
     }
-    auto data_iter = document.FindMember("data");
-    if (data_iter == document.MemberEnd() || !data_iter->value.IsObject())
+
+    auto [waiting_iter, inserted] = _waiting.try_emplace(room_id);
+    waiting_iter->second.push_back(waiter{std::move(on_success), std::move(on_failed)});
+    if (!inserted)
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: no data object.");
-        return _on_failed();
+        // 同一房间已经有请求在进行，等它的结果就好
+        coalesced.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    auto token_iter = data_iter->value.FindMember("token");
-    if (token_iter == data_iter->value.MemberEnd() || !token_iter->value.IsString())
+    fetch_request request{room_id, {}, pick_user_agent()};
+    if (_host.empty() || !parse_target(room_id, request.target))
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Token does not exist or isn't string.");
-        return _on_failed();
+        post(_context, [this, room_id]() -> void { complete(room_id, nullptr); });
+        return;
     }
+    _queue.push_back(std::move(request));
+    pump();
+}
 
-    auto server_list_iter = data_iter->value.FindMember("host_list");
-    if (server_list_iter == data_iter->value.MemberEnd() || !server_list_iter->value.IsArray())
+void bilibili_live_config_client::pump()
+{
+    auto now = std::chrono::steady_clock::now();
+    _connections.erase(
+        std::remove_if(_connections.begin(), _connections.end(),
+                       [now](const std::shared_ptr<connection>& conn) -> bool {
+                           if (!conn->stale(now))
+                               return false;
+                           conn->close();
+                           return true;
+                       }),
+        _connections.end());
+
+    while (!_queue.empty())
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Server list doesn't exist or isn't array.");
-        return _on_failed();
+        connection* best = nullptr;
+        for (auto& conn : _connections)
+            if (conn->ready() && conn->load() < _pipeline && (!best || conn->load() < best->load()))
+                best = conn.get();
+        // 已有的连接都有请求在排队时再开一个，冷启动时连接数很快涨到上限
+        if (!_connecting && _connections.size() < _max_connections && (!best || best->load() > 0))
+            open_connection();
+        if (!best)
+            return;
+        best->send(std::move(_queue.front()));
+        _queue.pop_front();
     }
-    if (server_list_iter->value.GetArray().Size() <= 0)
+}
+
+void bilibili_live_config_client::open_connection()
+{
+    _connecting = true;
+    _dns.resolve(_context, _host, _port,
+                 std::bind(&bilibili_live_config_client::on_resolved, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+void bilibili_live_config_client::on_resolved(const error_code& ec, ip::tcp::resolver::results_type resolved)
+{
+    if (ec)
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: No chat server provided.");
-        return _on_failed();
+        if (ec.value() == error::operation_aborted)
+            return;
+        spdlog::warn("[live_cfg] Failed to fetch chat config! Can't resolve {}. err: {}:{}",
+                     _host, ec.value(), ec.message());
+        on_connection_failed(nullptr, {}, false);
+        return;
     }
+    auto conn = std::make_shared<connection>(this);
+    _connections.push_back(conn);
+    conn->start(resolved);
+}
 
-    auto chat_server = server_list_iter->value.Begin();
-    auto succ = false;
-    while (chat_server != server_list_iter->value.End() && !succ)
+void bilibili_live_config_client::on_connection_ready(const std::shared_ptr<connection>& conn)
+{
+    _connecting = false;
+    handshakes.fetch_add(1, std::memory_order_relaxed);
+    pump();
+}
+
+void bilibili_live_config_client::on_connection_failed(const std::shared_ptr<connection>& conn, std::deque<fetch_request> unfinished, const bool connected)
+{
+    if (conn)
+        _connections.erase(std::remove(_connections.begin(), _connections.end(), conn), _connections.end());
+
+    // 已发出的请求放回队首重发，保持原来的顺序
+    for (auto iter = unfinished.rbegin(); iter != unfinished.rend(); ++iter)
     {
-        if (!chat_server->IsObject())
+        if (++iter->attempts >= max_attempts)
         {
-            chat_server++;
-            continue;
+            failures.fetch_add(1, std::memory_order_relaxed);
+            complete(iter->room_id, nullptr);
         }
-        auto char_server_host_iter = chat_server->FindMember("host");
-        auto char_server_port_iter = chat_server->FindMember("wss_port");
-        if (char_server_host_iter == chat_server->MemberEnd() || !char_server_host_iter->value.IsString()
-            || char_server_port_iter == chat_server->MemberEnd() || !char_server_port_iter->value.IsInt())
+        else
+            _queue.push_front(std::move(*iter));
+    }
+
+    if (!connected)
+    {
+        _connecting = false;
+        // 还有可用的连接时，排队的请求由它们处理
+        if (std::any_of(_connections.begin(), _connections.end(),
+                        [](const std::shared_ptr<connection>& other) -> bool { return other->ready(); }))
+            return;
+        // 连不上服务器，排队的请求也不用等了，由 supervisor 稍后重新分配
+        while (!_queue.empty())
         {
-            chat_server++;
-            continue;
+            auto room_id = _queue.front().room_id;
+            _queue.pop_front();
+            failures.fetch_add(1, std::memory_order_relaxed);
+            complete(room_id, nullptr);
         }
-
-        auto token = std::string(token_iter->value.GetString(), token_iter->value.GetStringLength());
-        auto host = std::string(char_server_host_iter->value.GetString(), char_server_host_iter->value.GetStringLength());
-        auto port = char_server_port_iter->value.GetInt();
-        SPDLOG_DEBUG("[bili_token_upd] Received new bilibili live chat config. token={}, host={}, port={}, ua={}", token, host, port, *_user_agent);
-
-        _on_success(bilibili_live_config{host, port, token, *_user_agent});
         return;
     }
-    if (!succ)
-    {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: port or host doesn't exist or valid.");
-        return _on_failed();
-    }
+    pump();
 }
 
-void bilibili_live_config_fetch_context::init(ip::tcp::resolver& resolver, std::string const& port)
+void bilibili_live_config_client::on_response(const fetch_request& request, const unsigned status, const std::string& body)
 {
-    resolver.async_resolve(_host, port,
-                           boost::bind(&bilibili_live_config_fetch_context::on_resolved, shared_from_this(), placeholders::error, placeholders::iterator));
+    requests.fetch_add(1, std::memory_order_relaxed);
+    if (status != static_cast<unsigned>(http::status::ok))
+    {
+        spdlog::warn("[live_cfg] Failed connecting to room {}! Failed to fetch chat config. HTTP status:{}",
+                     request.room_id, status);
+        failures.fetch_add(1, std::memory_order_relaxed);
+        return complete(request.room_id, nullptr);
+    }
+
+    cached_config config{};
+    std::vector<chat_server> servers, tcp_servers;
+    if (!parse_bilibili_config(body, config.token, servers, tcp_servers, _default_tcp_port))
+    {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        return complete(request.room_id, nullptr);
+    }
+    if (!_last_servers || *_last_servers != servers)
+        _last_servers = std::make_shared<const std::vector<chat_server>>(std::move(servers));
+    if (!_last_tcp_servers || *_last_tcp_servers != tcp_servers)
+        _last_tcp_servers = std::make_shared<const std::vector<chat_server>>(std::move(tcp_servers));
+    config.servers = _last_servers;
+    config.tcp_servers = _last_tcp_servers;
+    config.user_agent = request.user_agent;
+    config.expires = std::chrono::steady_clock::now() + _cache_ttl;
+    SPDLOG_DEBUG("[bili_token_upd] Received new bilibili live chat config. room={}, token={}, {} servers, first={}:{}, ua={}",
+                 request.room_id, config.token, config.servers->size(), config.servers->front().host, config.servers->front().port, *config.user_agent);
+    if (_cache_ttl.count() > 0)
+        _cache[request.room_id] = config;
+    complete(request.room_id, &config);
 }
 
-std::string path_seg_to_string(UriPathSegmentA* xs, const std::string& delim)
+void bilibili_live_config_client::complete(const int room_id, const cached_config* config)
 {
-    UriPathSegmentStructA* head(xs);
-    std::string ret;
-
-    while (head)
+    auto iter = _waiting.find(room_id);
+    if (iter == _waiting.end())
+        return;
+    auto waiters = std::move(iter->second);
+    _waiting.erase(iter);
+    for (auto& waiter : waiters)
     {
-        ret += delim + std::string(head->text.first, head->text.afterLast);
-        head = head->next;
+        if (config)
+            waiter.on_success(bilibili_live_config{config->servers, config->tcp_servers, config->token, *config->user_agent});
+        else
+            waiter.on_failed();
     }
-
-    return ret;
 }
 
-void async_fetch_bilibili_live_config(
-    io_context& context,
-    ip::tcp::resolver& resolver,
-    config::config_t config,
-    int room_id,
-    std::function<void(bilibili_live_config const&)> on_success,
-    std::function<void()> on_failed)
+void bilibili_live_config_client::stop()
 {
-    auto const& user_agents = (*config)["chat-config-user-agent"].as<std::vector<std::string>>();
-    std::random_device rd;
-    std::mt19937 rand_engine(rd() * room_id);
-    std::uniform_int_distribution<> ua_dist(0, user_agents.size() - 1);
-    auto const& user_agent = user_agents[ua_dist(rand_engine)];
-
-    UriUriA uri;
-    const char* errorPos;
-    auto raw_url = fmt::format((*config)["chat-config-url"].as<std::string>(), room_id);
-    auto retval = uriParseSingleUriA(&uri, raw_url.c_str(), &errorPos);
-    if (retval != URI_SUCCESS)
-        return spdlog::error("[live_cfg] Failed to parse chat config url {}!!!!!! urlparser Err:{}", raw_url, retval);
-
-    auto port = std::string(uri.portText.first, uri.portText.afterLast);
-    if (port.empty())
-        port = "443";
-    auto host = std::string(uri.hostText.first, uri.hostText.afterLast);
-    auto endpoint = path_seg_to_string(uri.pathHead, "/") + "?" + std::string(uri.query.first, uri.query.afterLast - uri.query.first);
-
-    std::make_shared<bilibili_live_config_fetch_context>(&context, room_id, config, on_success, on_failed, host, endpoint, &user_agent)->init(resolver, port);
-    uriFreeUriMembersA(&uri);
+    // 分片线程已经退出，未完成的请求直接丢弃，不再回调
+    for (auto& conn : _connections)
+        conn->close();
+    _connections.clear();
+    _queue.clear();
+    _waiting.clear();
 }
 }
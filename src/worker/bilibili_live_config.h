@@ -1,23 +1,125 @@
 #pragma once
+#include "chat_server_selector.h"
 #include "config.h"
+#include "dns_cache.h"
 
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace vNerve::bilibili
 {
 struct bilibili_live_config
 {
-    std::string host;
-    int port;
+    chat_server_list servers;      // WebSocket (wss) 端口，至少有一个
+    chat_server_list tcp_servers;  // 与 servers 对应的 TCP 端口
     std::string token;
     std::string const& user_agent;
 };
 
-void async_fetch_bilibili_live_config(
-    boost::asio::io_context& context,
-    boost::asio::ip::tcp::resolver& resolver,
-    config::config_t config,
-    int room_id,
-    std::function<void(bilibili_live_config const&)> on_success,
-    std::function<void()> on_failed);
+using live_config_success_handler = std::function<void(bilibili_live_config const&)>;
+using live_config_failure_handler = std::function<void()>;
+
+///
+/// 获取弹幕服务器配置（getDanmuInfo）的 HTTPS 客户端。每个连接分片一个，只能在分片的线程上使用。
+/// - 到 API 服务器保持最多 chat-config-connections 个长连接，每个连接上最多流水线发送 chat-config-pipeline 个请求；
+/// - 成功获取的配置按房间缓存 chat-config-cache-sec 秒；
+/// - 同一房间同时发起的多个请求合并为一个。
+/// 房间固定属于一个分片，所以缓存和请求合并都不需要跨分片共享。
+class bilibili_live_config_client
+{
+    class connection;
+
+    struct fetch_request
+    {
+        int room_id;
+        std::string target;
+        std::string const* user_agent;
+        int attempts = 0;
+    };
+
+    struct cached_config
+    {
+        chat_server_list servers;
+        chat_server_list tcp_servers;
+        std::string token;
+        std::string const* user_agent;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct waiter
+    {
+        live_config_success_handler on_success;
+        live_config_failure_handler on_failed;
+    };
+
+    boost::asio::io_context& _context;
+    config::config_t _config;  // 持有配置，_user_agents 和缓存中的 User-Agent 指向其中
+    dns_cache& _dns;
+
+    std::string _url;
+    std::string _host;
+    std::string _port;
+    std::string _referer;
+    std::vector<std::string> const& _user_agents;
+
+    size_t _max_connections;
+    size_t _pipeline;
+    std::chrono::seconds _cache_ttl;
+    std::chrono::seconds _timeout;
+    int _default_tcp_port;  // 服务器列表中没有 TCP 端口时使用
+
+    std::vector<std::shared_ptr<connection>> _connections;
+    bool _connecting = false;  // 同时只建立一个新连接，其余请求排队等待
+    std::deque<fetch_request> _queue;
+    std::unordered_map<int, std::vector<waiter>> _waiting;  // 正在获取的房间及等待结果的回调
+    std::unordered_map<int, cached_config> _cache;
+    chat_server_list _last_servers;  // 最近一次获取的服务器列表，相同的列表共用它
+    chat_server_list _last_tcp_servers;
+
+    bool parse_target(int room_id, std::string& target) const;
+    std::string const* pick_user_agent() const;
+
+    void pump();
+    void open_connection();
+    void on_resolved(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::results_type resolved);
+    void on_connection_ready(const std::shared_ptr<connection>& conn);
+    void on_connection_failed(const std::shared_ptr<connection>& conn, std::deque<fetch_request> unfinished, bool connected);
+
+    void on_response(const fetch_request& request, unsigned status, const std::string& body);
+    void complete(int room_id, const cached_config* config);
+
+public:
+    // 以下统计由分片线程写入，统计定时器读取
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> handshakes{0};
+    std::atomic<uint64_t> failures{0};
+
+    bilibili_live_config_client(boost::asio::io_context& context, config::config_t config, dns_cache& dns);
+    ~bilibili_live_config_client();
+
+    bilibili_live_config_client(const bilibili_live_config_client&) = delete;
+    bilibili_live_config_client& operator=(const bilibili_live_config_client&) = delete;
+
+    ///
+    /// 获取房间的弹幕服务器配置。回调总是异步调用的，不会在 fetch 内部直接调用。
+    void fetch(int room_id, live_config_success_handler on_success, live_config_failure_handler on_failed);
+    ///
+    /// 丢弃房间缓存的配置，在用缓存的配置连接失败时调用，下次会重新获取。
+    void invalidate(int room_id) { _cache.erase(room_id); }
+    size_t connection_count() const { return _connections.size(); }
+    ///
+    /// 关闭所有连接，丢弃未完成的请求。分片线程退出后调用。
+    void stop();
+};
 }
@@ -68,28 +68,31 @@ void bilibili_token_updater::on_updated(std::string_view body)
         return;
     }
 
-    auto chat_server = server_list_iter->value.GetArray().Begin();
-    if (!chat_server->IsObject())
+    std::vector<chat_server> servers;
+    for (auto& server : server_list_iter->value.GetArray())
     {
-        spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: Chat server info isn't JSON object.");
-        return;
+        if (!server.IsObject())
+            continue;
+        auto char_server_host_iter = server.FindMember("host");
+        auto char_server_port_iter = server.FindMember("port");
+        if (char_server_host_iter == server.MemberEnd() || !char_server_host_iter->value.IsString()
+            || char_server_port_iter == server.MemberEnd() || !char_server_port_iter->value.IsInt())
+            continue;
+        servers.push_back(chat_server{
+            std::string(char_server_host_iter->value.GetString(), char_server_host_iter->value.GetStringLength()),
+            char_server_port_iter->value.GetInt()});
     }
-
-    auto char_server_host_iter = chat_server->FindMember("host");
-    auto char_server_port_iter = chat_server->FindMember("port");
-    if (char_server_host_iter == chat_server->MemberEnd() || !char_server_host_iter->value.IsString()
-        || char_server_port_iter == chat_server->MemberEnd() || !char_server_port_iter->value.IsInt())
+    if (servers.empty())
     {
         spdlog::warn("[bili_token_upd] Invalid Bilibili Live Chat Config Response: port or host doesn't exist or valid.");
         return;
     }
 
     auto token = std::string(token_iter->value.GetString(), token_iter->value.GetStringLength());
-    auto host = std::string(char_server_host_iter->value.GetString(), char_server_host_iter->value.GetStringLength());
-    auto port = char_server_port_iter->value.GetInt();
-    SPDLOG_DEBUG("[bili_token_upd] Received new bilibili live chat config. token={}, host={}, port={}", token, host, port);
+    SPDLOG_DEBUG("[bili_token_upd] Received new bilibili live chat config. token={}, {} servers, first={}:{}",
+                 token, servers.size(), servers.front().host, servers.front().port);
 
-    _callback(host, port, token);
+    _callback(servers, token);
 }
 
 bilibili_token_updater::bilibili_token_updater(const config::config_t config, bilibili_token_updater_callback callback)
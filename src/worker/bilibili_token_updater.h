@@ -1,13 +1,15 @@
 #pragma once
 
 #include "http_interval_updater.h"
+#include "chat_server_selector.h"
 #include "config.h"
 
 #include <functional>
 
 namespace vNerve::bilibili
 {
-using bilibili_token_updater_callback = std::function<void(const std::string&, int, const std::string&)>;
+/// 参数为服务器列表和 token
+using bilibili_token_updater_callback = std::function<void(const std::vector<chat_server>&, const std::string&)>;
 
 class bilibili_token_updater final : public http_interval_updater
 {
@@ -7,7 +7,7 @@ namespace vNerve::bilibili
 class borrowed_message
 {
 public:
-    int crc32;
+    checksum_t checksum;
     char routing_key[worker_supervisor::routing_key_max_size];
     virtual size_t size() const = 0;
     virtual void write(void* data, int size) const = 0;
@@ -0,0 +1,117 @@
+#include "chat_server_selector.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <random>
+
+namespace vNerve::bilibili
+{
+namespace
+{
+const double rtt_ewma_weight = 0.2;
+// 延迟不超过最低值的 120% + 2ms 的服务器视为一样快
+const double rtt_tolerance_ratio = 1.2;
+const double rtt_tolerance_ms = 2;
+const int max_cooldown_shift = 4;  // 冷却期最多为 chat-server-cooldown-sec 的 16 倍
+}  // namespace
+
+chat_server_selector::chat_server_selector(const std::chrono::seconds cooldown)
+    : _cooldown(cooldown)
+{
+}
+
+std::string chat_server_selector::key_of(const chat_server& server)
+{
+    return server.host + ':' + std::to_string(server.port);
+}
+
+size_t chat_server_selector::pick(const std::vector<chat_server>& servers, const std::vector<bool>& tried)
+{
+    thread_local std::minstd_rand engine(std::random_device{}());
+    auto now = clock::now();
+
+    std::vector<size_t> unmeasured, healthy;
+    std::vector<double> healthy_rtt;
+    auto earliest = servers.size();
+    auto earliest_up = clock::time_point::max();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < servers.size(); i++)
+        {
+            if (i < tried.size() && tried[i])
+                continue;
+            auto& stats = _servers[key_of(servers[i])];
+            if (stats.down_until > now)
+            {
+                if (stats.down_until < earliest_up)
+                {
+                    earliest_up = stats.down_until;
+                    earliest = i;
+                }
+                continue;
+            }
+            if (stats.rtt_ms < 0)
+                unmeasured.push_back(i);
+            else
+            {
+                healthy.push_back(i);
+                healthy_rtt.push_back(stats.rtt_ms);
+            }
+        }
+    }
+
+    if (!unmeasured.empty())
+        return unmeasured[std::uniform_int_distribution<size_t>(0, unmeasured.size() - 1)(engine)];
+    if (healthy.empty())
+        return earliest;
+
+    auto best = *std::min_element(healthy_rtt.begin(), healthy_rtt.end());
+    auto limit = best * rtt_tolerance_ratio + rtt_tolerance_ms;
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < healthy.size(); i++)
+        if (healthy_rtt[i] <= limit)
+            candidates.push_back(healthy[i]);
+    return candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(engine)];
+}
+
+void chat_server_selector::record_rtt(const chat_server& server, const clock::duration rtt)
+{
+    auto ms = std::chrono::duration<double, std::milli>(rtt).count();
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& stats = _servers[key_of(server)];
+    stats.rtt_ms = stats.rtt_ms < 0 ? ms : stats.rtt_ms + rtt_ewma_weight * (ms - stats.rtt_ms);
+    stats.samples++;
+}
+
+void chat_server_selector::on_established(const chat_server& server)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& stats = _servers[key_of(server)];
+    stats.consecutive_failures = 0;
+    stats.down_until = {};
+    stats.established++;
+}
+
+void chat_server_selector::on_failed(const chat_server& server)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& stats = _servers[key_of(server)];
+    stats.failures++;
+    auto shift = std::min(stats.consecutive_failures++, max_cooldown_shift);
+    stats.down_until = clock::now() + _cooldown * (1 << shift);
+}
+
+void chat_server_selector::report_statistics()
+{
+    auto now = clock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& [key, stats] : _servers)
+    {
+        spdlog::info("[servers] {}: rtt {:.1f}ms ({} samples), {} established, {} failed{}.",
+                     key, stats.rtt_ms, stats.samples, stats.established, stats.failures,
+                     stats.down_until > now ? ", cooling down" : "");
+        stats.samples = stats.established = stats.failures = 0;
+    }
+}
+}  // namespace vNerve::bilibili
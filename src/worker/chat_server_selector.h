@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+///
+/// 弹幕服务器（getDanmuInfo 返回的 host_list 中的一项）
+struct chat_server
+{
+    std::string host;
+    int port;
+
+    bool operator==(const chat_server& other) const { return port == other.port && host == other.host; }
+};
+
+/// 房间的弹幕服务器列表。大多数房间拿到的列表相同，共用一份。
+using chat_server_list = std::shared_ptr<const std::vector<chat_server>>;
+
+///
+/// 按各弹幕服务器的往返延迟和健康状况挑选连接的服务器，所有分片共用，线程安全。
+/// 延迟取 TCP 建连耗时和心跳往返耗时的指数移动平均。
+/// 连接失败的服务器在冷却期内不会被优先选择，冷却期随连续失败次数翻倍。
+class chat_server_selector
+{
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct server_stats
+    {
+        double rtt_ms = -1;  // 小于 0 表示还没有测量过
+        int consecutive_failures = 0;
+        clock::time_point down_until;
+        // 以下在统计周期内累计，report_statistics 后清空
+        uint64_t samples = 0;
+        uint64_t established = 0;
+        uint64_t failures = 0;
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, server_stats> _servers;  // 键为 host:port
+    std::chrono::seconds _cooldown;
+
+    static std::string key_of(const chat_server& server);
+
+public:
+    explicit chat_server_selector(std::chrono::seconds cooldown);
+
+    ///
+    /// 从还没尝试过的服务器中挑选一个：优先没有测量过延迟的服务器，其次是延迟与最低值相差不多的服务器（随机选一个，分散负载）。
+    /// 都在冷却期内时，选择最早结束冷却的服务器。
+    /// @param tried 与 servers 一一对应，已尝试过的服务器为 true
+    /// @return 选中的下标，都尝试过时返回 servers.size()
+    size_t pick(const std::vector<chat_server>& servers, const std::vector<bool>& tried);
+
+    void record_rtt(const chat_server& server, clock::duration rtt);
+    void on_established(const chat_server& server);
+    void on_failed(const chat_server& server);
+
+    void report_statistics();
+};
+}  // namespace vNerve::bilibili
@@ -4,24 +4,63 @@ namespace vNerve::bilibili::config
 {
 // Default options.
 const int DEFAULT_HEARTBEAT_TIMEOUT_SEC = 25;
+const int DEFAULT_HANDSHAKE_TIMEOUT_SEC = 45;
+const int DEFAULT_IDLE_TIMEOUT_SEC = 70;
+const int DEFAULT_TIMER_TICK_MS = 100;
 const std::string DEFAULT_CHAT_SERVER = "tx-sh-live-comet-03.chat.bilibili.com";
 const std::string DEFAULT_CHAT_SERVER_CONFIG_URL = "https://api.live.bilibili.com/xlive/web-room/v1/index/getDanmuInfo?id={}&type=0";
 const std::string DEFAULT_CHAT_SERVER_CONFIG_USER_AGENT = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/83.0.4103.97 Safari/537.36";
 const std::string DEFAULT_CHAT_SERVER_CONFIG_REFERER = "https://live.bilibili.com/";
 const int DEFAULT_CHAT_SERVER_CONFIG_INTERVAL_SEC = 10;
 const int DEFAULT_CHAT_SERVER_CONFIG_TIMEOUT_SEC = 15;
+const int DEFAULT_CHAT_SERVER_CONFIG_CACHE_SEC = 300;
+const int DEFAULT_CHAT_SERVER_CONFIG_CONNECTIONS = 4;
+const int DEFAULT_CHAT_SERVER_CONFIG_PIPELINE = 8;
 const int DEFAULT_CHAT_SERVER_PORT = 443;
+const int DEFAULT_CHAT_SERVER_TCP_PORT = 2243;
+const std::string DEFAULT_TRANSPORT = "websocket";
+const int DEFAULT_CHAT_SERVER_COOLDOWN_SEC = 30;
 const std::string DEFAULT_CHAT_SERVER_ENDPOINT = "/sub";
 const int DEFAULT_CHAT_SERVER_PROTOCOL_VER = 2;
+const std::string DEFAULT_JSON_ENGINE = "dom";
 
 const int DEFAULT_READ_BUFFER = 128 * 1024;
+const int DEFAULT_MAX_READ_BUFFER = 4 * 1024 * 1024;
+const int DEFAULT_READ_BUFFER_POOL = 16 * 1024 * 1024;
+const int DEFAULT_ZLIB_BUFFER = 256 * 1024;
+const std::string DEFAULT_ZLIB_BACKEND = "zlib";
 const int DEFAULT_THREADS = 1;
+const bool DEFAULT_PIN_THREADS = true;
+const int DEFAULT_PARSE_THREADS = 0;
+const int DEFAULT_PARSE_QUEUE_MAX = 4096;
+const std::string DEFAULT_TLS_CIPHERS = "";
+const std::string DEFAULT_TLS_CIPHERSUITES = "";
+const std::string DEFAULT_TLS_CURVES = "X25519:P-256:P-384";
+const bool DEFAULT_TLS_SESSION_RESUME = true;
+const int DEFAULT_MAX_CONCURRENT_HANDSHAKES = 64;
+const double DEFAULT_CONNECT_RATE = 100;
+const double DEFAULT_CONNECT_BURST = 50;
+const int DEFAULT_CONNECT_BACKOFF_MS = 1000;
+const int DEFAULT_CONNECT_BACKOFF_MAX_MS = 60 * 1000;
+const int DEFAULT_DNS_CACHE_TTL_SEC = 60;
+const int DEFAULT_DNS_NEGATIVE_TTL_SEC = 5;
 
 const std::string DEFAULT_SUPERVISOR_HOST = "localhost";
 const int DEFAULT_SUPERVISOR_PORT = 2434; // see also supervisor/config.cpp
 const int DEFAULT_MAX_ROOMS = 500;
 const int DEFAULT_MAX_RETRY_SEC = 60;
 const std::string DEFAULT_AUTH_CODE = "abcdefghijklmnopqrstuvwyzabcdef"; // see also supervisor/config.cpp
+const int DEFAULT_BATCH_SIZE = 16 * 1024;
+const int DEFAULT_BATCH_DELAY_US = 500;
+const int DEFAULT_LINK_COMPRESSION_LEVEL = 6;
+const int DEFAULT_SUPERVISOR_WRITE_HIGH_WATER = 16 * 1024 * 1024;
+const std::string DEFAULT_READ_BACKPRESSURE = "all";
+const int DEFAULT_REPLAY_BUFFER = 32 * 1024 * 1024;
+const int DEFAULT_REPLAY_MAX_AGE_MS = 10 * 1000;
+const bool DEFAULT_SESSION_RESUME = true;
+const int DEFAULT_SESSION_GRACE_SEC = 30;
+
+const int DEFAULT_STATS_INTERVAL_SEC = 60;
 
 boost::program_options::options_description create_description()
 {
@@ -34,23 +73,52 @@ boost::program_options::options_description create_description()
 
     auto descNetworking = options_description("Networking parameters");
     descNetworking.add_options()
-        ("read-buffer,b", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) of sockets to bilibili server.")
-        ("zlib-buffer", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) for storing unzipped bilibili chat packet.")
-        ("threads", value<int>()->default_value(DEFAULT_THREADS), "Thread numbers for communicating with bilibili server.")
+        ("read-buffer,b", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) of sockets to bilibili server in TCP mode. In WebSocket mode, read buffers up to this size are pooled and shared between rooms.")
+        ("read-buffer-pool", value<size_t>()->default_value(DEFAULT_READ_BUFFER_POOL), "Max bytes of free read buffers kept for reuse by each communicating thread.")
+        ("max-read-buffer", value<size_t>()->default_value(DEFAULT_MAX_READ_BUFFER), "Max reading buffer size(bytes) of sockets to bilibili server. Packets larger than this are disposed.")
+        ("zlib-buffer", value<size_t>()->default_value(DEFAULT_ZLIB_BUFFER), "Max buffer size(bytes) for decompressing bilibili chat packets. Decompressed packets larger than this are disposed.")
+        ("zlib-backend", value<std::string>()->default_value(DEFAULT_ZLIB_BACKEND), "Decompressor for protocol-ver 2 packets. zlib: streaming; libdeflate: faster, but zlib-buffer limits the whole packet.")
+        ("threads", value<int>()->default_value(DEFAULT_THREADS), "Thread numbers for communicating with bilibili server. Each thread runs its own shard of rooms.")
+        ("pin-threads", value<bool>()->default_value(DEFAULT_PIN_THREADS), "Pin each communicating thread to one CPU core.")
+        ("timer-tick-ms", value<int>()->default_value(DEFAULT_TIMER_TICK_MS), "Tick(milliseconds) of the timing wheel driving heartbeats and timeouts in each communicating thread.")
+        ("parse-threads", value<int>()->default_value(DEFAULT_PARSE_THREADS), "Thread numbers for decompressing and parsing bilibili packets. 0 to parse in communicating threads.")
+        ("parse-queue-max", value<size_t>()->default_value(DEFAULT_PARSE_QUEUE_MAX), "Max packets queued to one parse thread. Rooms of a parse thread at this depth stop reading until it drains to half.")
+        ("tls-ciphers", value<std::string>()->default_value(DEFAULT_TLS_CIPHERS), "OpenSSL cipher list for TLS 1.2 and below. Empty to use OpenSSL defaults.")
+        ("tls-ciphersuites", value<std::string>()->default_value(DEFAULT_TLS_CIPHERSUITES), "OpenSSL ciphersuites for TLS 1.3. Empty to use OpenSSL defaults.")
+        ("tls-curves", value<std::string>()->default_value(DEFAULT_TLS_CURVES), "Preferred key exchange groups, in OpenSSL groups list format. Empty to use OpenSSL defaults.")
+        ("tls-session-resume", value<bool>()->default_value(DEFAULT_TLS_SESSION_RESUME), "Resume TLS sessions (session tickets) when reconnecting to the same host.")
+        ("max-concurrent-handshakes", value<int>()->default_value(DEFAULT_MAX_CONCURRENT_HANDSHAKES), "Max rooms connecting (fetching config, resolving, TCP, TLS and WebSocket handshaking) at the same time. Others wait in a queue.")
+        ("connect-rate", value<double>()->default_value(DEFAULT_CONNECT_RATE), "Max rooms starting to connect per second. 0 for unlimited.")
+        ("connect-burst", value<double>()->default_value(DEFAULT_CONNECT_BURST), "Max rooms starting to connect at once before connect-rate applies.")
+        ("connect-backoff-ms", value<int>()->default_value(DEFAULT_CONNECT_BACKOFF_MS), "Initial delay(ms) before reopening a room that failed. Doubled on each failure, with jitter. 0 to disable.")
+        ("connect-backoff-max-ms", value<int>()->default_value(DEFAULT_CONNECT_BACKOFF_MAX_MS), "Max delay(ms) before reopening a room that failed repeatedly.")
+        ("dns-cache-ttl-sec", value<int>()->default_value(DEFAULT_DNS_CACHE_TTL_SEC), "Reuse resolved addresses of chat servers and the chat config server within this(secs). 0 to resolve every time, still sharing concurrent lookups.")
+        ("dns-negative-ttl-sec", value<int>()->default_value(DEFAULT_DNS_NEGATIVE_TTL_SEC), "Return the same error for this(secs) after failing to resolve a host. Previously resolved addresses are used instead if there are any.")
     ;
 
     auto descBili = options_description("Bilibili Livestream Interface options");
     descBili.add_options()
         ("heartbeat-timeout,t", value<int>()->default_value(DEFAULT_HEARTBEAT_TIMEOUT_SEC), "Timeout(secs) between heartbeat packets to Bilibili server.")
+        ("handshake-timeout-sec", value<int>()->default_value(DEFAULT_HANDSHAKE_TIMEOUT_SEC), "Timeout(secs) from fetching chat config to finishing WebSocket handshake with Bilibili server.")
+        ("idle-timeout-sec", value<int>()->default_value(DEFAULT_IDLE_TIMEOUT_SEC), "Reconnect a room if nothing is received from Bilibili server within this(secs). 0 to disable.")
         ("chat-server,s", value<std::string>()->default_value(DEFAULT_CHAT_SERVER), "Bilibili live chat server in TCP mode.")
         ("chat-server-port,p", value<int>()->default_value(DEFAULT_CHAT_SERVER_PORT), "Bilibili live chat server port.")
         ("chat-server-endpoint", value<std::string>()->default_value(DEFAULT_CHAT_SERVER_ENDPOINT), "Bilibili live chat server WebSocket endpoint.")
-        ("protocol-ver,V", value<int>()->default_value(DEFAULT_CHAT_SERVER_PROTOCOL_VER),"Bilibili live chat server protocol version.")
+        ("chat-server-tcp-port", value<int>()->default_value(DEFAULT_CHAT_SERVER_TCP_PORT), "Bilibili live chat server port in TCP mode, used when the chat config doesn't provide one.")
+        ("transport", value<std::string>()->default_value(DEFAULT_TRANSPORT), "Transport to Bilibili live chat server. websocket: WebSocket over TLS; tcp: plain TCP, unencrypted but cheaper.")
+        ("tcp-rooms", value<std::vector<int>>()->multitoken(), "Rooms connected in plain TCP regardless of transport.")
+        ("websocket-rooms", value<std::vector<int>>()->multitoken(), "Rooms connected in WebSocket over TLS regardless of transport.")
+        ("chat-server-cooldown-sec", value<int>()->default_value(DEFAULT_CHAT_SERVER_COOLDOWN_SEC), "Avoid a chat server for this(secs) after failing to connect to it. Doubled on consecutive failures.")
+        ("protocol-ver,V", value<int>()->default_value(DEFAULT_CHAT_SERVER_PROTOCOL_VER),"Bilibili live chat server protocol version. 2: zlib; 3: brotli.")
         ("chat-config-url", value<std::string>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_URL),"Bilibili live chat config URL. Use {} as placeholder for roomid.")
         ("chat-config-user-agent", value<std::vector<std::string>>()->default_value(std::vector{DEFAULT_CHAT_SERVER_CONFIG_USER_AGENT}, DEFAULT_CHAT_SERVER_CONFIG_USER_AGENT),"User-Agent used in requesting bilibili live chat config URL.")
         ("chat-config-referer", value<std::string>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_REFERER),"Referer used in requesting bilibili chat config URL.")
         ("chat-config-interval-sec", value<int>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_INTERVAL_SEC),"Interval between requesting bilibili chat config URL.")
         ("chat-config-timeout-sec", value<int>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_TIMEOUT_SEC),"Timeout requesting bilibili chat config URL.")
+        ("chat-config-cache-sec", value<int>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_CACHE_SEC),"Reuse the fetched chat config of a room within this(secs). 0 to disable caching.")
+        ("chat-config-connections", value<int>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_CONNECTIONS),"Max keep-alive connections to the chat config server per communicating thread.")
+        ("chat-config-pipeline", value<int>()->default_value(DEFAULT_CHAT_SERVER_CONFIG_PIPELINE),"Max pipelined requests on each connection to the chat config server. 1 to disable pipelining.")
+        ("json-engine", value<std::string>()->default_value(DEFAULT_JSON_ENGINE), "Engine for parsing bilibili JSON messages. dom: full document; sax: only fields used by handlers.")
     ;
 
     auto descSupervisor = options_description("vNerve bilibili chat supervisor options");
@@ -60,6 +128,23 @@ boost::program_options::options_description create_description()
         ("max-rooms,M", value<int>()->default_value(DEFAULT_MAX_ROOMS), "Max concurrent connecting rooms.")
         ("retry-interval-sec,R", value<int>()->default_value(DEFAULT_MAX_RETRY_SEC), "Interval between retrying to connect to supervisor. In seconds.")
         ("auth-code,A", value<std::string>()->default_value(DEFAULT_AUTH_CODE), "Auth code for authentication.")
+        ("batch-size", value<size_t>()->default_value(DEFAULT_BATCH_SIZE), "Max size(bytes) of a batched data packet sent to supervisor. Should be smaller than read-buffer of the supervisor. 0 to disable batching.")
+        ("batch-delay-us", value<int>()->default_value(DEFAULT_BATCH_DELAY_US), "Max delay(microseconds) of a message waiting in a batched data packet.")
+        ("supervisor-write-high-water", value<size_t>()->default_value(DEFAULT_SUPERVISOR_WRITE_HIGH_WATER), "High water mark(bytes) of the sending queue to supervisor. Data is dropped when the queue grows to twice of this.")
+        ("read-backpressure", value<std::string>()->default_value(DEFAULT_READ_BACKPRESSURE), "Pause reading bilibili sockets when the sending queue to supervisor is above high water mark, until it drains below half of it. all: pause all rooms; low-priority: pause only low-priority-rooms; off: never pause.")
+        ("low-priority-rooms", value<std::vector<int>>()->multitoken(), "Rooms paused first when the sending queue to supervisor is congested. See read-backpressure.")
+        ("replay-buffer", value<size_t>()->default_value(DEFAULT_REPLAY_BUFFER), "Max bytes of data buffered while disconnected from supervisor, replayed after reconnecting. Oldest data is dropped when full. 0 to disable.")
+        ("replay-max-age-ms", value<int>()->default_value(DEFAULT_REPLAY_MAX_AGE_MS), "Max age(milliseconds) of buffered data. Rooms are closed if supervisor is not reconnected within this. 0 to disable buffering.")
+        ("session-resume", value<bool>()->default_value(DEFAULT_SESSION_RESUME), "Keep rooms connected while reconnecting to supervisor, and ask supervisor to adopt them.")
+        ("session-grace-sec", value<int>()->default_value(DEFAULT_SESSION_GRACE_SEC), "Max time(secs) keeping rooms connected while supervisor is unreachable when session-resume is enabled.")
+        ("link-compression", value<bool>()->default_value(false), "Compress data sent to supervisor if the supervisor supports it.")
+        ("link-compression-level", value<int>()->default_value(DEFAULT_LINK_COMPRESSION_LEVEL), "Deflate level(1-9) of compressing data sent to supervisor.")
+        ("link-dictionary", value<std::string>()->default_value(""), "Preset dictionary file for compressing data sent to supervisor. Must be the same file as supervisor uses.")
+    ;
+
+    auto descDiagnostics = options_description("Diagnostics options");
+    descDiagnostics.add_options()
+        ("stats-interval-sec", value<int>()->default_value(DEFAULT_STATS_INTERVAL_SEC), "Interval between printing runtime statistics. 0 to disable.")
     ;
 
     auto desc = options_description("vNerve Bilibili Livestream chat crawling worker");
@@ -67,6 +152,7 @@ boost::program_options::options_description create_description()
     desc.add(descNetworking);
     desc.add(descBili);
     desc.add(descSupervisor);
+    desc.add(descDiagnostics);
 
     return desc;
     // clang-format on
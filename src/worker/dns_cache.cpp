@@ -0,0 +1,115 @@
+#include "dns_cache.h"
+
+#include <spdlog/spdlog.h>
+
+namespace vNerve::bilibili
+{
+dns_cache::dns_cache(const std::chrono::seconds ttl, const std::chrono::seconds negative_ttl)
+    : _ttl(ttl), _negative_ttl(negative_ttl)
+{
+}
+
+void dns_cache::resolve(boost::asio::io_context& context, const std::string& host, const std::string& port, resolve_handler handler)
+{
+    auto key = host + ':' + port;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& entry = _entries[key];
+        if (entry.resolving)
+        {
+            _coalesced.fetch_add(1, std::memory_order_relaxed);
+            entry.waiting.push_back(waiter{&context, std::move(handler)});
+            return;
+        }
+        if (entry.expires > clock::now())
+        {
+            if (entry.error)
+                _negative_hits.fetch_add(1, std::memory_order_relaxed);
+            else
+                _hits.fetch_add(1, std::memory_order_relaxed);
+            boost::asio::post(context, [handler = std::move(handler), ec = entry.error, results = entry.results]() -> void {
+                handler(ec, results);
+            });
+            return;
+        }
+        entry.resolving = true;
+        entry.waiting.push_back(waiter{&context, std::move(handler)});
+    }
+
+    _lookups.fetch_add(1, std::memory_order_relaxed);
+    SPDLOG_DEBUG("[dns] Resolving {}.", key);
+    auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(context);
+    resolver->async_resolve(
+        host, port,
+        [this, resolver, key, started = clock::now()](const boost::system::error_code& ec, const results_type& results) -> void {
+            on_resolved(key, started, ec, results);
+        });
+}
+
+void dns_cache::on_resolved(const std::string& key, const clock::time_point started,
+                            const boost::system::error_code& ec, const results_type& results)
+{
+    auto now = clock::now();
+    _lookup_us.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(now - started).count(), std::memory_order_relaxed);
+
+    std::vector<waiter> waiters;
+    boost::system::error_code result_ec = ec;
+    results_type result = results;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& entry = _entries[key];
+        entry.resolving = false;
+        waiters.swap(entry.waiting);
+        if (!ec)
+        {
+            entry.results = results;
+            entry.error = {};
+            entry.expires = now + _ttl;
+        }
+        else
+        {
+            _failures.fetch_add(1, std::memory_order_relaxed);
+            entry.expires = now + _negative_ttl;
+            if (!entry.results.empty())
+            {
+                // 一次解析失败不代表地址变了，继续用过期的结果
+                spdlog::warn("[dns] Failed resolving {}, using stale addresses. err: {}:{}", key, ec.value(), ec.message());
+                _stale_served.fetch_add(waiters.size(), std::memory_order_relaxed);
+                result_ec = {};
+                result = entry.results;
+            }
+            else
+            {
+                spdlog::warn("[dns] Failed resolving {}. err: {}:{}", key, ec.value(), ec.message());
+                entry.error = ec;
+            }
+        }
+    }
+
+    for (auto& waiter : waiters)
+        boost::asio::post(*waiter.context, [handler = std::move(waiter.handler), result_ec, result]() -> void {
+            handler(result_ec, result);
+        });
+}
+
+void dns_cache::report_statistics()
+{
+    auto hits = _hits.exchange(0, std::memory_order_relaxed);
+    auto negative_hits = _negative_hits.exchange(0, std::memory_order_relaxed);
+    auto coalesced = _coalesced.exchange(0, std::memory_order_relaxed);
+    auto lookups = _lookups.exchange(0, std::memory_order_relaxed);
+    auto failures = _failures.exchange(0, std::memory_order_relaxed);
+    auto stale = _stale_served.exchange(0, std::memory_order_relaxed);
+    auto lookup_us = _lookup_us.exchange(0, std::memory_order_relaxed);
+    size_t entries;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries = _entries.size();
+    }
+    auto total = hits + negative_hits + coalesced + lookups;
+    spdlog::info("[dns] {} resolves, hit rate {:.1f}% ({} hits, {} negative hits, {} coalesced), {} lookups ({} failed, avg {}us), {} stale results served, {} hosts cached.",
+                 total, total > 0 ? 100.0 * (hits + negative_hits + coalesced) / total : 0.0,
+                 hits, negative_hits, coalesced, lookups, failures, lookups > 0 ? lookup_us / lookups : 0,
+                 stale, entries);
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+using resolve_handler = std::function<void(const boost::system::error_code&, const boost::asio::ip::tcp::resolver::results_type&)>;
+
+///
+/// 进程内共用的 DNS 解析缓存，弹幕服务器和获取配置的 API 服务器都通过它解析。所有分片共用，线程安全。
+/// - 解析成功的结果缓存 dns-cache-ttl-sec 秒（getaddrinfo 不返回记录的 TTL，所以使用固定值）；
+/// - 解析失败的结果缓存 dns-negative-ttl-sec 秒，期间直接返回同样的错误；
+/// - 同一个 host:port 同时只有一个解析在进行，其他请求等待它的结果；
+/// - 缓存过期后重新解析失败时，继续使用过期的结果，直到下一次负缓存过期后再重试。
+class dns_cache
+{
+private:
+    using clock = std::chrono::steady_clock;
+    using results_type = boost::asio::ip::tcp::resolver::results_type;
+
+    struct waiter
+    {
+        boost::asio::io_context* context;
+        resolve_handler handler;
+    };
+
+    struct entry
+    {
+        results_type results;  // 最近一次成功的结果，可能已过期
+        boost::system::error_code error;  // 最近一次解析失败，成功后清空
+        clock::time_point expires;
+        bool resolving = false;
+        std::vector<waiter> waiting;
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, entry> _entries;  // 键为 host:port
+    std::chrono::seconds _ttl;
+    std::chrono::seconds _negative_ttl;
+
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _negative_hits{0};
+    std::atomic<uint64_t> _coalesced{0};
+    std::atomic<uint64_t> _lookups{0};
+    std::atomic<uint64_t> _failures{0};
+    std::atomic<uint64_t> _stale_served{0};
+    std::atomic<uint64_t> _lookup_us{0};
+
+    void on_resolved(const std::string& key, clock::time_point started,
+                     const boost::system::error_code& ec, const results_type& results);
+
+public:
+    dns_cache(std::chrono::seconds ttl, std::chrono::seconds negative_ttl);
+
+    dns_cache(const dns_cache&) = delete;
+    dns_cache& operator=(const dns_cache&) = delete;
+
+    ///
+    /// 解析 host:port。回调总是通过 post 投递到 context 上调用，不会在 resolve 内部直接调用。
+    /// 需要解析时，解析在 context 上进行，所以 context 必须在运行。
+    void resolve(boost::asio::io_context& context, const std::string& host, const std::string& port, resolve_handler handler);
+
+    void report_statistics();
+};
+}  // namespace vNerve::bilibili
@@ -0,0 +1,128 @@
+#include "frame_pool.h"
+
+#include <concurrentqueue.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace vNerve::bilibili::worker_supervisor
+{
+namespace
+{
+// 缓冲区前预留的头部，记录所属的级别。保持 max_align_t 对齐。
+const size_t frame_header_size = alignof(std::max_align_t);
+const size_t min_class_shift = 8;  // 最小级别 256 字节（含头部）
+const size_t class_count = 9;      // 256B ~ 64KB
+const size_t oversize_class = class_count;
+// 每个级别最多缓存的字节数，超过后释放的缓冲区直接 delete[]
+const size_t max_cached_bytes_per_class = 4 * 1024 * 1024;
+
+size_t class_size(size_t size_class) { return size_t(1) << (min_class_shift + size_class); }
+
+struct frame_size_class
+{
+    moodycamel::ConcurrentQueue<unsigned char*> free_list;
+    std::atomic<size_t> cached{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+std::array<frame_size_class, class_count> size_classes;
+std::atomic<uint64_t> oversize_allocations{0};
+std::atomic<int64_t> frames_in_use{0};
+std::atomic<int64_t> frames_in_use_high_water{0};
+
+size_t size_class_of(size_t total_size)
+{
+    for (size_t i = 0; i < class_count; i++)
+        if (class_size(i) >= total_size)
+            return i;
+    return oversize_class;
+}
+
+void update_high_water(int64_t in_use)
+{
+    auto high_water = frames_in_use_high_water.load(std::memory_order_relaxed);
+    while (in_use > high_water && !frames_in_use_high_water.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed))
+        ;
+}
+}  // namespace
+
+unsigned char* allocate_frame(const size_t size)
+{
+    auto total_size = size + frame_header_size;
+    auto index = size_class_of(total_size);
+
+    unsigned char* block = nullptr;
+    if (index == oversize_class)
+    {
+        oversize_allocations.fetch_add(1, std::memory_order_relaxed);
+        block = new unsigned char[total_size];
+    }
+    else
+    {
+        auto& size_class = size_classes[index];
+        if (size_class.free_list.try_dequeue(block))
+        {
+            size_class.cached.fetch_sub(1, std::memory_order_relaxed);
+            size_class.hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            size_class.misses.fetch_add(1, std::memory_order_relaxed);
+            block = new unsigned char[class_size(index)];
+        }
+    }
+
+    *reinterpret_cast<size_t*>(block) = index;
+    update_high_water(frames_in_use.fetch_add(1, std::memory_order_relaxed) + 1);
+    return block + frame_header_size;
+}
+
+void release_frame(unsigned char* frame)
+{
+    if (!frame)
+        return;
+    auto block = frame - frame_header_size;
+    auto index = *reinterpret_cast<size_t*>(block);
+    frames_in_use.fetch_sub(1, std::memory_order_relaxed);
+
+    if (index != oversize_class)
+    {
+        auto& size_class = size_classes[index];
+        auto max_cached = std::max<size_t>(max_cached_bytes_per_class / class_size(index), 1);
+        if (size_class.cached.fetch_add(1, std::memory_order_relaxed) < max_cached)
+        {
+            if (size_class.free_list.enqueue(block))
+                return;
+        }
+        size_class.cached.fetch_sub(1, std::memory_order_relaxed);
+    }
+    delete[] block;
+}
+
+void report_frame_pool_statistics()
+{
+    uint64_t total_hits = 0, total_misses = 0;
+    for (size_t i = 0; i < class_count; i++)
+    {
+        auto& size_class = size_classes[i];
+        auto hits = size_class.hits.exchange(0, std::memory_order_relaxed);
+        auto misses = size_class.misses.exchange(0, std::memory_order_relaxed);
+        total_hits += hits;
+        total_misses += misses;
+        if (hits + misses > 0)
+            spdlog::debug("[f_pool] Class {}B: {} hits, {} misses, {} cached.",
+                          class_size(i), hits, misses, size_class.cached.load(std::memory_order_relaxed));
+    }
+    auto total = total_hits + total_misses;
+    spdlog::info("[f_pool] {} frames allocated, hit rate {:.2f}%, {} oversize. In use: {}, high water: {}.",
+                 total, total == 0 ? 100.0 : total_hits * 100.0 / total,
+                 oversize_allocations.exchange(0, std::memory_order_relaxed),
+                 frames_in_use.load(std::memory_order_relaxed),
+                 frames_in_use_high_water.load(std::memory_order_relaxed));
+}
+}  // namespace vNerve::bilibili::worker_supervisor
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vNerve::bilibili::worker_supervisor
+{
+///
+/// 发往 supervisor 的数据帧的分配器。
+/// 按大小分级缓存已释放的缓冲区，任意线程分配、任意线程释放，均不加锁。
+/// 超过最大级别的帧直接使用 new[]。
+/// @return 至少 size 字节的缓冲区，必须使用 release_frame 释放
+unsigned char* allocate_frame(size_t size);
+///
+/// 释放 allocate_frame 分配的缓冲区，可以直接用作 supervisor_buffer_deleter。
+void release_frame(unsigned char* frame);
+
+void report_frame_pool_statistics();
+}  // namespace vNerve::bilibili::worker_supervisor
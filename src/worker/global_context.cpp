@@ -13,9 +13,11 @@ worker_global_context::worker_global_context(config::config_t config)
       _session(config,
                std::bind(&worker_global_context::on_request_connect_room, this, std::placeholders::_1),
                std::bind(&worker_global_context::on_request_disconnect_room, this, std::placeholders::_1),
-               std::bind(&worker_global_context::on_supervisor_disconnected, this))
-      //_token_updater(std::make_shared<bilibili_token_updater>(config, std::bind(&worker_global_context::on_update_live_chat_config, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)))
+               std::bind(&worker_global_context::on_supervisor_disconnected, this),
+               std::bind(&bilibili_connection_manager::opened_rooms, &_conn_manager))
+      //_token_updater(std::make_shared<bilibili_token_updater>(config, std::bind(&worker_global_context::on_update_live_chat_config, this, std::placeholders::_1, std::placeholders::_2)))
 {
+    _session.set_watermark_handler(std::bind(&worker_global_context::on_supervisor_write_watermark, this, std::placeholders::_1));
     //_token_updater->init();
 }
 
@@ -55,4 +57,12 @@ void worker_global_context::on_supervisor_disconnected()
 {
     _conn_manager.close_all_connections();
 }
+
+void worker_global_context::on_supervisor_write_watermark(bool)
+{
+    // 越过高水位和降到低水位的回调分别来自写入线程和发送线程，可能交错到达，
+    // 因此以加锁后读到的发送队列状态为准，而不是参数
+    std::lock_guard<std::mutex> lock(_backpressure_mutex);
+    _conn_manager.set_read_paused(_session.write_queue_above_high_water());
+}
 }
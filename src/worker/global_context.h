@@ -6,6 +6,7 @@
 #include "config.h"
 
 #include <memory>
+#include <mutex>
 
 namespace vNerve::bilibili
 {
@@ -16,6 +17,7 @@ private:
 
     bilibili_connection_manager _conn_manager;
     worker_supervisor::supervisor_session _session;
+    std::mutex _backpressure_mutex;
 
     //std::shared_ptr<bilibili_token_updater> _token_updater;
 
@@ -24,6 +26,7 @@ private:
     void on_request_connect_room(int room_id);
     void on_request_disconnect_room(int room_id);
     void on_supervisor_disconnected();
+    void on_supervisor_write_watermark(bool above_high_water);
 
 public:
     worker_global_context(config::config_t);
@@ -0,0 +1,127 @@
+#include "read_buffer_pool.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+namespace
+{
+const size_t min_class_shift = 11;  // 最小级别 2KB，足够放下 beast 一次读取的一帧 TCP 数据
+const size_t class_count = 16;      // 2KB ~ 64MB
+const size_t oversize_class = class_count;
+
+size_t max_pooled = 128 * 1024;
+size_t max_cached_per_thread = 16 * 1024 * 1024;
+
+std::atomic<int64_t> bytes_in_use{0};
+std::atomic<int64_t> bytes_cached{0};
+std::atomic<uint64_t> hits{0};
+std::atomic<uint64_t> misses{0};
+std::atomic<uint64_t> oversize_allocations{0};
+
+size_t class_size(size_t size_class) { return size_t(1) << (min_class_shift + size_class); }
+
+size_t size_class_of(size_t size)
+{
+    if (size > max_pooled)
+        return oversize_class;
+    for (size_t i = 0; i < class_count; i++)
+        if (class_size(i) >= size)
+            return i;
+    return oversize_class;
+}
+
+struct thread_cache
+{
+    std::array<std::vector<void*>, class_count> free_lists;
+    size_t cached = 0;
+
+    ~thread_cache()
+    {
+        for (auto& list : free_lists)
+            for (auto buffer : list)
+                ::operator delete(buffer);
+        bytes_cached.fetch_sub(static_cast<int64_t>(cached), std::memory_order_relaxed);
+    }
+};
+
+thread_local thread_cache cache;
+}  // namespace
+
+void setup_read_buffer_pool(const size_t max_pooled_size, const size_t max_cached_bytes)
+{
+    max_pooled = std::min(max_pooled_size, class_size(class_count - 1));
+    max_cached_per_thread = max_cached_bytes;
+}
+
+void* allocate_read_buffer(const size_t size)
+{
+    auto index = size_class_of(size);
+    if (index == oversize_class)
+    {
+        oversize_allocations.fetch_add(1, std::memory_order_relaxed);
+        bytes_in_use.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+
+    auto block_size = class_size(index);
+    bytes_in_use.fetch_add(static_cast<int64_t>(block_size), std::memory_order_relaxed);
+    auto& list = cache.free_lists[index];
+    if (!list.empty())
+    {
+        auto buffer = list.back();
+        list.pop_back();
+        cache.cached -= block_size;
+        bytes_cached.fetch_sub(static_cast<int64_t>(block_size), std::memory_order_relaxed);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return buffer;
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(block_size);
+}
+
+void release_read_buffer(void* buffer, const size_t size) noexcept
+{
+    auto index = size_class_of(size);
+    auto block_size = index == oversize_class ? size : class_size(index);
+    bytes_in_use.fetch_sub(static_cast<int64_t>(block_size), std::memory_order_relaxed);
+    if (index == oversize_class || cache.cached + block_size > max_cached_per_thread)
+    {
+        ::operator delete(buffer);
+        return;
+    }
+    try
+    {
+        cache.free_lists[index].push_back(buffer);
+    }
+    catch (std::bad_alloc&)
+    {
+        ::operator delete(buffer);
+        return;
+    }
+    cache.cached += block_size;
+    bytes_cached.fetch_add(static_cast<int64_t>(block_size), std::memory_order_relaxed);
+}
+
+size_t read_buffer_bytes_in_use()
+{
+    return static_cast<size_t>(std::max<int64_t>(bytes_in_use.load(std::memory_order_relaxed), 0));
+}
+
+void report_read_buffer_statistics()
+{
+    spdlog::info("[read_buffer] {}KB in use, {}KB cached, {} hits, {} misses, {} oversize allocations.",
+                 read_buffer_bytes_in_use() / 1024,
+                 bytes_cached.load(std::memory_order_relaxed) / 1024,
+                 hits.exchange(0, std::memory_order_relaxed),
+                 misses.exchange(0, std::memory_order_relaxed),
+                 oversize_allocations.exchange(0, std::memory_order_relaxed));
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vNerve::bilibili
+{
+///
+/// 读取 Bilibili 连接的缓冲区的分配器。
+/// 按 2 的幂分级，每个线程缓存自己释放的缓冲区，不加锁。连接处理完数据后立即把缓冲区还回来，
+/// 空闲的连接只持有等待下一帧所需的一小块缓冲区，大块缓冲区在忙碌的连接之间复用。
+/// 超过 read-buffer 的缓冲区不缓存，直接使用 operator new。
+void* allocate_read_buffer(size_t size);
+///
+/// 释放 allocate_read_buffer 分配的缓冲区，size 必须与分配时相同。可以在任意线程释放。
+void release_read_buffer(void* buffer, size_t size) noexcept;
+
+///
+/// 设置缓存的最大缓冲区大小和每个线程最多缓存的字节数，需要在开始读取前调用。
+void setup_read_buffer_pool(size_t max_pooled_size, size_t max_cached_bytes);
+
+///
+/// 读取缓冲区当前分配出去的字节数（按实际占用的级别大小计算）
+size_t read_buffer_bytes_in_use();
+void report_read_buffer_statistics();
+
+///
+/// 供 beast::basic_flat_buffer 使用的分配器
+template <class T>
+struct read_buffer_allocator
+{
+    using value_type = T;
+
+    read_buffer_allocator() noexcept = default;
+    template <class U>
+    read_buffer_allocator(const read_buffer_allocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t n) { return static_cast<T*>(allocate_read_buffer(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { release_read_buffer(p, n * sizeof(T)); }
+
+    template <class U>
+    bool operator==(const read_buffer_allocator<U>&) const noexcept { return true; }
+    template <class U>
+    bool operator!=(const read_buffer_allocator<U>&) const noexcept { return false; }
+};
+}  // namespace vNerve::bilibili
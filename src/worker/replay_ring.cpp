@@ -0,0 +1,124 @@
+#include "replay_ring.h"
+
+#include <spdlog/spdlog.h>
+
+namespace vNerve::bilibili::worker_supervisor
+{
+namespace
+{
+std::atomic<uint64_t> frames_buffered{0};
+std::atomic<uint64_t> frames_replayed{0};
+std::atomic<uint64_t> bytes_replayed{0};
+std::atomic<uint64_t> frames_dropped_overflow{0};
+std::atomic<uint64_t> frames_dropped_expired{0};
+std::atomic<uint64_t> frames_dropped_disconnected{0};
+std::atomic<uint64_t> bytes_dropped{0};
+}  // namespace
+
+replay_ring::replay_ring(const size_t max_bytes, const std::chrono::milliseconds max_age)
+    : _max_bytes(max_bytes), _max_age(max_age)
+{
+}
+
+replay_ring::~replay_ring()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (!_frames.empty())
+        drop_front();
+}
+
+void replay_ring::drop_front()
+{
+    auto& frame = _frames.front();
+    _bytes -= frame.length;
+    bytes_dropped.fetch_add(frame.length, std::memory_order_relaxed);
+    frame.deleter(frame.data);
+    _frames.pop_front();
+}
+
+void replay_ring::evict_expired(const std::chrono::steady_clock::time_point now)
+{
+    while (!_frames.empty() && now - _frames.front().stored > _max_age)
+    {
+        drop_front();
+        frames_dropped_expired.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void replay_ring::start_buffering()
+{
+    if (!enabled())
+        return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffering.store(true, std::memory_order_release);
+}
+
+bool replay_ring::push(unsigned char* data, const size_t length, const supervisor_buffer_deleter deleter)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_buffering.load(std::memory_order_relaxed))
+        return false;
+
+    if (length > _max_bytes)
+    {
+        frames_dropped_overflow.fetch_add(1, std::memory_order_relaxed);
+        bytes_dropped.fetch_add(length, std::memory_order_relaxed);
+        deleter(data);
+        return true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    evict_expired(now);
+    while (_bytes + length > _max_bytes)
+    {
+        if (frames_dropped_overflow.fetch_add(1, std::memory_order_relaxed) % 1000 == 0)
+            spdlog::warn("[r_ring] Replay buffer full({} bytes), dropping oldest frames.", _max_bytes);
+        drop_front();
+    }
+    _frames.push_back({data, length, deleter, now});
+    _bytes += length;
+    frames_buffered.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t replay_ring::replay(const replay_writer& writer)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffering.store(false, std::memory_order_release);
+    evict_expired(std::chrono::steady_clock::now());
+
+    auto count = _frames.size();
+    bytes_replayed.fetch_add(_bytes, std::memory_order_relaxed);
+    frames_replayed.fetch_add(count, std::memory_order_relaxed);
+    for (auto& frame : _frames)
+        writer(frame.data, frame.length, frame.deleter);
+    _frames.clear();
+    _bytes = 0;
+    return count;
+}
+
+size_t replay_ring::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffering.store(false, std::memory_order_release);
+    auto count = _frames.size();
+    while (!_frames.empty())
+        drop_front();
+    frames_dropped_disconnected.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void report_replay_ring_statistics()
+{
+    auto buffered = frames_buffered.exchange(0, std::memory_order_relaxed);
+    auto replayed = frames_replayed.exchange(0, std::memory_order_relaxed);
+    auto overflow = frames_dropped_overflow.exchange(0, std::memory_order_relaxed);
+    auto expired = frames_dropped_expired.exchange(0, std::memory_order_relaxed);
+    auto disconnected = frames_dropped_disconnected.exchange(0, std::memory_order_relaxed);
+    if (buffered == 0 && replayed == 0 && overflow == 0 && expired == 0 && disconnected == 0)
+        return;
+    spdlog::info("[r_ring] {} frames buffered, {} frames({} bytes) replayed. Dropped: {} overflow, {} expired, {} disconnected, {} bytes.",
+                 buffered, replayed, bytes_replayed.exchange(0, std::memory_order_relaxed),
+                 overflow, expired, disconnected, bytes_dropped.exchange(0, std::memory_order_relaxed));
+}
+}  // namespace vNerve::bilibili::worker_supervisor
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "asio_socket_write_helper.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace vNerve::bilibili::worker_supervisor
+{
+using replay_writer = std::function<void(unsigned char*, size_t, supervisor_buffer_deleter)>;
+
+///
+/// 与 supervisor 断开期间暂存发往 supervisor 的数据帧，重新连接后按原顺序重放。
+/// 按总字节数和帧的存放时间限制，超过限制时丢弃最早的帧。
+/// 线程安全。
+class replay_ring
+{
+private:
+    struct replay_frame
+    {
+        unsigned char* data;
+        size_t length;
+        supervisor_buffer_deleter deleter;
+        std::chrono::steady_clock::time_point stored;
+    };
+
+    std::mutex _mutex;
+    std::deque<replay_frame> _frames;
+    size_t _bytes = 0;
+    std::atomic<bool> _buffering{false};
+
+    size_t _max_bytes;
+    std::chrono::milliseconds _max_age;
+
+    void evict_expired(std::chrono::steady_clock::time_point now);
+    void drop_front();
+
+public:
+    replay_ring(size_t max_bytes, std::chrono::milliseconds max_age);
+    ~replay_ring();
+    replay_ring(const replay_ring&) = delete;
+    replay_ring& operator=(const replay_ring&) = delete;
+
+    /// replay-buffer 或 replay-max-age-ms 为 0 时不暂存
+    bool enabled() const { return _max_bytes > 0 && _max_age.count() > 0; }
+    bool buffering() const { return _buffering.load(std::memory_order_acquire); }
+    std::chrono::milliseconds max_age() const { return _max_age; }
+
+    void start_buffering();
+    ///
+    /// 暂存一帧，取得其所有权。
+    /// @return 不在暂存状态时返回 false，所有权不转移
+    bool push(unsigned char* data, size_t length, supervisor_buffer_deleter deleter);
+    ///
+    /// 停止暂存，把未过期的帧按顺序交给 writer。
+    /// 在锁内调用 writer，因此 replay 返回后 push 失败的调用方写出的数据一定排在重放的数据之后。
+    /// @return 重放的帧数
+    size_t replay(const replay_writer& writer);
+    ///
+    /// 停止暂存并丢弃所有帧。
+    /// @return 丢弃的帧数
+    size_t clear();
+};
+
+void report_replay_ring_statistics();
+}  // namespace vNerve::bilibili::worker_supervisor
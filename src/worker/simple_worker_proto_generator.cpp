@@ -1,6 +1,7 @@
 #include "simple_worker_proto_generator.h"
 
 #include "simple_worker_proto.h"
+#include "frame_pool.h"
 #include "borrowed_message.h"
 #include <boost/asio/detail/socket_ops.hpp>
 
@@ -10,7 +11,7 @@ namespace vNerve::bilibili::worker_supervisor
 std::pair<unsigned char*, size_t> generate_room_basic_packet(int room_place, size_t payload_size)
 {
     const int packet_length = simple_message_header_length + payload_size;
-    auto packet = new unsigned char[packet_length];
+    auto packet = allocate_frame(packet_length);
     *reinterpret_cast<int*>(packet) = boost::asio::detail::socket_ops::host_to_network_long(payload_size);
 
     *reinterpret_cast<int*>(packet + simple_message_header_length + 1) = boost::asio::detail::socket_ops::host_to_network_long(room_place);
@@ -25,12 +26,32 @@ std::pair<unsigned char*, size_t> generate_room_failed_packet(room_id_t room_id)
     return pair;
 }
 
-std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms, std::string_view auth_code)
+std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms, std::string_view auth_code, uint32_t flags, uint32_t dictionary_id,
+                                                               uint64_t session_id, const std::vector<room_id_t>& rooms)
 {
-    auto pair = generate_room_basic_packet(max_rooms, worker_ready_payload_length);
+    bool resume = (flags & capability_session_resume) != 0;
+    size_t payload_length = worker_ready_payload_length + worker_ready_flags_length;
+    if (resume)
+        payload_length += worker_ready_session_header_length + room_id_length * rooms.size();
+    auto pair = generate_room_basic_packet(max_rooms, payload_length);
     pair.first[simple_message_header_length] = worker_ready_code;
     std::memset(reinterpret_cast<char*>(pair.first + simple_message_header_length + 5), 0, auth_code_size);
     std::memcpy(reinterpret_cast<char*>(pair.first + simple_message_header_length + 5), auth_code.data(), auth_code.size());
+    *reinterpret_cast<uint32_t*>(pair.first + simple_message_header_length + worker_ready_payload_length) = boost::asio::detail::socket_ops::host_to_network_long(flags);
+    *reinterpret_cast<uint32_t*>(pair.first + simple_message_header_length + worker_ready_payload_length + sizeof(uint32_t)) = boost::asio::detail::socket_ops::host_to_network_long(dictionary_id);
+    if (!resume)
+        return pair;
+
+    auto ptr = pair.first + simple_message_header_length + worker_ready_payload_length + worker_ready_flags_length;
+    *reinterpret_cast<uint64_t*>(ptr) = host_to_network_longlong(session_id);                                     // SESSION_ID
+    ptr += sizeof(uint64_t);
+    *reinterpret_cast<uint32_t*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(static_cast<uint32_t>(rooms.size()));  // ROOM_COUNT
+    ptr += sizeof(uint32_t);
+    for (auto room_id : rooms)
+    {
+        *reinterpret_cast<uint32_t*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(room_id);
+        ptr += room_id_length;
+    }
     return pair;
 }
 
@@ -38,7 +59,7 @@ std::pair<unsigned char*, size_t> generate_worker_data_packet(room_id_t room_id,
 {
     const size_t payload_length = worker_data_payload_header_length + msg->size();
     const size_t packet_length = simple_message_header_length + payload_length;
-    auto packet = new unsigned char[packet_length];
+    auto packet = allocate_frame(packet_length);
 
     auto ptr = packet;
     *reinterpret_cast<int*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(payload_length); // LEN
@@ -47,12 +68,59 @@ std::pair<unsigned char*, size_t> generate_worker_data_packet(room_id_t room_id,
     ptr++;
     *reinterpret_cast<int*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(room_id);                      // ROOM
     ptr += room_id_length;
-    *reinterpret_cast<int*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(msg->crc32);                       // CHECKSUM
-    ptr += crc_32_length;
+    *reinterpret_cast<checksum_t*>(ptr) = host_to_network_longlong(msg->checksum);                                        // CHECKSUM
+    ptr += checksum_length;
     std::memcpy(ptr, msg->routing_key, routing_key_max_size);
     ptr += routing_key_max_size;
     msg->write(ptr, payload_length - worker_data_payload_header_length);
 
     return std::pair(packet, packet_length);
 }
+
+std::pair<unsigned char*, size_t> generate_worker_data_entry(room_id_t room_id, borrowed_message const* msg)
+{
+    const size_t routing_key_length = strnlen(msg->routing_key, routing_key_max_size);
+    const size_t payload_length = msg->size();
+    const size_t entry_length = worker_data_entry_header_length + routing_key_length + worker_data_entry_payload_length_length + payload_length;
+    auto entry = allocate_frame(entry_length);
+
+    auto ptr = entry;
+    *reinterpret_cast<int*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(room_id);    // ROOM
+    ptr += room_id_length;
+    *reinterpret_cast<checksum_t*>(ptr) = host_to_network_longlong(msg->checksum);                      // CHECKSUM
+    ptr += checksum_length;
+    *(ptr++) = static_cast<unsigned char>(routing_key_length);                                         // RK_LEN
+    std::memcpy(ptr, msg->routing_key, routing_key_length);                                            // ROUTING_KEY
+    ptr += routing_key_length;
+    *reinterpret_cast<uint32_t*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(payload_length); // PAYLOAD_LEN
+    ptr += worker_data_entry_payload_length_length;
+    msg->write(ptr, payload_length);
+
+    return std::pair(entry, entry_length);
+}
+
+std::pair<unsigned char*, size_t> generate_worker_data_packet_from_entry(const unsigned char* entry, size_t& entry_length)
+{
+    const size_t routing_key_length = entry[room_id_length + checksum_length];
+    auto payload_length_ptr = entry + worker_data_entry_header_length + routing_key_length;
+    const size_t payload_length = boost::asio::detail::socket_ops::network_to_host_long(*reinterpret_cast<const uint32_t*>(payload_length_ptr));
+    entry_length = worker_data_entry_header_length + routing_key_length + worker_data_entry_payload_length_length + payload_length;
+
+    const size_t packet_payload_length = worker_data_payload_header_length + payload_length;
+    const size_t packet_length = simple_message_header_length + packet_payload_length;
+    auto packet = allocate_frame(packet_length);
+
+    auto ptr = packet;
+    *reinterpret_cast<int*>(ptr) = boost::asio::detail::socket_ops::host_to_network_long(packet_payload_length); // LEN
+    ptr += simple_message_header_length;
+    *(ptr++) = worker_data_code;                                                                           // OP_CODE
+    std::memcpy(ptr, entry, room_id_length + checksum_length);                                             // ROOM CHECKSUM
+    ptr += room_id_length + checksum_length;
+    std::memset(ptr, 0, routing_key_max_size);
+    std::memcpy(ptr, entry + worker_data_entry_header_length, routing_key_length);                         // ROUTING_KEY
+    ptr += routing_key_max_size;
+    std::memcpy(ptr, payload_length_ptr + worker_data_entry_payload_length_length, payload_length);        // PAYLOAD
+
+    return std::pair(packet, packet_length);
+}
 }
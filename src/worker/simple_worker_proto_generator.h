@@ -2,8 +2,10 @@
 
 #include "type.h"
 
+#include <cstdint>
 #include <utility>
 #include <string_view>
+#include <vector>
 
 namespace vNerve::bilibili {
 class borrowed_message;
@@ -12,9 +14,19 @@ class borrowed_message;
 namespace vNerve::bilibili::worker_supervisor
 {
 ///
-/// Use delete[] to remove!
+/// Use release_frame to remove!
 std::pair<unsigned char*, size_t> generate_room_failed_packet(room_id_t room_id);
-std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms, std::string_view auth_code);
+///
+/// flags 包含 capability_session_resume 时附带 session_id 和 rooms。
+std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms, std::string_view auth_code, uint32_t flags, uint32_t dictionary_id,
+                                                               uint64_t session_id, const std::vector<room_id_t>& rooms);
 
 std::pair<unsigned char*, size_t> generate_worker_data_packet(room_id_t room_id, borrowed_message const* msg);
+///
+/// 生成 WORKER DATA BATCH 中的一项，不含数据包头部，需要由 supervisor_connection 拼接成批。
+std::pair<unsigned char*, size_t> generate_worker_data_entry(room_id_t room_id, borrowed_message const* msg);
+///
+/// 把 generate_worker_data_entry 生成的一项还原成单独的 WORKER DATA 数据包，用于不能再批量发送的数据。
+/// @param entry_length 输出该项的长度
+std::pair<unsigned char*, size_t> generate_worker_data_packet_from_entry(const unsigned char* entry, size_t& entry_length);
 }  // namespace vNerve::bilibili::worker_supervisor
\ No newline at end of file
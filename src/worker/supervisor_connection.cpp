@@ -1,4 +1,10 @@
 #include "supervisor_connection.h"
+
+#include "frame_pool.h"
+#include "simple_worker_proto.h"
+#include "simple_worker_proto_generator.h"
+
+#include <boost/asio/detail/socket_ops.hpp>
 #include <spdlog/spdlog.h>
 
 namespace vNerve::bilibili::worker_supervisor
@@ -15,11 +21,23 @@ supervisor_connection::supervisor_connection(const config::config_t config,
       _write_helper(std::make_shared<asio_socket_write_helper>("[sv_conn]", nullptr, boost::bind(&supervisor_connection::on_failed, this))),
       _timer(_context),
       _retry_interval_sec((*config)["retry-interval-sec"].as<int>()),
+      _batch_size((*config)["batch-size"].as<size_t>()),
+      _batch_delay((*config)["batch-delay-us"].as<int>()),
+      _batch_timer(_context),
+      _compression_requested((*config)["link-compression"].as<bool>()),
+      _compression_level((*config)["link-compression-level"].as<int>()),
+      _link_dictionary(load_link_dictionary((*config)["link-dictionary"].as<std::string>())),
+      _replay_ring((*config)["replay-buffer"].as<size_t>(), std::chrono::milliseconds((*config)["replay-max-age-ms"].as<int>())),
+      _detach_timer(_context),
       _supervisor_host((*config)["supervisor-host"].as<std::string>()),
       _supervisor_port(std::to_string((*config)["supervisor-port"].as<int>())),
       _connected_handler(std::move(connected_handler)),
       _disconnected_handler(std::move(disconnected_handler))
 {
+    _write_helper->set_watermarks((*config)["supervisor-write-high-water"].as<size_t>());
+    _detach_timeout = _replay_ring.enabled() ? _replay_ring.max_age() : std::chrono::milliseconds(0);
+    if ((*config)["session-resume"].as<bool>())
+        _detach_timeout = std::max<std::chrono::milliseconds>(_detach_timeout, std::chrono::seconds((*config)["session-grace-sec"].as<int>()));
     _thread = boost::thread(boost::bind(&boost::asio::io_context::run, &_context));
     _timer.expires_from_now(boost::posix_time::seconds(5));
     _timer.async_wait(boost::bind(&supervisor_connection::on_retry_timer_tick, this, boost::asio::placeholders::error));
@@ -29,9 +47,12 @@ supervisor_connection::~supervisor_connection()
 {
     try
     {
-        force_close();
+        // 先停下连接线程，再在本线程上关闭连接，避免与连接线程上的回调同时访问
         _guard.reset();
         _context.stop();
+        if (_thread.joinable())
+            _thread.join();
+        force_close();
     }
     catch (boost::system::system_error& ex)
     {
@@ -42,14 +63,208 @@ supervisor_connection::~supervisor_connection()
 }
 
 void supervisor_connection::publish_msg(unsigned char* msg, size_t len,
-                                        supervisor_buffer_deleter deleter)
+                                        supervisor_buffer_deleter deleter, write_priority priority)
 {
+    // 以下情况在连接线程上按顺序写出：
+    // 压缩流必须按发送顺序使用；控制消息要排到当前批次之后；
+    // 断开到重新就绪期间的数据要和之前加入批次的数据一起排队，暂存或拆开后才不会打乱同一房间的顺序
+    if (_compressing.load(std::memory_order_relaxed) || !_link_ready.load(std::memory_order_relaxed) ||
+        (priority == write_priority::control && _batching.load(std::memory_order_relaxed)))
+    {
+        dispatch(_context, [this, msg, len, deleter, priority]() -> void {
+            write_frame(msg, len, deleter, priority);
+        });
+        return;
+    }
     if (!_socket)
     {
         deleter(msg); // Dispose data.
         return;
     }
-    _write_helper->write(msg, len, deleter);
+    _write_helper->write(msg, len, deleter, priority);
+}
+
+void supervisor_connection::publish_data_entry(unsigned char* entry, size_t len)
+{
+    post(_context, [this, entry, len]() -> void {
+        append_to_batch(entry, len);
+    });
+}
+
+void supervisor_connection::set_batching(const bool enabled)
+{
+    if (!enabled)
+        unbatch_pending();
+    _batching = enabled && _batch_size > 0;
+    spdlog::info("[sv_conn] Batching worker data: {}", _batching.load());
+}
+
+void supervisor_connection::set_compression(const bool enabled)
+{
+    if (enabled && _compression_requested)
+        _deflater = std::make_unique<link_deflater>(_compression_level, _link_dictionary);
+    else
+        _deflater.reset();
+    _compressing = static_cast<bool>(_deflater);
+    spdlog::info("[sv_conn] Compressing worker data: {}", _compressing.load());
+}
+
+void supervisor_connection::set_watermark_handler(write_watermark_handler handler)
+{
+    _watermark_handler = handler;
+    _write_helper->set_watermark_handler(std::move(handler));
+}
+
+void supervisor_connection::set_link_ready()
+{
+    if (_link_ready.exchange(true))
+        return;
+    if (_watermark_handler)
+        _watermark_handler(false);
+}
+
+void supervisor_connection::write_frame(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter, write_priority priority)
+{
+    // ROOM FAILED 等控制消息之前加入批次的数据（可能属于同一房间）要先发出
+    if (priority == write_priority::control)
+        flush_batch();
+    // 控制消息只对当前连接有意义，不暂存
+    if (priority != write_priority::control && _replay_ring.buffering() && _replay_ring.push(msg, len, deleter))
+        return;
+    if (!_socket)
+    {
+        deleter(msg);
+        return;
+    }
+    // 连接已经重置时，新的连接还没有确认压缩
+    if (_deflater)
+        write_compressed(msg, len, deleter, priority);
+    else
+        _write_helper->write(msg, len, deleter, priority);
+}
+
+void supervisor_connection::write_compressed(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter, write_priority priority)
+{
+    // 每个压缩块都依赖之前的压缩流，写出队列丢弃任何一块都会让 supervisor 无法解压之后的数据。
+    // 所以在压缩之前按原始帧决定是否丢弃，压缩块本身以 control 写出，不再丢弃。
+    if (!_write_helper->admit(len, priority))
+    {
+        deleter(msg);
+        return;
+    }
+
+    auto header_length = simple_message_header_length + compressed_chunk_header_length;
+    auto chunk = allocate_frame(header_length + _deflater->bound(len));
+    auto compressed = _deflater->compress(msg, len, chunk + header_length);
+    deleter(msg);
+    if (compressed == 0)
+    {
+        // 压缩流已经损坏，只能重新连接
+        release_frame(chunk);
+        spdlog::error("[sv_conn] Failed compressing worker data. Reconnecting.");
+        on_failed();
+        return;
+    }
+
+    *reinterpret_cast<uint32_t*>(chunk) = boost::asio::detail::socket_ops::host_to_network_long(
+        static_cast<uint32_t>(compressed + compressed_chunk_header_length));
+    chunk[simple_message_header_length] = compressed_chunk_code;
+    _write_helper->write(chunk, header_length + compressed, release_frame, write_priority::control);
+}
+
+void supervisor_connection::append_to_batch(unsigned char* entry, const size_t len)
+{
+    if (!_batching)
+    {
+        // 连接已经断开，或者新的连接还没有确认批量发送：拆成单独的 WORKER DATA，暂存或者直接写出
+        size_t entry_length;
+        auto [packet, packet_length] = generate_worker_data_packet_from_entry(entry, entry_length);
+        release_frame(entry);
+        write_frame(packet, packet_length, release_frame, write_priority::data);
+        return;
+    }
+
+    if (_batch && _batch_length + len > _batch_capacity)
+        flush_batch();
+    if (!_batch)
+    {
+        _batch_capacity = std::max(_batch_size, simple_message_header_length + worker_data_batch_header_length + len);
+        _batch = allocate_frame(_batch_capacity);
+        _batch[simple_message_header_length] = worker_data_batch_code;
+        _batch_length = simple_message_header_length + worker_data_batch_header_length;
+
+        _batch_timer.expires_after(_batch_delay);
+        _batch_timer.async_wait(boost::bind(&supervisor_connection::on_batch_timer, this, boost::asio::placeholders::error));
+    }
+
+    std::memcpy(_batch + _batch_length, entry, len);
+    _batch_length += len;
+    release_frame(entry);
+
+    if (_batch_length >= _batch_size)
+        flush_batch();
+}
+
+void supervisor_connection::flush_batch()
+{
+    if (!_batch)
+        return;
+    boost::system::error_code nec;
+    _batch_timer.cancel(nec);
+
+    auto batch = _batch;
+    auto batch_length = _batch_length;
+    _batch = nullptr;  // 写出失败时 force_close 不能再释放它
+    _batch_length = 0;
+    *reinterpret_cast<uint32_t*>(batch) = boost::asio::detail::socket_ops::host_to_network_long(
+        static_cast<uint32_t>(batch_length - simple_message_header_length));
+    SPDLOG_TRACE("[sv_conn] Flushing worker data batch. len={}", batch_length);
+    write_frame(batch, batch_length, release_frame, write_priority::data);
+}
+
+void supervisor_connection::drop_batch()
+{
+    if (!_batch)
+        return;
+    boost::system::error_code nec;
+    _batch_timer.cancel(nec);
+    release_frame(_batch);
+    _batch = nullptr;
+    _batch_length = 0;
+}
+
+void supervisor_connection::unbatch_pending()
+{
+    if (!_batch)
+        return;
+    boost::system::error_code nec;
+    _batch_timer.cancel(nec);
+
+    auto batch = _batch;
+    auto batch_length = _batch_length;
+    _batch = nullptr;
+    _batch_length = 0;
+    size_t count = 0;
+    for (size_t offset = simple_message_header_length + worker_data_batch_header_length; offset < batch_length; count++)
+    {
+        size_t entry_length;
+        auto [packet, packet_length] = generate_worker_data_packet_from_entry(batch + offset, entry_length);
+        offset += entry_length;
+        write_frame(packet, packet_length, release_frame, write_priority::data);
+    }
+    release_frame(batch);
+    SPDLOG_DEBUG("[sv_conn] Unbatched {} pending worker data entries.", count);
+}
+
+void supervisor_connection::on_batch_timer(const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        if (ec.value() != boost::asio::error::operation_aborted)
+            spdlog::warn("[sv_conn] Error in batching timer! err: {}:{}", ec.value(), ec.message());
+        return;
+    }
+    flush_batch();
 }
 
 void supervisor_connection::join()
@@ -72,6 +287,14 @@ void supervisor_connection::connect()
 void supervisor_connection::force_close()
 {
     auto nec = boost::system::error_code();
+    // 断开后要暂存时，未发出的批次拆开放入暂存，重新连接后不必再等 supervisor 确认批量发送
+    if (_replay_ring.buffering())
+        unbatch_pending();
+    else
+        drop_batch();
+    _batching = false;
+    _deflater.reset();
+    _compressing = false;
     if (!_socket)
         return;
     _socket->shutdown(boost::asio::socket_base::shutdown_both, nec);
@@ -155,13 +378,61 @@ void supervisor_connection::on_connected(const boost::system::error_code& ec, st
     spdlog::info("[sv_conn] Connecting to server.");
     _proto_handler->reset(socket);
     _write_helper->reset(socket);
-    _connected_handler();
+    if (_detached)
+    {
+        _detached = false;
+        _detach_timer.cancel(nec);
+    }
+    _connected_handler();  // 发送 WORKER READY
+    if (_replay_ring.buffering())
+        replay();
 }
 
 void supervisor_connection::on_failed()
 {
+    // 没有连接时与发送队列已满一样暂停读取，否则重新连接前读到的数据只能丢弃或者挤占暂存空间
+    _link_ready = false;
+    auto detach = _detach_timeout.count() > 0 && !_detached;
+    if (detach)
+        _replay_ring.start_buffering();  // 在 force_close 之前开始暂存，未发出的批次也进入暂存
     force_close();
-    _disconnected_handler();
+    if (_watermark_handler)
+        _watermark_handler(true);
+    if (detach)
+    {
+        // 先保留房间并暂存数据，短时间内重新连接时不丢失数据，也不用重新连接所有房间
+        spdlog::info("[sv_conn] Disconnected from supervisor. Keeping rooms for at most {}ms.", _detach_timeout.count());
+        _detached = true;
+        _detach_timer.expires_after(_detach_timeout);
+        _detach_timer.async_wait(boost::bind(&supervisor_connection::on_detach_timer, this, boost::asio::placeholders::error));
+    }
+    else if (!_detached)
+        _disconnected_handler();
     reschedule_retry_timer();
 }
+
+void supervisor_connection::on_detach_timer(const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        if (ec.value() != boost::asio::error::operation_aborted)
+            spdlog::warn("[sv_conn] Error in detach timer! err: {}:{}", ec.value(), ec.message());
+        return;
+    }
+    if (_socket || !_detached)
+        return;
+    _detached = false;
+    auto dropped = _replay_ring.clear();
+    spdlog::warn("[sv_conn] Supervisor is still unreachable. Dropped {} buffered frames and closing all rooms.", dropped);
+    _disconnected_handler();
+}
+
+void supervisor_connection::replay()
+{
+    // 新连接还没有协商压缩，直接写出
+    auto count = _replay_ring.replay([this](unsigned char* msg, size_t len, supervisor_buffer_deleter deleter) -> void {
+        _write_helper->write(msg, len, deleter, write_priority::data);
+    });
+    spdlog::info("[sv_conn] Reconnected to supervisor. Replayed {} buffered frames.", count);
+}
 }
@@ -3,15 +3,19 @@
 #include "config.h"
 #include "simple_worker_proto_handler.h"
 #include "asio_socket_write_helper.h"
+#include "link_compression.h"
+#include "replay_ring.h"
 
 #include <boost/thread.hpp>
 #include <boost/asio.hpp>
 
+#include <atomic>
+#include <chrono>
+
 namespace vNerve::bilibili::worker_supervisor
 {
 using supervisor_connected_handler = std::function<void()>;
 using supervisor_buffer_handler = std::function<void(unsigned char*, size_t)>;
-using supervisor_buffer_deleter = std::function<void(unsigned char*)>;
 
 class supervisor_connection
 {
@@ -32,6 +36,32 @@ private:
     boost::asio::deadline_timer _timer;
     int _retry_interval_sec;
 
+    // WORKER DATA BATCH，只在 _thread 上访问
+    size_t _batch_size;  // 0 为不使用批量发送
+    std::chrono::microseconds _batch_delay;
+    boost::asio::steady_timer _batch_timer;
+    std::atomic<bool> _batching{false};  // supervisor 是否已确认支持批量发送，在 _thread 上写入，由解析线程读取
+    unsigned char* _batch = nullptr;
+    size_t _batch_capacity = 0;
+    size_t _batch_length = 0;
+
+    // COMPRESSED CHUNK，_deflater 只在 _thread 上访问
+    bool _compression_requested;
+    int _compression_level;
+    link_dictionary_t _link_dictionary;
+    std::unique_ptr<link_deflater> _deflater;
+    std::atomic<bool> _compressing{false};
+
+    // 断开后在 _detach_timeout 内保留房间连接，期间的数据帧暂存在 _replay_ring 中，重新连接后重放
+    replay_ring _replay_ring;
+    std::chrono::milliseconds _detach_timeout;
+    boost::asio::steady_timer _detach_timer;
+    bool _detached = false;
+
+    // 断开后到下一次 SUPERVISOR READY 之前视为超过高水位，暂停读取房间
+    std::atomic<bool> _link_ready{false};
+    write_watermark_handler _watermark_handler;
+
     std::string _supervisor_host;
     std::string _supervisor_port;
 
@@ -49,14 +79,55 @@ private:
         );
     void on_connected(const boost::system::error_code& ec, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
     void on_failed();
+    void on_detach_timer(const boost::system::error_code& ec);
+    void replay();
+
+    void append_to_batch(unsigned char* entry, size_t len);
+    void flush_batch();
+    void drop_batch();
+    /// 把当前批次拆成单独的 WORKER DATA 写出（或暂存），用于不能再以批次发送的数据
+    void unbatch_pending();
+    void on_batch_timer(const boost::system::error_code& ec);
+
+    /// 在连接线程上写出一帧：暂存、压缩或直接写出
+    void write_frame(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter, write_priority priority);
+    void write_compressed(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter, write_priority priority);
 
 public:
+    ///
+    /// @param disconnected_handler 与 supervisor 断开且未能及时重新连接时调用，此时应关闭所有房间
     supervisor_connection(config::config_t config,
                           supervisor_buffer_handler buffer_handler, supervisor_connected_handler connected_handler, supervisor_connected_handler disconnected_handler);
     ~supervisor_connection();
 
     // Take the ownership of msg.
-    void publish_msg(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter);
+    void publish_msg(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter, write_priority priority = write_priority::data);
+    ///
+    /// 把一项 WORKER DATA BATCH 数据加入当前批次，批次达到 batch-size 或者等待超过 batch-delay-us 后发送。
+    /// Take the ownership of entry, which must be allocated by allocate_frame.
+    void publish_data_entry(unsigned char* entry, size_t len);
+    bool batching_supported() const { return _batch_size > 0; }
+    /// Must be called in the connection thread, i.e. in the buffer handler.
+    void set_batching(bool enabled);
+    /// 当前连接是否使用 publish_data_entry 发送数据，连接断开后立即变为 false。
+    /// 之后才执行的 publish_data_entry 会拆成单独的 WORKER DATA 写出或暂存，不会丢弃。
+    bool batching() const { return _batching.load(std::memory_order_relaxed); }
+
+    bool compression_requested() const { return _compression_requested; }
+    uint32_t link_dictionary_id() const { return worker_supervisor::link_dictionary_id(_link_dictionary); }
+    /// Must be called in the connection thread, i.e. in the buffer handler.
+    void set_compression(bool enabled);
+
+    ///
+    /// 发送队列超过 supervisor-write-high-water 或者与 supervisor 断开时以 true 调用，
+    /// 降到一半以下或者重新连接并收到 SUPERVISOR READY 时以 false 调用。以 above_high_water 为准。
+    /// Must be called before connecting.
+    void set_watermark_handler(write_watermark_handler handler);
+    bool above_high_water() const { return !_link_ready.load(std::memory_order_relaxed) || _write_helper->above_high_water(); }
+    ///
+    /// 新的连接已经可以发送数据（收到了 SUPERVISOR READY），恢复读取房间。
+    /// Must be called in the connection thread, i.e. in the buffer handler.
+    void set_link_ready();
     void join();
 };
 }  // namespace vNerve::bilibili::live::worker_supervisor
\ No newline at end of file
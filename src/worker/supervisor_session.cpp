@@ -2,23 +2,21 @@
 
 #include "simple_worker_proto.h"
 #include "simple_worker_proto_generator.h"
+#include "frame_pool.h"
 
 #include <boost/asio/detail/socket_ops.hpp>
+#include <random>
 #include <utility>
 #include <spdlog/spdlog.h>
 
 namespace vNerve::bilibili::worker_supervisor
 {
-void deleter_unsigned_char_array(unsigned char* buf)
-{
-    delete[] buf;
-}
-
 supervisor_session::supervisor_session(
     config::config_t config,
     room_operation_handler on_open_connection,
     room_operation_handler on_close_connection,
-    supervisor_operation_handler on_supervisor_disconnected)
+    supervisor_operation_handler on_supervisor_disconnected,
+    room_set_provider opened_rooms)
     : _config(config),
       _connection(config,
                   std::bind(&supervisor_session::on_supervisor_message, this, std::placeholders::_1, std::placeholders::_2),
@@ -26,11 +24,16 @@ supervisor_session::supervisor_session(
                   std::bind(&supervisor_session::on_supervisor_disconnected, this)),
       _max_rooms((*_config)["max-rooms"].as<int>()),
       _auth_code((*_config)["auth-code"].as<std::string>()),
+      _session_resume((*_config)["session-resume"].as<bool>()),
+      _room_set_provider(std::move(opened_rooms)),
       _on_open_connection(std::move(on_open_connection)),
       _on_close_connection(std::move(on_close_connection)),
       _on_supervisor_disconnected(std::move(on_supervisor_disconnected))
 {
-
+    std::random_device device;
+    std::uniform_int_distribution<uint64_t> distribution(1);
+    _session_id = distribution(device);
+    spdlog::info("[sv_sess] Session id: {:016x}, resuming: {}", _session_id, _session_resume);
 }
 
 supervisor_session::~supervisor_session()
@@ -39,14 +42,36 @@ supervisor_session::~supervisor_session()
 
 void supervisor_session::on_supervisor_connected()
 {
-    auto [packet, packet_length] = generate_worker_ready_packet(_max_rooms, _auth_code);
+    uint32_t flags = 0;
+    if (_connection.batching_supported())
+        flags |= capability_data_batch;
+    if (_connection.compression_requested())
+        flags |= capability_link_compression;
+
+    // 断开后及时重新连接时房间没有关闭
+    auto rooms = _room_set_provider();
+    if (_session_resume)
+        flags |= capability_session_resume;
+    auto [packet, packet_length] = generate_worker_ready_packet(_max_rooms, _auth_code, flags, _connection.link_dictionary_id(), _session_id, rooms);
+
+    spdlog::info("[sv_sess] Connected to supervisor. Sending ready packet with max_rooms={}, flags={:08x}, rooms={}", _max_rooms, flags, rooms.size());
+    _connection.publish_msg(packet, packet_length, release_frame, write_priority::control);
+
+    _awaiting_resume = _session_resume && !rooms.empty();
+    if (!_session_resume && !rooms.empty())
+        drop_kept_rooms();
+}
 
-    spdlog::info("[sv_sess] Connected to supervisor. Sending ready packet with max_rooms={}", _max_rooms);
-    _connection.publish_msg(packet, packet_length, deleter_unsigned_char_array);
+void supervisor_session::drop_kept_rooms()
+{
+    spdlog::info("[sv_sess] Session not resumed. Closing rooms kept during reconnection.");
+    _awaiting_resume = false;
+    _on_supervisor_disconnected();
 }
 
 void supervisor_session::on_supervisor_disconnected()
 {
+    _awaiting_resume = false;
     _on_supervisor_disconnected();
 }
 
@@ -65,6 +90,9 @@ void supervisor_session::on_supervisor_message(unsigned char* msg, size_t len)
     {
     case assign_room_code:
     {
+        if (_awaiting_resume)
+            drop_kept_rooms();  // 不认识 SUPERVISOR READY 的 supervisor
+        _connection.set_link_ready();
         SPDLOG_DEBUG("[sv_sess] Reveived Assign room packet. room_id={}", room_id);
         _on_open_connection(room_id);
     }
@@ -75,6 +103,25 @@ void supervisor_session::on_supervisor_message(unsigned char* msg, size_t len)
         _on_close_connection(room_id);
     }
         break;
+    case supervisor_ready_code:
+    {
+        auto flags = static_cast<uint32_t>(room_id);  // flags is in the place of room_id
+        spdlog::info("[sv_sess] Supervisor ready. flags={:08x}", flags);
+        _connection.set_batching((flags & capability_data_batch) != 0);
+        _connection.set_compression((flags & capability_link_compression) != 0);
+        _connection.set_link_ready();
+        if (_awaiting_resume)
+        {
+            if (flags & capability_session_resume)
+            {
+                spdlog::info("[sv_sess] Session resumed.");
+                _awaiting_resume = false;
+            }
+            else
+                drop_kept_rooms();
+        }
+    }
+        break;
     default:
         SPDLOG_DEBUG("[sv_sess] Invalid sv packet. opcode=", op_code);
         break;
@@ -83,10 +130,18 @@ void supervisor_session::on_supervisor_message(unsigned char* msg, size_t len)
 
 void supervisor_session::on_message(room_id_t room_id, borrowed_message const* msg)
 {
+    if (_connection.batching())
+    {
+        auto [entry, entry_length] = generate_worker_data_entry(room_id, msg);
+        SPDLOG_TRACE("[sv_sess] Batching Worker data. room_id={}, len={}", room_id, entry_length);
+        _connection.publish_data_entry(entry, entry_length);
+        return;
+    }
+
     auto [packet, packet_length] = generate_worker_data_packet(room_id, msg);
 
     SPDLOG_TRACE("[sv_sess] Sending Worker data packet. room_id={}, len={}", room_id, packet_length);
-    _connection.publish_msg(packet, packet_length, deleter_unsigned_char_array);
+    _connection.publish_msg(packet, packet_length, release_frame);
 }
 
 void supervisor_session::on_room_failed(room_id_t room_id)
@@ -94,7 +149,7 @@ void supervisor_session::on_room_failed(room_id_t room_id)
     auto [packet, packet_length] = generate_room_failed_packet(room_id);
 
     SPDLOG_DEBUG("[sv_sess] Sending Room failed packet. room_id=", room_id);
-    _connection.publish_msg(packet, packet_length, deleter_unsigned_char_array);
+    _connection.publish_msg(packet, packet_length, release_frame, write_priority::control);
 }
 
 void supervisor_session::join()
@@ -108,7 +163,8 @@ void supervisor_session::on_data(unsigned char* data, size_t len, supervisor_buf
     {
         SPDLOG_DEBUG("[sv_sess] Failed to send packet. Malformed data: len={}<simple_message_header_length", len);
         deleter(data);
+        return;
     }
-    _connection.publish_msg(data, len, deleter_unsigned_char_array);
+    _connection.publish_msg(data, len, deleter);
 }
 }
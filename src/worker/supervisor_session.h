@@ -6,11 +6,13 @@
 #include "type.h"
 
 #include <memory>
+#include <vector>
 
 namespace vNerve::bilibili::worker_supervisor
 {
 using room_operation_handler = std::function<void(int)>;
 using supervisor_operation_handler = std::function<void()>;
+using room_set_provider = std::function<std::vector<room_id_t>()>;
 
 class supervisor_session
 {
@@ -19,6 +21,11 @@ class supervisor_session
 
     int _max_rooms;
     std::string _auth_code;
+    // 会话恢复：同一进程内不变的 SESSION_ID，重新连接时在 WORKER READY 中带上仍在连接的房间
+    bool _session_resume;
+    uint64_t _session_id;
+    bool _awaiting_resume = false;  // 已发送房间列表，等待 SUPERVISOR READY 确认
+    room_set_provider _room_set_provider;
 
     room_operation_handler _on_open_connection;
     room_operation_handler _on_close_connection;
@@ -26,6 +33,8 @@ class supervisor_session
 
     void on_supervisor_connected();
     void on_supervisor_disconnected();
+    /// supervisor 没有接受会话恢复，关闭重新连接前保留的房间
+    void drop_kept_rooms();
     ///
     /// Called when received a message from the supervisor
     /// The data which the function is called with DOESN'T contains header.
@@ -46,7 +55,12 @@ public:
     void on_room_failed(room_id_t room_id);
     void join();
 
-    supervisor_session(config::config_t config, room_operation_handler on_open_connection, room_operation_handler on_close_connection, supervisor_operation_handler on_supervisor_disconnected);
+    /// 见 supervisor_connection::set_watermark_handler
+    void set_watermark_handler(write_watermark_handler handler) { _connection.set_watermark_handler(std::move(handler)); }
+    bool write_queue_above_high_water() const { return _connection.above_high_water(); }
+
+    supervisor_session(config::config_t config, room_operation_handler on_open_connection, room_operation_handler on_close_connection, supervisor_operation_handler on_supervisor_disconnected,
+                       room_set_provider opened_rooms);
     ~supervisor_session();
 };
 }
@@ -0,0 +1,129 @@
+#include "timing_wheel.h"
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace vNerve::bilibili
+{
+timing_wheel::timing_wheel(boost::asio::io_context& context, const std::chrono::milliseconds tick)
+    : _timer(context), _tick(std::max(tick, std::chrono::milliseconds(1))), _start(std::chrono::steady_clock::now())
+{
+    start_timer();
+}
+
+timing_wheel::timer_id timing_wheel::schedule(const std::chrono::milliseconds delay, handler callback)
+{
+    // 从实际时间算起，而不是从 _current_tick：分片繁忙、时间轮还没追上时，_current_tick 落后于实际时间
+    auto due = std::chrono::steady_clock::now() - _start + delay;
+    auto deadline = static_cast<uint64_t>((due + _tick - std::chrono::steady_clock::duration(1)) / _tick);
+    deadline = std::max(deadline, _current_tick + 1);  // 当前 tick 已经处理过
+    auto id = _next_id++;
+    _entries.emplace(id, entry{deadline, std::move(callback)});
+    insert(id, deadline);
+    pending.store(_entries.size(), std::memory_order_relaxed);
+    return id;
+}
+
+void timing_wheel::cancel(const timer_id id)
+{
+    if (id == 0)
+        return;
+    _entries.erase(id);
+    pending.store(_entries.size(), std::memory_order_relaxed);
+}
+
+void timing_wheel::stop()
+{
+    _stopped = true;
+    boost::system::error_code ec;
+    _timer.cancel(ec);
+    _entries.clear();
+    for (auto& slot : _level0)
+        slot.clear();
+    for (auto& slot : _level1)
+        slot.clear();
+    pending.store(0, std::memory_order_relaxed);
+}
+
+void timing_wheel::insert(const timer_id id, uint64_t deadline)
+{
+    // 降级时可能恰好在当前 tick 到期，放入当前格，随后即被处理
+    deadline = std::max(deadline, _current_tick);
+    if (deadline - _current_tick < level0_slots)
+    {
+        _level0[deadline & (level0_slots - 1)].push_back(id);
+        return;
+    }
+    // 超过第 1 层范围的放在最远的一格，转到时重新插入
+    auto round = std::min(deadline >> level0_bits, (_current_tick >> level0_bits) + level1_slots - 1);
+    _level1[round % level1_slots].push_back(id);
+}
+
+void timing_wheel::cascade()
+{
+    auto& slot = _level1[(_current_tick >> level0_bits) % level1_slots];
+    if (slot.empty())
+        return;
+    std::vector<timer_id> ids;
+    ids.swap(slot);
+    for (auto id : ids)
+    {
+        auto iter = _entries.find(id);
+        if (iter != _entries.end())
+            insert(id, iter->second.deadline);
+    }
+}
+
+void timing_wheel::start_timer()
+{
+    _timer.expires_at(_start + _tick * (_current_tick + 1));
+    _timer.async_wait(boost::bind(&timing_wheel::on_tick, this, boost::asio::placeholders::error));
+}
+
+void timing_wheel::on_tick(const boost::system::error_code& ec)
+{
+    if (ec || _stopped)
+    {
+        if (ec && ec.value() != boost::asio::error::operation_aborted)
+            spdlog::warn("[t_wheel] Timer error: {}:{}", ec.value(), ec.message());
+        return;
+    }
+
+    auto target = static_cast<uint64_t>((std::chrono::steady_clock::now() - _start) / _tick);
+    if (target > _current_tick + 1)
+        late_ticks.fetch_add(target - _current_tick - 1, std::memory_order_relaxed);
+    while (_current_tick < target)
+    {
+        _current_tick++;
+        if ((_current_tick & (level0_slots - 1)) == 0)
+            cascade();
+
+        auto& slot = _level0[_current_tick & (level0_slots - 1)];
+        if (slot.empty())
+            continue;
+        _expiring.clear();
+        _expiring.swap(slot);
+        for (auto id : _expiring)
+        {
+            auto iter = _entries.find(id);
+            if (iter == _entries.end())
+                continue;  // 已取消
+            if (iter->second.deadline > _current_tick)
+            {
+                insert(id, iter->second.deadline);
+                continue;
+            }
+            auto callback = std::move(iter->second.callback);
+            _entries.erase(iter);
+            fired.fetch_add(1, std::memory_order_relaxed);
+            callback();
+            if (_stopped)
+                return;
+        }
+    }
+    pending.store(_entries.size(), std::memory_order_relaxed);
+    start_timer();
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+///
+/// 分片内所有连接共用的分层时间轮，驱动心跳、握手超时和空闲检测。
+/// 整个分片只有一个 steady_timer，按固定的 tick 推进，避免每个连接各自的定时器在 reactor 的定时器堆中反复增删。
+///
+/// 第 0 层 512 格，每格一个 tick；第 1 层 64 格，每格为第 0 层一圈。
+/// tick 为 100ms 时第 0 层覆盖 51.2 秒，第 1 层覆盖约 54 分钟，更远的定时器会在第 1 层中多转几圈。
+///
+/// 不是线程安全的，只能在分片的线程上使用。到期回调也在分片线程上调用，精度为一个 tick。
+class timing_wheel
+{
+public:
+    using timer_id = uint64_t;
+    using handler = std::function<void()>;
+
+private:
+    static const size_t level0_bits = 9;
+    static const size_t level0_slots = size_t(1) << level0_bits;
+    static const size_t level1_slots = 64;
+
+    struct entry
+    {
+        uint64_t deadline;  // 到期的 tick
+        handler callback;
+    };
+
+    boost::asio::steady_timer _timer;
+    std::chrono::milliseconds _tick;
+    std::chrono::steady_clock::time_point _start;
+    uint64_t _current_tick = 0;
+    timer_id _next_id = 1;
+    bool _stopped = false;
+
+    std::unordered_map<timer_id, entry> _entries;  // 取消时只从这里删除，时间轮中的 id 在到期时跳过
+    std::array<std::vector<timer_id>, level0_slots> _level0;
+    std::array<std::vector<timer_id>, level1_slots> _level1;
+    std::vector<timer_id> _expiring;
+
+    void insert(timer_id id, uint64_t deadline);
+    void cascade();
+    void start_timer();
+    void on_tick(const boost::system::error_code& ec);
+
+public:
+    // 以下统计由分片线程写入，统计定时器读取
+    std::atomic<size_t> pending{0};
+    std::atomic<uint64_t> fired{0};
+    std::atomic<uint64_t> late_ticks{0};  // 推进时补上的 tick 数，反映分片线程的繁忙程度
+
+    timing_wheel(boost::asio::io_context& context, std::chrono::milliseconds tick);
+    timing_wheel(const timing_wheel&) = delete;
+    timing_wheel& operator=(const timing_wheel&) = delete;
+
+    ///
+    /// 在 delay 之后调用 callback。到期时间从调用时的实际时间算起并向上取整到 tick，不会因为时间轮推进滞后而提前。
+    /// @return 用于取消的 id，不会为 0
+    timer_id schedule(std::chrono::milliseconds delay, handler callback);
+    ///
+    /// 取消定时器。id 为 0 或已经到期时什么也不做。
+    void cancel(timer_id id);
+    ///
+    /// 停止推进，丢弃所有定时器。
+    void stop();
+
+    std::chrono::milliseconds tick() const { return _tick; }
+};
+}  // namespace vNerve::bilibili
@@ -0,0 +1,149 @@
+#include "tls_context.h"
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace vNerve::bilibili
+{
+namespace
+{
+std::unique_ptr<boost::asio::ssl::context> shared_context;
+bool session_resume = true;
+
+struct session_deleter
+{
+    void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+};
+using session_ptr = std::unique_ptr<SSL_SESSION, session_deleter>;
+
+std::mutex sessions_mutex;
+std::unordered_map<std::string, session_ptr> sessions;  // SNI 主机名 -> 最近一次握手得到的会话
+
+std::atomic<uint64_t> handshakes{0};
+std::atomic<uint64_t> resumed_handshakes{0};
+std::atomic<uint64_t> failed_handshakes{0};
+std::atomic<uint64_t> handshake_us{0};
+std::atomic<uint64_t> max_handshake_us{0};
+
+/// OpenSSL 在收到新会话（TLS 1.3 下握手之后的 NewSessionTicket）时调用
+int on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!host || !SSL_SESSION_is_resumable(session))
+        return 0;
+    // 连接没有 SSL_shutdown 就释放时，OpenSSL 会把它当前的会话标记为不可恢复，所以缓存一份副本
+    session_ptr copy(SSL_SESSION_dup(session));
+    if (!copy)
+        return 0;
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    sessions[host] = std::move(copy);
+    return 0;
+}
+}  // namespace
+
+boost::asio::ssl::context& client_tls_context()
+{
+    return *shared_context;
+}
+
+void setup_tls_context(const config::config_t options)
+{
+    shared_context = std::make_unique<boost::asio::ssl::context>(boost::asio::ssl::context::tls_client);
+    try
+    {
+        shared_context->load_verify_file("cacert.pem");
+    }
+    catch (boost::system::system_error& err)
+    {
+        spdlog::critical("[tls] Failed to initialize ssl_context from file cacert.pem! Ensure you have a valid CA cert file. err:{}:{}", err.code().value(), err.code().message());
+        throw;
+    }
+    auto native = shared_context->native_handle();
+    // 连接空闲时释放 OpenSSL 的读写缓冲区（各约 17KB），大部分房间大部分时间都是空闲的
+    SSL_CTX_set_mode(native, SSL_MODE_RELEASE_BUFFERS);
+
+    auto ciphers = (*options)["tls-ciphers"].as<std::string>();
+    if (!ciphers.empty() && !SSL_CTX_set_cipher_list(native, ciphers.c_str()))
+        spdlog::warn("[tls] Invalid tls-ciphers {}, using OpenSSL defaults.", ciphers);
+    auto ciphersuites = (*options)["tls-ciphersuites"].as<std::string>();
+    if (!ciphersuites.empty() && !SSL_CTX_set_ciphersuites(native, ciphersuites.c_str()))
+        spdlog::warn("[tls] Invalid tls-ciphersuites {}, using OpenSSL defaults.", ciphersuites);
+    auto curves = (*options)["tls-curves"].as<std::string>();
+    if (!curves.empty() && !SSL_CTX_set1_groups_list(native, curves.c_str()))
+        spdlog::warn("[tls] Invalid tls-curves {}, using OpenSSL defaults.", curves);
+
+    session_resume = (*options)["tls-session-resume"].as<bool>();
+    if (session_resume)
+    {
+        // 会话由 sessions 按主机名保存，OpenSSL 内部的缓存只对服务端有意义
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(native, on_new_session);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+    }
+    spdlog::info("[tls] Initialized SSL Context from cacert.pem. session resumption={}, curves={}",
+                 session_resume, curves.empty() ? "default" : curves);
+}
+
+bool prepare_tls_session(SSL* ssl, const std::string& host)
+{
+    if (!SSL_set_tlsext_host_name(ssl, host.c_str()))
+        return false;
+    if (!session_resume)
+        return true;
+
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto iter = sessions.find(host);
+    if (iter != sessions.end())
+        SSL_set_session(ssl, iter->second.get());  // SSL 自己持有一个引用
+    return true;
+}
+
+void record_tls_handshake(SSL* ssl, const std::chrono::steady_clock::duration elapsed)
+{
+    auto us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    handshakes.fetch_add(1, std::memory_order_relaxed);
+    if (SSL_session_reused(ssl))
+        resumed_handshakes.fetch_add(1, std::memory_order_relaxed);
+    handshake_us.fetch_add(us, std::memory_order_relaxed);
+    auto max = max_handshake_us.load(std::memory_order_relaxed);
+    while (us > max && !max_handshake_us.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+void record_tls_handshake_failure(SSL* ssl)
+{
+    failed_handshakes.fetch_add(1, std::memory_order_relaxed);
+    auto host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!host)
+        return;
+    // 服务器拒绝会话时本应退回完整握手，以防万一下次不再尝试这个会话
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    sessions.erase(host);
+}
+
+void report_tls_statistics()
+{
+    auto count = handshakes.exchange(0, std::memory_order_relaxed);
+    auto resumed = resumed_handshakes.exchange(0, std::memory_order_relaxed);
+    auto failed = failed_handshakes.exchange(0, std::memory_order_relaxed);
+    auto total_us = handshake_us.exchange(0, std::memory_order_relaxed);
+    auto max_us = max_handshake_us.exchange(0, std::memory_order_relaxed);
+    size_t cached;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        cached = sessions.size();
+    }
+    spdlog::info("[tls] {} handshakes, {} resumed ({:.1f}%), {} failed, avg {}us, max {}us, {} sessions cached.",
+                 count, resumed, count > 0 ? 100.0 * resumed / count : 0.0, failed,
+                 count > 0 ? total_us / count : 0, max_us, cached);
+}
+}  // namespace vNerve::bilibili
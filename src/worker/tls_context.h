@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.h"
+
+#include <boost/asio/ssl.hpp>
+
+#include <chrono>
+#include <string>
+
+namespace vNerve::bilibili
+{
+///
+/// 所有到 Bilibili 的 TLS 连接（弹幕 WebSocket 和获取弹幕服务器配置）共用的客户端 TLS 上下文。
+/// 按 SNI 主机名缓存最近一次握手得到的会话（TLS 1.3 下为 session ticket），重连同一主机时用它恢复会话，省去完整握手。
+/// 需要在创建任何连接之前调用 setup_tls_context。
+boost::asio::ssl::context& client_tls_context();
+
+///
+/// 读取 TLS 相关的配置（tls-ciphers、tls-ciphersuites、tls-curves、tls-session-resume）并初始化上下文。
+void setup_tls_context(const config::config_t options);
+
+///
+/// 在握手前调用：设置 SNI，并在有缓存的会话时尝试恢复。可以在任意线程调用。
+/// @return 设置 SNI 失败时返回 false
+bool prepare_tls_session(SSL* ssl, const std::string& host);
+
+///
+/// 在握手完成后调用，记录握手耗时以及会话是否被恢复。
+void record_tls_handshake(SSL* ssl, std::chrono::steady_clock::duration elapsed);
+///
+/// 在握手失败后调用。如果失败的握手尝试了恢复会话，丢弃这个主机缓存的会话。
+void record_tls_handshake_failure(SSL* ssl);
+
+void report_tls_statistics();
+}  // namespace vNerve::bilibili
@@ -0,0 +1,157 @@
+///
+/// bili_packet_framer 与 WebSocket 读取路径的配合：
+/// 超过 max-read-buffer 的消息要按 bilibili_connection_websocket::start_read 的方式分段读取，
+/// 由分包器丢弃其中过大的数据包，同一条消息和之后消息中的其他数据包照常处理，连接不断开。
+#include "bili_json.h"
+#include "bili_packet.h"
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vNerve::bilibili;
+namespace beast = boost::beast;
+namespace websocket = boost::beast::websocket;
+using boost::asio::ip::tcp;
+
+// 本测试只检查分包，不解析 JSON，不链接 bili_json.cpp 和 protobuf
+namespace vNerve::bilibili
+{
+const borrowed_message* serialize_buffer(char*, const size_t&, const unsigned int&) { return nullptr; }
+const borrowed_message* serialize_popularity(const long long, const unsigned int&) { return nullptr; }
+}  // namespace vNerve::bilibili
+
+namespace
+{
+int failures = 0;
+#define CHECK(expr)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(expr))                                                       \
+        {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (false)
+
+const size_t max_read_buffer = 4096;
+
+std::string make_packet(bilibili_packet_op_code op_code, size_t payload_size, char fill)
+{
+    auto header = bilibili_packet_header();
+    header.length(static_cast<uint32_t>(sizeof(bilibili_packet_header) + payload_size));
+    header.protocol_version(json_protocol);
+    header.op_code(op_code);
+    return std::string(reinterpret_cast<char*>(&header), sizeof(header)) + std::string(payload_size, fill);
+}
+
+struct received_packet
+{
+    uint32_t op_code;
+    size_t length;
+    char first;
+};
+
+///
+/// 在后台线程上接受一个 WebSocket 连接，依次发送 messages 中的每条消息。
+std::thread serve(tcp::acceptor& acceptor, std::vector<std::string> messages)
+{
+    return std::thread([&acceptor, messages]() {
+        boost::asio::io_context context;
+        tcp::socket socket(context);
+        acceptor.accept(socket);
+        websocket::stream<tcp::socket> ws(std::move(socket));
+        ws.accept();
+        ws.binary(true);
+        for (auto& message : messages)
+            ws.write(boost::asio::buffer(message));
+        boost::system::error_code ec;
+        ws.close(websocket::close_code::normal, ec);
+    });
+}
+
+///
+/// 与 bilibili_connection_websocket 相同的读取循环：async_read_some 限制为 read_limit，读到的数据交给 on_data。
+/// @return 读取结束时的错误
+boost::system::error_code read_all(bool whole_messages, std::vector<received_packet>& packets, size_t& max_capacity)
+{
+    boost::asio::io_context server_context;
+    tcp::acceptor acceptor(server_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto small = make_packet(json_message, 8, 'a');
+    auto oversized = make_packet(json_message, max_read_buffer * 3, 'b');
+    auto heartbeat = make_packet(heartbeat_resp, 4, 'c');
+    auto after = make_packet(json_message, 8, 'd');
+    auto server = serve(acceptor, {small + oversized + heartbeat, after});
+
+    boost::asio::io_context context;
+    websocket::stream<beast::tcp_stream> ws(context);
+    beast::get_lowest_layer(ws).connect(acceptor.local_endpoint());
+    ws.handshake("localhost", "/sub");
+
+    bili_packet_framer framer(max_read_buffer);
+    boost::system::error_code result;
+    std::function<void()> start_read;
+    auto on_receive = [&](const boost::system::error_code& ec, size_t) {
+        if (ec)
+        {
+            result = ec;
+            return;
+        }
+        max_capacity = std::max(max_capacity, framer.capacity());
+        framer.on_data([&](unsigned char* packet) {
+            auto header = reinterpret_cast<bilibili_packet_header*>(packet);
+            packets.push_back({header->op_code(), header->length(), static_cast<char>(packet[sizeof(bilibili_packet_header)])});
+        });
+        start_read();
+    };
+    start_read = [&]() {
+        if (whole_messages)
+            ws.async_read(framer.buffer(), on_receive);
+        else
+            ws.async_read_some(framer.buffer(), framer.read_limit(), on_receive);
+    };
+    start_read();
+    context.run();
+    beast::get_lowest_layer(ws).close();  // 读取出错时服务端还在等待关闭握手
+    server.join();
+    return result;
+}
+}  // namespace
+
+int main()
+{
+    {
+        std::vector<received_packet> packets;
+        size_t max_capacity = 0;
+        auto ec = read_all(false, packets, max_capacity);
+        CHECK(ec == websocket::error::closed);
+        CHECK(packets.size() == 3);
+        if (packets.size() == 3)
+        {
+            CHECK(packets[0].op_code == json_message && packets[0].first == 'a');
+            CHECK(packets[1].op_code == heartbeat_resp && packets[1].first == 'c');
+            CHECK(packets[2].op_code == json_message && packets[2].first == 'd');
+        }
+        CHECK(max_capacity <= max_read_buffer);
+    }
+    {
+        // 整条读取时，过大的消息让 beast 直接失败，分包器什么也收不到
+        std::vector<received_packet> packets;
+        size_t max_capacity = 0;
+        auto ec = read_all(true, packets, max_capacity);
+        CHECK(ec == websocket::error::buffer_overflow);
+        CHECK(packets.empty());
+    }
+
+    if (failures)
+        std::fprintf(stderr, "%d check(s) failed.\n", failures);
+    else
+        std::printf("All checks passed.\n");
+    return failures ? 1 : 0;
+}
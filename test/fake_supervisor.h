@@ -0,0 +1,275 @@
+#pragma once
+
+#include "link_compression.h"
+#include "simple_worker_proto.h"
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vNerve::bilibili::worker_supervisor::test
+{
+///
+/// 测试用的 supervisor：监听本机端口，一次接受一个 worker 连接。
+/// 回复 WORKER READY，解开 COMPRESSED CHUNK 和 WORKER DATA BATCH，把收到的每个数据包记录下来。
+/// 所有方法都可以在测试线程中调用，数据包在后台线程上读取。
+class fake_supervisor
+{
+public:
+    struct packet
+    {
+        unsigned char op_code;
+        room_id_t room_id;  // WORKER DATA / ROOM FAILED
+        std::string payload;  // WORKER DATA 的 PAYLOAD
+    };
+
+private:
+    boost::asio::io_context _context;
+    boost::asio::ip::tcp::acceptor _acceptor;
+    std::thread _thread;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
+    std::vector<packet> _packets;
+    size_t _connections = 0;
+    size_t _ready_received = 0;
+    size_t _inflate_errors = 0;
+    bool _reading = true;
+    bool _stopped = false;
+
+    uint32_t _accepted_flags;
+    bool _keep_packets;
+    std::atomic<uint64_t> _bytes{0};
+    std::atomic<uint64_t> _data_packets{0};
+
+    static uint32_t read_uint32(const unsigned char* ptr)
+    {
+        return boost::asio::detail::socket_ops::network_to_host_long(*reinterpret_cast<const uint32_t*>(ptr));
+    }
+
+    void record(unsigned char op_code, room_id_t room_id, const unsigned char* payload, size_t len)
+    {
+        if (op_code == worker_data_code)
+            _data_packets.fetch_add(1, std::memory_order_relaxed);
+        if (_keep_packets)
+            _packets.push_back({op_code, room_id, std::string(reinterpret_cast<const char*>(payload), len)});
+    }
+
+    void on_packet(const unsigned char* payload, size_t len, boost::asio::ip::tcp::socket& socket, link_inflater& inflater)
+    {
+        if (len < 1)
+            return;
+        std::unique_lock lock(_mutex);
+        switch (payload[0])
+        {
+        case worker_ready_code:
+        {
+            _ready_received++;
+            auto flags = len >= worker_ready_payload_length + sizeof(uint32_t) ? read_uint32(payload + worker_ready_payload_length) : 0;
+            unsigned char reply[simple_message_header_length + supervisor_ready_payload_length];
+            *reinterpret_cast<uint32_t*>(reply) = boost::asio::detail::socket_ops::host_to_network_long(supervisor_ready_payload_length);
+            reply[simple_message_header_length] = supervisor_ready_code;
+            *reinterpret_cast<uint32_t*>(reply + simple_message_header_length + 1) =
+                boost::asio::detail::socket_ops::host_to_network_long(flags & _accepted_flags);
+            lock.unlock();
+            boost::system::error_code ec;
+            boost::asio::write(socket, boost::asio::buffer(reply), ec);
+            lock.lock();
+            break;
+        }
+        case worker_data_code:
+        {
+            auto header = worker_data_payload_header_length;
+            record(worker_data_code, read_uint32(payload + 1), payload + header, len - header);
+            break;
+        }
+        case room_failed_code:
+            record(room_failed_code, read_uint32(payload + 1), nullptr, 0);
+            break;
+        case worker_data_batch_code:
+        {
+            size_t offset = worker_data_batch_header_length;
+            while (offset < len)
+            {
+                auto room_id = read_uint32(payload + offset);
+                offset += room_id_length + checksum_length;
+                offset += 1 + payload[offset];  // RK_LEN ROUTING_KEY
+                auto payload_length = read_uint32(payload + offset);
+                offset += worker_data_entry_payload_length_length;
+                record(worker_data_code, room_id, payload + offset, payload_length);
+                offset += payload_length;
+            }
+            break;
+        }
+        case compressed_chunk_code:
+        {
+            auto [inflated, inflated_length] = inflater.decompress(payload + compressed_chunk_header_length, len - compressed_chunk_header_length);
+            if (!inflated)
+            {
+                _inflate_errors++;
+                _changed.notify_all();
+                return;
+            }
+            lock.unlock();
+            size_t offset = 0;
+            while (offset + simple_message_header_length <= inflated_length)
+            {
+                auto packet_length = read_uint32(inflated + offset);
+                offset += simple_message_header_length;
+                on_packet(inflated + offset, packet_length, socket, inflater);
+                offset += packet_length;
+            }
+            return;
+        }
+        default:
+            break;
+        }
+        _changed.notify_all();
+    }
+
+    void serve()
+    {
+        while (true)
+        {
+            auto socket = std::make_shared<boost::asio::ip::tcp::socket>(_context);
+            boost::system::error_code ec;
+            _acceptor.accept(*socket, ec);
+            {
+                std::lock_guard lock(_mutex);
+                if (_stopped || ec)
+                    return;
+                _socket = socket;
+                _connections++;
+            }
+            _changed.notify_all();
+
+            // 每个连接各自的压缩流
+            link_inflater inflater(64 * 1024 * 1024, nullptr);
+            std::vector<unsigned char> buffer(64 * 1024);
+            size_t buffered = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock lock(_mutex);
+                    _changed.wait(lock, [this]() { return _reading || _stopped; });
+                    if (_stopped)
+                        return;
+                }
+                if (buffered == buffer.size())
+                    buffer.resize(buffer.size() * 2);
+                auto transferred = socket->read_some(boost::asio::buffer(buffer.data() + buffered, buffer.size() - buffered), ec);
+                if (ec)
+                    break;
+                _bytes.fetch_add(transferred, std::memory_order_relaxed);
+                buffered += transferred;
+
+                size_t offset = 0;
+                while (buffered - offset >= simple_message_header_length)
+                {
+                    auto packet_length = read_uint32(buffer.data() + offset);
+                    if (buffered - offset - simple_message_header_length < packet_length)
+                        break;
+                    on_packet(buffer.data() + offset + simple_message_header_length, packet_length, *socket, inflater);
+                    offset += simple_message_header_length + packet_length;
+                }
+                std::memmove(buffer.data(), buffer.data() + offset, buffered - offset);
+                buffered -= offset;
+            }
+            std::lock_guard lock(_mutex);
+            _socket.reset();
+        }
+    }
+
+public:
+    ///
+    /// @param accepted_flags 在 SUPERVISOR READY 中确认的能力，与 worker 请求的取交集
+    /// @param keep_packets 为 false 时只计数，不保存数据包（用于压测）
+    explicit fake_supervisor(uint32_t accepted_flags, bool keep_packets = true)
+        : _acceptor(_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+          _accepted_flags(accepted_flags),
+          _keep_packets(keep_packets)
+    {
+        _thread = std::thread([this]() { serve(); });
+    }
+
+    ~fake_supervisor()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+            boost::system::error_code ec;
+            if (_socket)
+                _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+        }
+        _changed.notify_all();
+        // 唤醒阻塞在 accept 中的线程
+        boost::asio::ip::tcp::socket wake(_context);
+        boost::system::error_code ec;
+        wake.connect(_acceptor.local_endpoint(), ec);
+        _thread.join();
+    }
+
+    unsigned short port() const { return _acceptor.local_endpoint().port(); }
+    uint64_t bytes_received() const { return _bytes.load(std::memory_order_relaxed); }
+    uint64_t data_packets_received() const { return _data_packets.load(std::memory_order_relaxed); }
+
+    /// 暂停读取，worker 的数据会积压在内核缓冲区和 worker 的发送队列中
+    void pause_reading()
+    {
+        std::lock_guard lock(_mutex);
+        _reading = false;
+    }
+
+    void resume_reading()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _reading = true;
+        }
+        _changed.notify_all();
+    }
+
+    /// 断开当前连接，worker 会重新连接
+    void disconnect()
+    {
+        std::lock_guard lock(_mutex);
+        boost::system::error_code ec;
+        if (_socket)
+            _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+    }
+
+    ///
+    /// 等待 predicate 成立，predicate 在锁内调用。
+    /// @return 超时返回 false
+    bool wait(const std::function<bool(const fake_supervisor&)>& predicate, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(_mutex);
+        return _changed.wait_for(lock, timeout, [&]() { return predicate(*this); });
+    }
+
+    /// 以下在 wait 的 predicate 中使用，或在读取停止后使用
+    const std::vector<packet>& packets() const { return _packets; }
+    size_t connections() const { return _connections; }
+    size_t ready_received() const { return _ready_received; }
+    size_t inflate_errors() const { return _inflate_errors; }
+    bool connected() const { return _socket != nullptr; }
+
+    std::vector<packet> take_packets()
+    {
+        std::vector<packet> result;
+        std::lock_guard lock(_mutex);
+        result.swap(_packets);
+        return result;
+    }
+};
+}  // namespace vNerve::bilibili::worker_supervisor::test
@@ -0,0 +1,247 @@
+///
+/// supervisor_session / supervisor_connection 与本机测试 supervisor 之间的链路：
+/// 批量发送和压缩打开时数据帧的顺序和完整性，写出队列丢弃数据时压缩流不被破坏，
+/// 断开时暂停读取，断开前后的数据经暂存重放后不缺不乱。
+#include "supervisor_session.h"
+#include "borrowed_message.h"
+#include "fake_supervisor.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vNerve::bilibili;
+using namespace vNerve::bilibili::worker_supervisor;
+using test::fake_supervisor;
+
+namespace
+{
+int failures = 0;
+#define CHECK(expr)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(expr))                                                       \
+        {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (false)
+
+const room_id_t test_room = 7;
+
+///
+/// PAYLOAD 以 8 位十进制序号开头，之后用 filler 填充到 size 字节
+class numbered_message : public borrowed_message
+{
+    std::string _payload;
+
+public:
+    numbered_message(size_t sequence, size_t size, const std::string& filler)
+    {
+        checksum = sequence;
+        std::memset(routing_key, 0, sizeof(routing_key));
+        char number[16];
+        std::snprintf(number, sizeof(number), "%08zu", sequence);
+        _payload = number;
+        while (_payload.size() < size)
+            _payload += filler;
+        _payload.resize(size);
+    }
+
+    size_t size() const override { return _payload.size(); }
+    void write(void* data, int size) const override { std::memcpy(data, _payload.data(), size); }
+};
+
+size_t sequence_of(const fake_supervisor::packet& packet)
+{
+    return std::strtoull(packet.payload.substr(0, 8).c_str(), nullptr, 10);
+}
+
+config::config_t make_config(unsigned short port, std::vector<std::string> extra)
+{
+    std::vector<std::string> args = {
+        "supervisor_connection_test",
+        "--supervisor-host=127.0.0.1",
+        "--supervisor-port=" + std::to_string(port),
+        "--retry-interval-sec=1"};
+    args.insert(args.end(), extra.begin(), extra.end());
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back(arg.data());
+    return config::parse_options(static_cast<int>(argv.size()), argv.data());
+}
+
+template <class Predicate>
+bool poll(Predicate predicate, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+bool wait_ready(fake_supervisor& supervisor, size_t count)
+{
+    // supervisor_connection 在启动 5 秒后才第一次连接
+    auto ready = supervisor.wait([count](const fake_supervisor& s) { return s.ready_received() >= count; }, std::chrono::seconds(15));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));  // 等待 SUPERVISOR READY 到达 worker
+    return ready;
+}
+
+///
+/// 批量发送时，ROOM FAILED 不能越过之前加入批次的同一房间的数据
+void test_room_failed_after_batch(supervisor_session& session, fake_supervisor& supervisor)
+{
+    const size_t count = 50;
+    supervisor.take_packets();
+    for (size_t i = 0; i < count; i++)
+    {
+        numbered_message message(i, 100, "x");
+        session.on_message(test_room, &message);
+    }
+    session.on_room_failed(test_room);
+    CHECK(supervisor.wait([](const fake_supervisor& s) {
+        return !s.packets().empty() && s.packets().back().op_code == room_failed_code;
+    }, std::chrono::seconds(5)));
+
+    auto packets = supervisor.take_packets();
+    CHECK(packets.size() == count + 1);
+    size_t data_before_failed = 0;
+    for (auto& packet : packets)
+    {
+        if (packet.op_code == room_failed_code)
+            break;
+        data_before_failed++;
+    }
+    CHECK(data_before_failed == count);
+}
+///
+/// 与 supervisor 断开时暂停读取房间，重新连接并收到 SUPERVISOR READY 后恢复
+void test_pause_while_disconnected(supervisor_session& session, fake_supervisor& supervisor, std::atomic<bool>& paused)
+{
+    auto connections = supervisor.connections();
+    CHECK(!session.write_queue_above_high_water());
+    supervisor.disconnect();
+    CHECK(poll([&]() { return paused.load(); }, std::chrono::seconds(5)));
+    CHECK(session.write_queue_above_high_water());
+
+    CHECK(supervisor.wait([connections](const fake_supervisor& s) { return s.connections() > connections; }, std::chrono::seconds(10)));
+    CHECK(poll([&]() { return !session.write_queue_above_high_water(); }, std::chrono::seconds(5)));
+    CHECK(!paused.load());
+}
+
+///
+/// 批次还没有发出时断开，断开期间继续产生数据：重新连接后 supervisor 收到的数据不缺不乱
+void test_disconnect_mid_batch(supervisor_session& session, fake_supervisor& supervisor, std::atomic<bool>& paused)
+{
+    const size_t per_phase = 10;
+    auto connections = supervisor.connections();
+    supervisor.take_packets();
+    size_t sequence = 0;
+    auto send = [&]() {
+        for (auto end = sequence + per_phase; sequence < end; sequence++)
+        {
+            numbered_message message(sequence, 100, "x");
+            session.on_message(test_room, &message);
+        }
+    };
+
+    send();  // batch-delay-us 为 200ms，断开时还在批次中
+    supervisor.disconnect();
+    CHECK(poll([&]() { return paused.load(); }, std::chrono::seconds(5)));
+    send();  // 断开期间
+    CHECK(supervisor.wait([connections](const fake_supervisor& s) { return s.connections() > connections; }, std::chrono::seconds(10)));
+    CHECK(poll([&]() { return !paused.load(); }, std::chrono::seconds(5)));
+    send();  // 重新连接之后
+
+    CHECK(supervisor.wait([](const fake_supervisor& s) { return s.packets().size() >= per_phase * 3; }, std::chrono::seconds(5)));
+    auto packets = supervisor.take_packets();
+    CHECK(packets.size() == per_phase * 3);
+    auto gap_free = true;
+    for (size_t i = 0; i < packets.size(); i++)
+        gap_free = gap_free && packets[i].room_id == test_room && sequence_of(packets[i]) == i;
+    CHECK(gap_free);
+}
+
+///
+/// 压缩打开时写出队列超过丢弃限制：丢弃的只能是整条消息，压缩流不能断，supervisor 仍然能解压之后的数据
+void test_drop_with_compression(supervisor_session& session, fake_supervisor& supervisor)
+{
+    const size_t count = 20000;
+    const size_t size = 1024;
+    // 随机内容几乎不能压缩，队列按原始大小增长
+    std::mt19937 random(1);
+    std::string noise(64 * 1024, '\0');
+    for (auto& ch : noise)
+        ch = static_cast<char>(random());
+
+    supervisor.pause_reading();
+    for (size_t i = 0; i < count; i++)
+    {
+        numbered_message message(i, size, noise.substr((i * 131) % (noise.size() - size), size));
+        session.on_message(test_room, &message);
+    }
+    supervisor.resume_reading();
+
+    auto drained = false;
+    for (int i = 0; i < 200 && !drained; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        drained = !session.write_queue_above_high_water();
+    }
+    CHECK(drained);
+    numbered_message last(count, size, "x");
+    session.on_message(test_room, &last);
+    CHECK(supervisor.wait([](const fake_supervisor& s) {
+        return s.inflate_errors() > 0 || (!s.packets().empty() && sequence_of(s.packets().back()) == count);
+    }, std::chrono::seconds(10)));
+
+    CHECK(supervisor.inflate_errors() == 0);
+    auto packets = supervisor.take_packets();
+    CHECK(packets.size() > 1 && packets.size() < count + 1);  // 丢弃了一部分，但连接没有断开
+    auto ordered = true;
+    for (size_t i = 1; i < packets.size(); i++)
+        ordered = ordered && sequence_of(packets[i - 1]) < sequence_of(packets[i]);
+    CHECK(ordered);
+    CHECK(supervisor.connections() == 1);
+}
+}  // namespace
+
+int main()
+{
+    fake_supervisor supervisor(capability_data_batch | capability_link_compression);
+    supervisor_session session(
+        make_config(supervisor.port(), {"--batch-delay-us=200000", "--link-compression=true"}),
+        [](int) {}, [](int) {}, []() {}, []() { return std::vector<room_id_t>(); });
+    std::atomic<bool> paused{false};  // 最近一次回调的参数
+    session.set_watermark_handler([&paused](bool above_high_water) { paused = above_high_water; });
+    CHECK(wait_ready(supervisor, 1));
+
+    test_room_failed_after_batch(session, supervisor);
+    test_pause_while_disconnected(session, supervisor, paused);
+    test_disconnect_mid_batch(session, supervisor, paused);
+
+    {
+        fake_supervisor small_queue_supervisor(capability_link_compression);
+        supervisor_session small_queue_session(
+            make_config(small_queue_supervisor.port(), {"--batch-size=0", "--link-compression=true", "--supervisor-write-high-water=65536"}),
+            [](int) {}, [](int) {}, []() {}, []() { return std::vector<room_id_t>(); });
+        CHECK(wait_ready(small_queue_supervisor, 1));
+        test_drop_with_compression(small_queue_session, small_queue_supervisor);
+    }
+
+    if (failures)
+        std::fprintf(stderr, "%d check(s) failed.\n", failures);
+    else
+        std::printf("All checks passed.\n");
+    return failures ? 1 : 0;
+}